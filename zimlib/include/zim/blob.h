@@ -30,7 +30,9 @@ namespace zim
   {
       const char* _data;
       unsigned _size;
-      SmartPtr<ClusterImpl> _cluster;
+      // keeps the memory alive, _data points to; this is the cluster or
+      // a buffer holding just the blob
+      SmartPtr<RefCounted> _owner;
 
     public:
       Blob()
@@ -42,10 +44,10 @@ namespace zim
           _size(size)
           { }
 
-      Blob(ClusterImpl* cluster, const char* data, unsigned size)
+      Blob(RefCounted* owner, const char* data, unsigned size)
         : _data(data),
           _size(size),
-          _cluster(cluster)
+          _owner(owner)
           { }
 
       const char* data() const  { return _data; }
@@ -42,6 +42,7 @@ namespace zim
       char_type* iobuffer;
       unsigned bufsize;
       std::streambuf* sinksource;
+      bool small;
 
       char_type* ibuffer()            { return iobuffer; }
       std::streamsize ibuffer_size()  { return bufsize >> 1; }
@@ -60,6 +61,10 @@ namespace zim
       int sync();
 
       void setSinksource(std::streambuf* sinksource_)   { sinksource = sinksource_; }
+
+      /// Prepares the decoder for a new stream read from sinksource. The
+      /// i/o buffer is reused.
+      void reset(std::streambuf* sinksource_);
   };
 
   class Bunzip2Stream : public std::iostream
@@ -80,6 +85,9 @@ namespace zim
       void setSinksource(std::ios& sinksource)         { streambuf.setSinksource(sinksource.rdbuf()); }
       void setSink(std::ostream& sink)                 { streambuf.setSinksource(sink.rdbuf()); }
       void setSource(std::istream& source)             { streambuf.setSinksource(source.rdbuf()); }
+
+      /// Starts decompressing a new stream from source.
+      void reset(std::istream& source)                 { streambuf.reset(source.rdbuf()); clear(); }
   };
 }
 
@@ -20,10 +20,17 @@
 #ifndef ZIM_CACHE_H
 #define ZIM_CACHE_H
 
-#include <map>
-#include <limits>
+#include <list>
+#include <cstddef>
+#include <utility>
 #include <iostream>
 
+#if __cplusplus >= 201103L
+#include <unordered_map>
+#else
+#include <tr1/unordered_map>
+#endif
+
 #ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
@@ -33,6 +40,20 @@
 
 namespace zim
 {
+  /// replacement strategies of zim::Cache
+  enum CachePolicy
+  {
+    /// Keeps elements, which are fetched more than once, in a protected
+    /// "winner" segment; new elements start as "loosers". A scan of
+    /// elements, which are used only once, do not flush the winners.
+    CACHE_WINNER,
+    /// Plain least recently used.
+    CACHE_LRU,
+    /// Second chance (clock) algorithm. A hit only sets a flag, so
+    /// lookups do not need to reorder the list.
+    CACHE_CLOCK
+  };
+
   /**
      Implements a container for caching elements.
 
@@ -45,24 +66,29 @@ namespace zim
      The cache has a maximum size, after which key-value-pairs are dropped,
      when a new item is put into the cache.
 
-     The algorithm for this cache is as follows:
+     The default algorithm (CACHE_WINNER) for this cache is as follows:
        - when the cache is not full, new elements are appended
        - new elements are put into the middle of the list otherwise
        - the last element of the list is then dropped
        - when getting a value and the value is found, it is put to the
          beginning of the list
 
-     When elements are searched, a linear search is done using the ==-operator
-     of the key type.
-
      The caching algorithm keeps elements, which are fetched more than once in
      the first half of the list. In the second half the elements are either new
      or the elements are pushed from the first half to the second half by other
      elements, which are found in the cache.
 
-     You should be aware, that the key type should be simple. Comparing keys
-     must be cheap. Copying elements (both key and value) must be possible and
-     should be cheap, since they are moved in the underlying container.
+     Elements are found through a hash index and the halves are kept as
+     linked lists, so put, get and dropping an element take constant time
+     regardless of the cache size. The key type must be hashable with
+     std::hash (or std::tr1::hash on older compilers).
+
+     Copying elements (both key and value) must be possible. Values are
+     copied once when put into the cache and are not moved afterwards.
+
+     Each element may be given a cost when put into the cache, e.g. its size
+     in bytes. The maximum size of the cache then limits the sum of the costs
+     rather than the number of elements. By default each element costs 1.
 
    */
   template <typename Key, typename Value>
@@ -70,150 +96,258 @@ namespace zim
   {
       struct Data
       {
-        bool winner;
-        unsigned serial;
+        Key key;
         Value value;
-        Data() { }
-        Data(bool winner_, unsigned serial_, const Value& value_)
-          : winner(winner_),
-            serial(serial_),
-            value(value_)
+        std::size_t cost;
+        bool winner;
+        bool referenced;
+        Data(const Key& key_, const Value& value_, std::size_t cost_, bool winner_)
+          : key(key_),
+            value(value_),
+            cost(cost_),
+            winner(winner_),
+            referenced(false)
             { }
       };
 
-      typedef std::map<Key, Data> DataType;
-      DataType data;
+      typedef std::list<Data> ListType;
+      typedef typename ListType::iterator ListIterator;
+
+#if __cplusplus >= 201103L
+      typedef std::unordered_map<Key, ListIterator> IndexType;
+#else
+      typedef std::tr1::unordered_map<Key, ListIterator> IndexType;
+#endif
+
+      // Most recently used elements are at the front of the lists. The
+      // lru and clock policies use only the list of loosers.
+      ListType winners;
+      ListType loosers;
+      IndexType index;
+
+      // clock hand; points into loosers or to loosers.end()
+      ListIterator hand;
 
-      typename DataType::size_type maxElements;
-      unsigned serial;
+      CachePolicy policy;
+      typename IndexType::size_type maxElements;
+      typename IndexType::size_type totalCost;
+      typename IndexType::size_type winnerCost;
       unsigned hits;
       unsigned misses;
 
-      unsigned _nextSerial()
+      // the index points into the own lists, so a cache can't be copied
+      Cache(const Cache&);
+      Cache& operator=(const Cache&);
+
+      // drop one element
+      void _dropLooser()
       {
-        if (serial == std::numeric_limits<unsigned>::max())
+        if (policy == CACHE_CLOCK)
         {
-          for (typename DataType::iterator it = data.begin(); it != data.end(); ++it)
-            it->second.serial = 0;
-          serial = 1;
+          // give referenced elements a second chance
+          while (true)
+          {
+            if (hand == loosers.end())
+              hand = loosers.begin();
+            if (!hand->referenced)
+              break;
+            hand->referenced = false;
+            ++hand;
+          }
+
+          totalCost -= hand->cost;
+          index.erase(hand->key);
+          hand = loosers.erase(hand);
+          return;
         }
 
-        return serial++;
+        // drop the oldest element in the list of loosers
+        ListType& l = loosers.empty() ? winners : loosers;
+        totalCost -= l.back().cost;
+        if (l.back().winner)
+          winnerCost -= l.back().cost;
+        index.erase(l.back().key);
+        l.pop_back();
       }
 
-      typename DataType::iterator _getOldest(bool winner)
+      void _makeLooser()
       {
-        typename DataType::iterator foundElement = data.begin();
-
-        typename DataType::iterator it = data.begin();
-
-        for (++it; it != data.end(); ++it)
-          if (it->second.winner == winner
-            && (foundElement->second.winner != winner || it->second.serial < foundElement->second.serial))
-              foundElement = it;
+        // move the oldest winner to the top of the loosers
+        if (winners.empty())
+          return;
+        winners.back().winner = false;
+        winnerCost -= winners.back().cost;
+        loosers.splice(loosers.begin(), winners, --winners.end());
+      }
 
-        return foundElement;
+      void _balanceWinners()
+      {
+        // the most recent winner stays, even if it exceeds the half alone
+        while (winnerCost > maxElements / 2 && winners.size() > 1)
+          _makeLooser();
       }
 
-      typename DataType::iterator _getNewest(bool winner)
+      void _makeWinner(ListIterator it)
       {
-        typename DataType::iterator foundElement = data.begin();
+        if (it->winner)
+          winners.splice(winners.begin(), winners, it);
+        else
+        {
+          // move element to the winner part
+          it->winner = true;
+          winnerCost += it->cost;
+          winners.splice(winners.begin(), loosers, it);
+          _balanceWinners();
+        }
+      }
 
-        typename DataType::iterator it = data.begin();
+      void _touch(ListIterator it)
+      {
+        switch (policy)
+        {
+          case CACHE_WINNER:
+            _makeWinner(it);
+            break;
 
-        for (++it; it != data.end(); ++it)
-          if (it->second.winner == winner
-            && (foundElement->second.winner != winner || it->second.serial > foundElement->second.serial))
-              foundElement = it;
+          case CACHE_LRU:
+            loosers.splice(loosers.begin(), loosers, it);
+            break;
 
-        return foundElement;
+          case CACHE_CLOCK:
+            it->referenced = true;
+            break;
+        }
       }
 
-      // drop one element
-      void _dropLooser()
+      void _insert(const Key& key, const Value& value, std::size_t cost, bool top)
       {
-        // look for the oldest element in the list of loosers to drop it
-        data.erase(_getOldest(false));
+        while (totalCost + cost > maxElements)
+          _dropLooser();
+
+        ListIterator it;
+        if (policy == CACHE_WINNER && (top || winnerCost + cost <= maxElements / 2))
+        {
+          winners.push_front(Data(key, value, cost, true));
+          it = winners.begin();
+          winnerCost += cost;
+          _balanceWinners();
+        }
+        else if (policy == CACHE_CLOCK)
+        {
+          // insert behind the hand, so that the new element is the last
+          // one visited
+          it = loosers.insert(hand, Data(key, value, cost, false));
+          it->referenced = top;
+        }
+        else
+        {
+          loosers.push_front(Data(key, value, cost, false));
+          it = loosers.begin();
+        }
+
+        totalCost += cost;
+        index.insert(typename IndexType::value_type(key, it));
       }
 
-      void _makeLooser()
+      void _put(const Key& key, const Value& value, std::size_t cost, bool top)
       {
-        // look for the oldest element in the list of winners to make it a looser
-        typename DataType::iterator it = _getOldest(true);
-        it->second.winner = false;
-        it->second.serial = _nextSerial();
+        // elements larger than the whole cache are not cached
+        if (cost > maxElements)
+          return;
+
+        typename IndexType::iterator it = index.find(key);
+        if (it == index.end())
+          _insert(key, value, cost, top);
+        else
+          // element found
+          _touch(it->second);
       }
 
     public:
-      typedef typename DataType::size_type size_type;
+      typedef typename IndexType::size_type size_type;
       typedef Value value_type;
 
-      explicit Cache(size_type maxElements_)
-        : maxElements(maxElements_ + (maxElements_ & 1)),
-          serial(0),
+      explicit Cache(size_type maxElements_, CachePolicy policy_ = CACHE_WINNER)
+        : hand(loosers.end()),
+          policy(policy_),
+          maxElements(maxElements_ + (maxElements_ & 1)),
+          totalCost(0),
+          winnerCost(0),
           hits(0),
           misses(0)
         { }
 
       /// returns the number of elements currently in the cache
-      size_type size() const        { return data.size(); }
+      size_type size() const        { return index.size(); }
 
-      /// returns the maximum number of elements in the cache
+      /// returns the maximum number of elements in the cache or the maximum
+      /// sum of costs, when elements are put with a cost
       size_type getMaxElements() const      { return maxElements; }
 
-      void setMaxElements(size_type maxElements_)
-      {
-        size_type numWinners = size() < maxElements / 2 ? size() : maxElements / 2;
+      /// returns the sum of the costs of the elements currently in the cache
+      size_type getCost() const     { return totalCost; }
 
-        maxElements_ += (maxElements_ & 1);
+      /// returns the replacement strategy
+      CachePolicy getPolicy() const  { return policy; }
 
-        if (maxElements_ > maxElements)
-        {
-          maxElements = maxElements_;
+      void setMaxElements(size_type maxElements_)
+      {
+        maxElements = maxElements_ + (maxElements_ & 1);
 
-          while (numWinners < maxElements / 2)
-          {
-            _getNewest(false)->winner = true;
-            ++numWinners;
-          }
-        }
-        else
-        {
-          while (maxElements > maxElements_)
-          {
-            _dropLooser();
-            _dropLooser();
-            _makeLooser();
-            maxElements -= 2;
-          }
+        while (totalCost > maxElements)
+          _dropLooser();
 
-          while (numWinners > maxElements / 2)
-          {
-            _getNewest(true)->winner = false;
-            --numWinners;
-          }
-        }
+        _balanceWinners();
+      }
 
+      /// returns true, if the key is in the cache; does not count as a hit
+      /// or miss and does not change the order of the elements
+      bool contains(const Key& key) const
+      {
+        return index.find(key) != index.end();
       }
 
       /// removes a element from the cache and returns true, if found
       bool erase(const Key& key)
       {
-        typename DataType::iterator it = data.find(key);
-        if (it == data.end())
+        typename IndexType::iterator it = index.find(key);
+        if (it == index.end())
           return false;
 
-        if (it->second.winner)
-          _getNewest(false)->winner=true;
+        ListIterator e = it->second;
+        index.erase(it);
+        totalCost -= e->cost;
+
+        if (e->winner)
+        {
+          winnerCost -= e->cost;
+          winners.erase(e);
+          if (!loosers.empty() && winnerCost + loosers.front().cost <= maxElements / 2)
+          {
+            // keep the winner half filled
+            loosers.front().winner = true;
+            winnerCost += loosers.front().cost;
+            winners.splice(winners.end(), loosers, loosers.begin());
+          }
+        }
+        else
+        {
+          if (e == hand)
+            ++hand;
+          loosers.erase(e);
+        }
 
-        data.erase(it);
         return true;
       }
 
       /// clears the cache.
       void clear(bool stats = false)
       {
-        data.clear();
+        index.clear();
+        winners.clear();
+        loosers.clear();
+        hand = loosers.end();
+        totalCost = winnerCost = 0;
         if (stats)
           hits = misses = 0;
       }
@@ -221,90 +355,32 @@ namespace zim
       /// puts a new element in the cache. If the element is already found in
       /// the cache, it is considered a cache hit and pushed to the top of the
       /// list.
-      void put(const Key& key, const Value& value)
+      void put(const Key& key, const Value& value, std::size_t cost = 1)
       {
-        typename DataType::iterator it;
-        if (data.size() < maxElements)
-        {
-          data.insert(data.begin(),
-            typename DataType::value_type(key,
-              Data(data.size() < maxElements / 2, _nextSerial(), value)));
-        }
-        else if ((it = data.find(key)) == data.end())
-        {
-          // element not found
-          _dropLooser();
-          data.insert(data.begin(),
-            typename DataType::value_type(key,
-              Data(false, _nextSerial(), value)));
-        }
-        else
-        {
-          // element found
-          it->second.serial = _nextSerial();
-          if (!it->second.winner)
-          {
-            // move element to the winner part
-            it->second.winner = true;
-            _makeLooser();
-          }
-        }
+        _put(key, value, cost, false);
       }
 
       /// puts a new element on the top of the cache. If the element is already
       /// found in the cache, it is considered a cache hit and pushed to the
       /// top of the list. This method actually overrides the need, that a element
       /// needs a hit to get to the top of the cache.
-      void put_top(const Key& key, const Value& value)
+      void put_top(const Key& key, const Value& value, std::size_t cost = 1)
       {
-        typename DataType::iterator it;
-        if (data.size() < maxElements)
-        {
-          if (data.size() >= maxElements / 2)
-            _makeLooser();
-
-          data.insert(data.begin(),
-            typename DataType::value_type(key,
-              Data(true, _nextSerial(), value)));
-        }
-        else if ((it = data.find(key)) == data.end())
-        {
-          // element not found
-          _dropLooser();
-          _makeLooser();
-          data.insert(data.begin(),
-            typename DataType::value_type(key,
-              Data(true, _nextSerial(), value)));
-        }
-        else
-        {
-          // element found
-          it->second.serial = _nextSerial();
-          if (!it->second.winner)
-          {
-            // move element to the winner part
-            it->second.winner = true;
-            _makeLooser();
-          }
-        }
+        _put(key, value, cost, true);
       }
 
       Value* getptr(const Key& key)
       {
-        typename DataType::iterator it = data.find(key);
-        if (it == data.end())
-          return 0;
-
-        it->second.serial = _nextSerial();
-
-        if (!it->second.winner)
+        typename IndexType::iterator it = index.find(key);
+        if (it == index.end())
         {
-          // move element to the winner part
-          it->second.winner = true;
-          _makeLooser();
+          ++misses;
+          return 0;
         }
 
-        return &it->second.value;
+        ++hits;
+        _touch(it->second);
+        return &it->second->value;
       }
 
       /// returns a pair of values - a flag, if the value was found and the
@@ -332,16 +408,16 @@ namespace zim
       /// returns the cache hit ratio between 0 and 1.
       double hitRatio() const     { return hits+misses > 0 ? static_cast<double>(hits)/static_cast<double>(hits+misses) : 0; }
       /// returns the ratio, between held elements and maximum elements.
-      double fillfactor() const   { return static_cast<double>(data.size()) / static_cast<double>(maxElements); }
+      double fillfactor() const   { return maxElements > 0 ? static_cast<double>(totalCost) / static_cast<double>(maxElements) : 0; }
 
 /*
       void dump(std::ostream& out) const
       {
         out << "cache max size=" << maxElements << " current size=" << size() << '\n';
-        for (typename DataType::const_iterator it = data.begin(); it != data.end(); ++it)
-        {
-          out << "\tkey=\"" << it->first << "\" value=\"" << it->second.value << "\" serial=" << it->second.serial << " winner=" << it->second.winner << '\n';
-        }
+        for (typename ListType::const_iterator it = winners.begin(); it != winners.end(); ++it)
+          out << "\tkey=\"" << it->key << "\" value=\"" << it->value << "\" winner\n";
+        for (typename ListType::const_iterator it = loosers.begin(); it != loosers.end(); ++it)
+          out << "\tkey=\"" << it->key << "\" value=\"" << it->value << "\" referenced=" << it->referenced << '\n';
         out << "--------\n";
       }
 */
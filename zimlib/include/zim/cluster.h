@@ -24,6 +24,9 @@
 #include <zim/refcounted.h>
 #include <zim/smartptr.h>
 #include <zim/fstream.h>
+#include <zim/filecompound.h>
+#include <zim/mutex.h>
+#include <zim/dictionary.h>
 #include <iosfwd>
 #include <vector>
 
@@ -44,45 +47,97 @@ namespace zim
       Data _data;
       offset_type startOffset;
 
-      ifstream* lazy_read_stream;
+      // compression dictionary used for reading and writing, if any
+      SmartPtr<Dictionary> dictionary;
+
+      // uncompressed data is read on first access from lazy_read_file
+      SmartPtr<FileCompound> lazy_read_file;
+      bool lazy_read;
+      mutable Mutex lazy_read_mutex;
+
+      // A partially decompressed cluster keeps its decompressor. _data has
+      // the full size, but only the first `decoded` bytes are valid; more
+      // are decompressed, when a later blob is requested.
+      SmartPtr<FileCompound> decoder_file;
+      std::istream* decoder_source;
+      std::istream* decoder;
+      size_type decoded;
+
+      // uncompressed data of a memory mapped file is not copied but read
+      // directly from the mapping, which is kept alive by the cluster
+      SmartPtr<FileCompound> mappedFile;
+      const char* mappedData;
+
+      // A framed cluster is compressed in independent frames of frameSize
+      // uncompressed bytes. _data has the full size, but a frame is only
+      // decompressed, when a blob in it is requested. frameEnds are the
+      // ends of the compressed frames relative to frameOffset.
+      size_type frameSize;
+      SmartPtr<FileCompound> frame_file;
+      const char* frameData;
+      offset_type frameOffset;
+      std::vector<size_type> frameEnds;
+      std::vector<bool> frameDecoded;
+      size_type headerSize;
 
       offset_type read_header(std::istream& in);
       void read_content(std::istream& in);
+      void read_compressed(std::istream& in);
+      void read_block(const char* src, size_type size);
+      void start_decoder(FileCompound* file, std::istream* source);
       void write(std::ostream& out) const;
-
-      void set_lazy_read(ifstream* in) {
-        lazy_read_stream = in;
+      void write_compressed(std::ostream& out, const char* data = 0, size_type size = 0) const;
+      void write_framed(std::ostream& out) const;
+
+      void init_frames(FileCompound* file, offset_type offset, const char* p, offset_type size);
+      size_type decode_frame(size_type n, char* dest, size_type size);
+      void read_frames(size_type begin, size_type end);
+      void read_data(size_type end);
+      void ensure_data(size_type begin, size_type end) const {
+        if (frame_file)
+          const_cast<ClusterImpl*>(this)->read_frames(begin, end);
+        else if (lazy_read_file || decoder_file)
+          const_cast<ClusterImpl*>(this)->read_data(end);
       }
-
-      bool is_fully_initialised() const { return lazy_read_stream == 0; }
-      void finalise_read();
       const Data& data() const {
-        if ( !is_fully_initialised() )
-        {
-           const_cast<ClusterImpl*>(this)->finalise_read();
-        }
+        ensure_data(0, offsets.back());
         return _data;
       }
 
     public:
       ClusterImpl();
+      ~ClusterImpl();
 
       void setCompression(CompressionType c)   { compression = c; }
       CompressionType getCompression() const   { return compression; }
-      bool isCompressed() const                { return compression == zimcompZip || compression == zimcompBzip2 || compression == zimcompLzma; }
+      bool isCompressed() const                { return compression == zimcompZip || compression == zimcompBzip2 || compression == zimcompLzma || compression == zimcompZstd || compression == zimcompLz4; }
 
       size_type getCount() const               { return offsets.size() - 1; }
-      const char* getData(unsigned n) const    { return &data()[ offsets[n] ]; }
+      const char* getData(unsigned n) const
+      {
+        if (mappedData)
+          return mappedData + offsets[n];
+        ensure_data(offsets[n], offsets[n+1]);
+        return &_data[ offsets[n] ];
+      }
       size_type getSize(unsigned n) const      { return offsets[n+1] - offsets[n]; }
-      size_type getSize() const                { return offsets.size() * sizeof(size_type) + data().size(); }
+      size_type getSize() const                { return offsets.size() * sizeof(size_type) + offsets.back(); }
       offset_type getOffset(size_type n) const { return startOffset + offsets[n]; }
       Blob getBlob(size_type n) const;
       void clear();
 
+      void setDictionary(Dictionary* d)        { dictionary = d; }
+      const Dictionary* getDictionary() const  { return dictionary; }
+
+      void setFrameSize(size_type s)           { frameSize = s; }
+      size_type getFrameSize() const           { return frameSize; }
+
       void addBlob(const Blob& blob);
       void addBlob(const char* data, unsigned size);
 
       void init_from_stream(ifstream& in, offset_type offset);
+      void init_from_file(FileCompound* file, offset_type offset, offset_type size, bool partial,
+                          Dictionary* dictionary);
   };
 
   class Cluster
@@ -101,13 +156,27 @@ namespace zim
       bool isCompressed() const
         { return impl && (impl->getCompression() == zimcompZip
                        || impl->getCompression() == zimcompBzip2
-                       || impl->getCompression() == zimcompLzma); }
+                       || impl->getCompression() == zimcompLzma
+                       || impl->getCompression() == zimcompZstd
+                       || impl->getCompression() == zimcompLz4); }
 
       const char* getBlobPtr(size_type n) const     { return impl->getData(n); }
       size_type getBlobSize(size_type n) const      { return impl->getSize(n); }
       offset_type getBlobOffset(size_type n) const  { return impl->getOffset(n); }
       Blob getBlob(size_type n) const;
 
+      /// Sets the dictionary, with which the cluster is compressed, when
+      /// written with zstd. It is kept, when the cluster is cleared.
+      void setDictionary(Dictionary* d)     { getImpl()->setDictionary(d); }
+      const Dictionary* getDictionary() const  { return impl ? impl->getDictionary() : 0; }
+
+      /// Sets the size of the frames, in which a compressed cluster is
+      /// written; 0 writes it as one stream. The frames are compressed
+      /// independently, so that reading a blob decompresses only the frames
+      /// it is in. It is kept, when the cluster is cleared.
+      void setFrameSize(size_type s)        { getImpl()->setFrameSize(s); }
+      size_type getFrameSize() const        { return impl ? impl->getFrameSize() : 0; }
+
       size_type count() const   { return impl ? impl->getCount() : 0; }
       size_type size() const    { return impl ? impl->getSize(): sizeof(size_type); }
       void clear()              { if (impl) impl->clear(); }
@@ -118,6 +187,25 @@ namespace zim
       operator bool() const   { return impl; }
 
       void init_from_stream(ifstream& in, offset_type offset);
+
+      /// Initializes the cluster from the file at the given offset. The
+      /// size of the cluster may be 0, if not known. When the cluster is
+      /// located in a mapped region of the file, it is parsed from the
+      /// mapping and uncompressed data is not copied. Otherwise data is read
+      /// using positional reads, so that the file may be shared between
+      /// threads.
+      ///
+      /// When the size is known, a compressed cluster is read in one go and
+      /// decompressed directly into the cluster buffer.
+      ///
+      /// When partial is set, a compressed cluster is only decompressed up
+      /// to the blob requested, and further when a later blob is requested.
+      /// The decompressor is kept with the cluster until all data is read.
+      ///
+      /// Clusters compressed with a dictionary are decompressed with the
+      /// dictionary passed.
+      void init_from_file(FileCompound* file, offset_type offset, offset_type size = 0,
+                          bool partial = false, Dictionary* dictionary = 0);
   };
 
   std::ostream& operator<< (std::ostream& out, const ClusterImpl& blobImpl);
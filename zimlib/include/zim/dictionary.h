@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_DICTIONARY_H
+#define ZIM_DICTIONARY_H
+
+#include <zim/zim.h>
+#include <zim/refcounted.h>
+#include <string>
+#include <vector>
+
+namespace zim
+{
+  /**
+     A compression dictionary shared by the clusters of a file.
+
+     Small clusters compress poorly, since each compressed stream starts
+     with an empty window. The writer trains a dictionary over sampled
+     articles and stores it in the metadata article M/ZstdDictionary. zstd
+     clusters compressed with it reference the dictionary by the id in
+     their frame header; the reader loads it once per file.
+   */
+  class Dictionary : public RefCounted
+  {
+      std::vector<char> data;
+      void* zstdDDict;
+
+    public:
+      static const char ns = 'M';
+      static const char* const url;
+
+      Dictionary(const char* data, size_type size);
+      ~Dictionary();
+
+      const char* getData() const   { return data.empty() ? 0 : &data[0]; }
+      size_type getSize() const     { return data.size(); }
+
+      /// Returns the id of a zstd dictionary or 0.
+      unsigned getId() const;
+
+      /// Returns the digested dictionary for the zstd decoder (ZSTD_DDict).
+      const void* getZstdDDict() const  { return zstdDDict; }
+
+      /// Trains a dictionary of at most maxSize bytes from the samples,
+      /// which are concatenated in data. Returns 0, if there are not
+      /// enough samples or zstd is not enabled.
+      static Dictionary* train(const std::string& samples,
+                               const std::vector<size_type>& sampleSizes,
+                               size_type maxSize);
+  };
+}
+
+#endif // ZIM_DICTIONARY_H
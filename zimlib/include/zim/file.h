@@ -21,6 +21,7 @@
 #define ZIM_FILE_H
 
 #include <string>
+#include <vector>
 #include <iterator>
 #include <zim/zim.h>
 #include <zim/fileimpl.h>
@@ -31,6 +32,14 @@ namespace zim
 {
   class Article;
 
+  /// Receives the articles visited by File::forEachArticleByCluster.
+  class ArticleVisitor
+  {
+    public:
+      virtual ~ArticleVisitor()  { }
+      virtual void visit(const Article& article, const Blob& data) = 0;
+  };
+
   class File
   {
       SmartPtr<FileImpl> impl;
@@ -38,13 +47,54 @@ namespace zim
     public:
       File()
         { }
-      explicit File(const std::string& fname)
-        : impl(new FileImpl(fname.c_str()))
+      /// Opens a zim file. When mmap is set, the file is mapped into memory
+      /// and index lookups and uncompressed data are read directly from
+      /// the mapping. The environment variable ZIM_MMAP overrides the flag.
+      explicit File(const std::string& fname, bool mmap = false)
+        : impl(new FileImpl(fname.c_str(), mmap))
         { }
 
       const std::string& getFilename() const   { return impl->getFilename(); }
       const Fileheader& getFileheader() const  { return impl->getFileheader(); }
       offset_type getFilesize() const          { return impl->getFilesize(); }
+      bool isMapped() const                    { return impl->isMapped(); }
+
+      /// Limits the memory used for cached uncompressed clusters. Clusters
+      /// are dropped from the cache until the sum of their sizes fits into
+      /// the given number of bytes. The initial value is taken from
+      /// ZIM_CLUSTERCACHESIZE (e.g. "512M") or the build default. Sizes
+      /// beyond the address space are clamped. The deprecated
+      /// ZIM_CLUSTERCACHE, a number of clusters, is still read as that
+      /// many megabytes.
+      void setClusterCacheSize(offset_type bytes)  { impl->setClusterCacheSize(bytes); }
+      /// returns the maximum memory used for cached clusters in bytes.
+      offset_type getClusterCacheSize() const      { return impl->getClusterCacheSize(); }
+      /// returns the memory currently used for cached clusters in bytes.
+      offset_type getClusterCacheUsage() const     { return impl->getClusterCacheUsage(); }
+      /// returns the number of clusters read from the file so far.
+      size_type getClusterReads() const            { return impl->getClusterReads(); }
+
+      /// When set, compressed clusters are decompressed only up to the
+      /// requested blob and resumed, when a later blob is needed. This
+      /// lowers the latency for blobs at the start of a cluster, but a
+      /// cached cluster keeps its decompressor state until it is fully
+      /// read. The initial value is taken from ZIM_PARTIALDECOMPRESSION.
+      void setPartialDecompression(bool sw)        { impl->setPartialDecompression(sw); }
+
+      /// Reads and decompresses the cluster into the cache in a background
+      /// thread, so that a later access does not wait for it. The thread is
+      /// started with the first call.
+      void prefetch(size_type clusterIdx)          { impl->prefetch(clusterIdx); }
+      /// When set to n > 0, sequential access to clusters prefetches the
+      /// following n clusters and forEachArticleByCluster reads up to n
+      /// clusters ahead of the visitor. The initial value is taken from
+      /// ZIM_READAHEAD.
+      void setReadahead(unsigned clusters)         { impl->setReadahead(clusters); }
+      unsigned getReadahead() const                { return impl->getReadahead(); }
+      /// returns the number of clusters read ahead so far by prefetch hints,
+      /// readahead or scans.
+      size_type getPrefetchedClusters() const      { return impl->getPrefetched(); }
+      bool getPartialDecompression() const         { return impl->getPartialDecompression(); }
 
       Dirent getDirent(size_type idx)          { return impl->getDirent(idx); }
       Dirent getDirentByTitle(size_type idx)   { return impl->getDirentByTitle(idx); }
@@ -62,6 +112,31 @@ namespace zim
 
       Blob getBlob(size_type clusterIdx, size_type blobIdx)
         { return getCluster(clusterIdx).getBlob(blobIdx); }
+
+      /// Returns the data of the articles with the given indexes in the
+      /// same order. The articles are read grouped by cluster, so each
+      /// cluster is read once, even if it does not fit into the cache.
+      /// Redirects, link targets and deleted articles give an empty blob.
+      std::vector<Blob> getArticleData(const std::vector<size_type>& idx);
+
+      /// Passes all articles with data to the visitor in the order of their
+      /// clusters and blobs instead of url order. Each cluster is read once
+      /// and only the current cluster is kept, so a full scan decompresses
+      /// every cluster exactly once. The clusters bypass the cluster cache,
+      /// so a scan does not evict the clusters cached for other readers.
+      /// With readahead set, the next clusters are read in a background
+      /// thread and handed to the scan directly. Redirects, link targets
+      /// and deleted articles are skipped.
+      void forEachArticleByCluster(ArticleVisitor& visitor);
+
+      /// Like forEachArticleByCluster, but clusters are read and
+      /// decompressed by one thread per visitor. Each thread passes the
+      /// articles of the clusters it read to its own visitor, so visitors
+      /// may keep per thread state without locking. Within a cluster the
+      /// articles are visited in blob order. If a visitor or a read throws,
+      /// the remaining clusters are skipped and the error is rethrown as
+      /// std::runtime_error.
+      void parallelForEachArticle(const std::vector<ArticleVisitor*>& visitors);
       offset_type getOffset(size_type clusterIdx, size_type blobIdx);
 
       size_type getNamespaceBeginOffset(char ch)
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_FILECOMPOUND_H
+#define ZIM_FILECOMPOUND_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <zim/zim.h>
+#include <zim/refcounted.h>
+#ifdef _WIN32
+#include <zim/mutex.h>
+#endif
+
+namespace zim
+{
+  /**
+     A zim file, which may be split into several parts (.zimaa, .zimab, ...).
+
+     Each part is opened once. After calling map() each part is mapped into
+     memory separately, so that regions, which do not cross a part boundary,
+     can be accessed directly using getPtr() without any system call.
+
+     Reading does not change any state of the object: data is read with
+     positional reads (pread) or copied from the mapping, so a single
+     FileCompound may be used by many threads concurrently.
+   */
+  class FileCompound : public RefCounted
+  {
+      struct Part
+      {
+        std::string fname;
+        int fd;
+        offset_type offset;  // offset of this part in the compound
+        offset_type size;
+        char* addr;          // start of the mapped part or 0 if not mapped
+      };
+
+      typedef std::vector<Part> PartsType;
+      PartsType parts;
+      offset_type _fsize;
+      bool mapped;
+#ifdef _WIN32
+      mutable Mutex seekMutex;
+#endif
+
+      bool addPart(const std::string& fname);
+      const Part* findPart(offset_type off) const;
+
+    public:
+      explicit FileCompound(const std::string& fname);
+      ~FileCompound();
+
+      /// Maps all parts into memory. Returns false and leaves the file
+      /// unmapped, if the system is not able to map it.
+      bool map();
+      bool isMapped() const           { return mapped; }
+
+      offset_type fsize() const       { return _fsize; }
+      unsigned getCountParts() const  { return parts.size(); }
+      const std::string& getFilename() const  { return parts.front().fname; }
+      time_t getMTime() const;
+
+      /// Reads size bytes at offset off into dest. Throws an exception, when
+      /// not all bytes could be read.
+      void read(char* dest, offset_type off, offset_type size) const;
+
+      /// Returns a pointer to the mapped region [off, off+size) or 0, if the
+      /// file is not mapped or the region crosses a part boundary.
+      const char* getPtr(offset_type off, offset_type size) const;
+
+      /// Returns the number of bytes, which can be accessed directly from
+      /// getPtr(off, ...) on, i.e. the bytes up to the end of the part.
+      offset_type available(offset_type off) const;
+  };
+
+  /// A stream buffer reading sequentially from a FileCompound starting at a
+  /// given offset. It has its own position, so it is cheap to create one
+  /// per read operation.
+  class compoundstreambuf : public std::streambuf
+  {
+      const FileCompound& file;
+      offset_type pos;
+      std::vector<char> buffer;
+
+      std::streambuf::int_type underflow();
+
+    public:
+      compoundstreambuf(const FileCompound& file_, offset_type pos_, unsigned bufsize)
+        : file(file_),
+          pos(pos_),
+          buffer(bufsize)
+        { }
+  };
+
+  class compoundstream : public std::istream
+  {
+      compoundstreambuf streambuf;
+
+    public:
+      compoundstream(const FileCompound& file, offset_type pos, unsigned bufsize = 8192)
+        : std::istream(0),
+          streambuf(file, pos, bufsize)
+        { init(&streambuf); }
+  };
+
+}
+
+#endif // ZIM_FILECOMPOUND_H
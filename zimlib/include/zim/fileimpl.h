@@ -23,54 +23,128 @@
 #include <string>
 #include <vector>
 #include <map>
-#include <zim/fstream.h>
+#include <zim/filecompound.h>
+#include <zim/mutex.h>
 #include <zim/refcounted.h>
 #include <zim/zim.h>
 #include <zim/fileheader.h>
-#include <zim/cache.h>
+#include <zim/shardedcache.h>
 #include <zim/dirent.h>
 #include <zim/cluster.h>
+#include <zim/dictionary.h>
 
 namespace zim
 {
+  class ClusterPrefetcher;
+
   class FileImpl : public RefCounted
   {
-      ifstream zimFile;
+      SmartPtr<FileCompound> zimFile;
       Fileheader header;
       std::string filename;
 
-      Cache<size_type, Dirent> direntCache;
-      Cache<offset_type, Cluster> clusterCache;
+      // the dirent and cluster caches lock per segment; the cluster cache
+      // is limited by the size of the uncompressed clusters in bytes
+      ShardedCache<size_type, Dirent> direntCache;
+      ShardedCache<offset_type, Cluster> clusterCache;
       bool cacheUncompressedCluster;
+      bool partialDecompression;
+
+      // guards the namespace caches, so that a file can be shared between threads
+      Mutex cacheMutex;
       typedef std::map<char, size_type> NamespaceCache;
       NamespaceCache namespaceBeginCache;
       NamespaceCache namespaceEndCache;
 
       std::string namespaces;
 
+      // clusters currently read by some thread; other threads requesting
+      // the same cluster wait for the result instead of decompressing it
+      // again
+      struct ClusterLoad : public RefCounted
+      {
+        Cluster cluster;
+        bool done;
+        // the waiting threads get the error with the type of the reader's
+        // error: ZimFileFormatError or std::runtime_error
+        std::string error;
+        bool formatError;
+        ClusterLoad() : done(false), formatError(false) { }
+      };
+      typedef std::map<size_type, SmartPtr<ClusterLoad> > ClusterLoads;
+      ClusterLoads clusterLoads;
+      Mutex clusterLoadMutex;
+      Condition clusterLoadDone;
+      size_type clusterReads;
+
+      void failClusterLoad(size_type idx, ClusterLoad& load,
+                           const std::string& error, bool formatError);
+
+      Cluster loadCluster(size_type idx);
+
+      // the compression dictionary of the file is loaded with the first
+      // cluster read
+      SmartPtr<Dictionary> dictionary;
+      bool dictionaryLoaded;
+      Mutex dictionaryMutex;
+      Dictionary* loadDictionary();
+
+      // Reads clusters into the cache in a background thread. It is
+      // started with the first hint. With readahead set, getCluster
+      // detects sequential access and hints the following clusters.
+      friend class ClusterPrefetcher;
+      ClusterPrefetcher* prefetcher;
+      Mutex prefetchMutex;
+      unsigned readahead;
+      size_type lastCluster;
+      size_type prefetched;
+
       typedef std::vector<std::string> MimeTypes;
       MimeTypes mimeTypes;
 
       offset_type getOffset(offset_type ptrOffset, size_type idx);
+      offset_type getClusterSize(size_type idx);
 
     public:
-      explicit FileImpl(const char* fname);
+      explicit FileImpl(const char* fname, bool mmap = false);
+      ~FileImpl();
 
-      time_t getMTime() const   { return zimFile.getMTime(); }
+      time_t getMTime() const   { return zimFile->getMTime(); }
 
       const std::string& getFilename() const   { return filename; }
       const Fileheader& getFileheader() const  { return header; }
-      offset_type getFilesize() const          { return zimFile.fsize(); }
+      offset_type getFilesize() const          { return zimFile->fsize(); }
+      bool isMapped() const                    { return zimFile->isMapped(); }
+
+      void setClusterCacheSize(offset_type bytes);
+      offset_type getClusterCacheSize() const      { return clusterCache.getMaxElements(); }
+      offset_type getClusterCacheUsage() const     { return clusterCache.getCost(); }
+      size_type getClusterReads();
+
+      void prefetch(size_type idx);
+      void setReadahead(unsigned clusters)         { readahead = clusters; }
+      unsigned getReadahead() const                { return readahead; }
+      void addPrefetched();
+      size_type getPrefetched();
+
+      void setPartialDecompression(bool sw)        { partialDecompression = sw; }
+      bool getPartialDecompression() const         { return partialDecompression; }
 
       Dirent getDirent(size_type idx);
+      // reads a dirent without looking into or filling the cache
+      Dirent readDirent(size_type idx);
       Dirent getDirentByTitle(size_type idx);
       size_type getIndexByTitle(size_type idx);
       size_type getCountArticles() const       { return header.getArticleCount(); }
 
       Cluster getCluster(size_type idx);
+      // reads a cluster without looking into or filling the cache
+      Cluster readCluster(size_type idx);
       size_type getCountClusters() const       { return header.getClusterCount(); }
       offset_type getClusterOffset(size_type idx)   { return getOffset(header.getClusterPtrPos(), idx); }
 
+      Dictionary* getDictionary();
+
       size_type getNamespaceBeginOffset(char ch);
       size_type getNamespaceEndOffset(char ch);
       size_type getNamespaceCount(char ns)
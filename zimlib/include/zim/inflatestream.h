@@ -65,6 +65,10 @@ namespace zim
 
       void setSinksource(std::streambuf* sinksource_)   { sinksource = sinksource_; }
       uLong getAdler() const   { return stream.adler; }
+
+      /// Prepares the decoder for a new stream read from sinksource. The
+      /// allocated decoder state is reused.
+      void reset(std::streambuf* sinksource_);
   };
 
   class InflateStream : public std::iostream
@@ -86,6 +90,9 @@ namespace zim
       void setSink(std::ostream& sink)                 { streambuf.setSinksource(sink.rdbuf()); }
       void setSource(std::istream& source)             { streambuf.setSinksource(source.rdbuf()); }
       uLong getAdler() const   { return streambuf.getAdler(); }
+
+      /// Starts decompressing a new stream from source.
+      void reset(std::istream& source)                 { streambuf.reset(source.rdbuf()); clear(); }
   };
 }
 
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_LZ4STREAM_H
+#define ZIM_LZ4STREAM_H
+
+#include <iostream>
+#include <stdexcept>
+#include <lz4frame.h>
+#include <vector>
+
+namespace zim
+{
+  class Lz4Error : public std::runtime_error
+  {
+      size_t ret;
+
+    public:
+      Lz4Error(size_t ret_, const std::string& msg)
+        : std::runtime_error(msg),
+          ret(ret_)
+          { }
+
+      size_t getRetcode() const  { return ret; }
+  };
+
+  class Lz4StreamBuf : public std::streambuf
+  {
+      LZ4F_cctx* stream;
+      LZ4F_preferences_t prefs;
+      bool started;
+      std::vector<char_type> obuffer;
+      std::vector<char_type> zbuffer;
+      std::streambuf* sink;
+
+      bool begin();
+      bool compressBuffer();
+      bool writeSink(const char* data, size_t size);
+
+    public:
+      /// Levels above 2 select the slower lz4hc compressor, which
+      /// decompresses as fast as plain lz4.
+      explicit Lz4StreamBuf(std::streambuf* sink_, int level = 9, unsigned bufsize = 65536);
+      ~Lz4StreamBuf();
+
+      /// see std::streambuf
+      int_type overflow(int_type c);
+      /// see std::streambuf
+      int_type underflow();
+      /// see std::streambuf
+      int sync();
+      /// end stream
+      int end();
+
+      void setSink(std::streambuf* sink_)   { sink = sink_; }
+  };
+
+  class Lz4Stream : public std::ostream
+  {
+      Lz4StreamBuf streambuf;
+
+    public:
+      explicit Lz4Stream(std::streambuf* sink, int level = 9, unsigned bufsize = 65536)
+        : std::ostream(0),
+          streambuf(sink, level, bufsize)
+        { init(&streambuf); }
+      explicit Lz4Stream(std::ostream& sink, int level = 9, unsigned bufsize = 65536)
+        : std::ostream(0),
+          streambuf(sink.rdbuf(), level, bufsize)
+        { init(&streambuf); }
+
+      void end();
+      void setSink(std::streambuf* sink)   { streambuf.setSink(sink); }
+      void setSink(std::ostream& sink)     { streambuf.setSink(sink.rdbuf()); }
+  };
+}
+
+#endif // ZIM_LZ4STREAM_H
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_MUTEX_H
+#define ZIM_MUTEX_H
+
+#include <pthread.h>
+#include <zim/noncopyable.h>
+
+namespace zim
+{
+  class Mutex : private NonCopyable
+  {
+      pthread_mutex_t m;
+
+    public:
+      Mutex()     { ::pthread_mutex_init(&m, 0); }
+      ~Mutex()    { ::pthread_mutex_destroy(&m); }
+
+      void lock()     { ::pthread_mutex_lock(&m); }
+      void unlock()   { ::pthread_mutex_unlock(&m); }
+
+      pthread_mutex_t* getHandle()  { return &m; }
+  };
+
+  class Condition : private NonCopyable
+  {
+      pthread_cond_t c;
+
+    public:
+      Condition()   { ::pthread_cond_init(&c, 0); }
+      ~Condition()  { ::pthread_cond_destroy(&c); }
+
+      /// Waits for a signal. The mutex must be locked by the caller.
+      void wait(Mutex& mutex)   { ::pthread_cond_wait(&c, mutex.getHandle()); }
+      void signal()             { ::pthread_cond_signal(&c); }
+      void broadcast()          { ::pthread_cond_broadcast(&c); }
+  };
+
+  /// Locks a mutex for the lifetime of the object.
+  class MutexLock : private NonCopyable
+  {
+      Mutex& mutex;
+
+    public:
+      explicit MutexLock(Mutex& mutex_)
+        : mutex(mutex_)
+        { mutex.lock(); }
+      ~MutexLock()
+        { mutex.unlock(); }
+  };
+
+}
+
+#endif // ZIM_MUTEX_H
@@ -48,8 +48,14 @@ namespace zim
 
       virtual ~RefCounted()  { }
 
+#if defined(__GNUC__)
+      // reference counted objects like clusters are shared between threads
+      virtual unsigned addRef()  { return __sync_add_and_fetch(&rc, 1); }
+      virtual void release()     { if (__sync_sub_and_fetch(&rc, 1) == 0) delete this; }
+#else
       virtual unsigned addRef()  { return ++rc; }
       virtual void release()     { if (--rc == 0) delete this; }
+#endif
       unsigned refs() const   { return rc; }
   };
 
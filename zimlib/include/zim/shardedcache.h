@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_SHARDEDCACHE_H
+#define ZIM_SHARDEDCACHE_H
+
+#include <zim/cache.h>
+#include <zim/mutex.h>
+#include <zim/noncopyable.h>
+#include <vector>
+
+namespace zim
+{
+  /**
+     Thread safe cache, which partitions the keys by hash into a number of
+     independently locked zim::Cache segments.
+
+     Threads accessing different keys rarely wait for each other. The
+     statistics are kept per segment and summed up by getHits, getMisses
+     and hitRatio.
+
+     Elements are returned by value, since a pointer into a segment would
+     be unprotected once the segment lock is released.
+
+     When created with largeElements set, elements costing more than the
+     share of one segment are kept in an extra segment, which is shared by
+     all keys and may use the part of the budget left by the others.
+     Otherwise such elements are not cached at all.
+   */
+  template <typename Key, typename Value>
+  class ShardedCache : private NonCopyable
+  {
+      typedef Cache<Key, Value> CacheType;
+
+      struct Shard
+      {
+        Mutex mutex;
+        CacheType cache;
+
+        Shard(typename CacheType::size_type maxElements, CachePolicy policy)
+          : cache(maxElements, policy)
+          { }
+      };
+
+      std::vector<Shard*> shards;
+
+      // segment for elements larger than a share; 0 when not enabled
+      Shard* large;
+      // total budget; guarded by the mutex of the large segment
+      typename CacheType::size_type maxElements;
+
+#if __cplusplus >= 201103L
+      typedef std::hash<Key> HashType;
+#else
+      typedef std::tr1::hash<Key> HashType;
+#endif
+      HashType hash;
+
+      Shard& shard(const Key& key)
+      {
+        // integer keys hash to themselves; spread them over the shards
+        unsigned long h = static_cast<unsigned long>(hash(key));
+        h ^= h >> 16;
+        h *= 0x45d9f3bUL;
+        h ^= h >> 16;
+        return *shards[h % shards.size()];
+      }
+
+      typename CacheType::size_type regularCost() const
+      {
+        typename CacheType::size_type ret = 0;
+        for (unsigned n = 0; n < shards.size(); ++n)
+        {
+          MutexLock lock(shards[n]->mutex);
+          ret += shards[n]->cache.getCost();
+        }
+        return ret;
+      }
+
+      void _put(const Key& key, const Value& value, std::size_t cost, bool top)
+      {
+        bool isLarge;
+        {
+          Shard& s = shard(key);
+          MutexLock lock(s.mutex);
+          isLarge = large && cost > s.cache.getMaxElements();
+          if (!isLarge)
+          {
+            if (top)
+              s.cache.put_top(key, value, cost);
+            else
+              s.cache.put(key, value, cost);
+          }
+        }
+
+        if (!large)
+          return;
+
+        // the large segment gets what the other segments leave over
+        typename CacheType::size_type used = regularCost();
+        MutexLock lock(large->mutex);
+        large->cache.setMaxElements(maxElements > used ? maxElements - used : 0);
+        if (isLarge)
+        {
+          if (top)
+            large->cache.put_top(key, value, cost);
+          else
+            large->cache.put(key, value, cost);
+        }
+      }
+
+    public:
+      typedef typename CacheType::size_type size_type;
+      typedef Value value_type;
+
+      /// Creates a cache with maxElements elements split into numShards
+      /// segments. The number of segments is reduced for small caches, so
+      /// that each segment holds at least 2 elements.
+      ShardedCache(size_type maxElements_, unsigned numShards,
+                   CachePolicy policy = CACHE_WINNER,
+                   bool largeElements = false)
+        : large(0),
+          maxElements(maxElements_)
+      {
+        if (numShards > maxElements / 2)
+          numShards = static_cast<unsigned>(maxElements / 2);
+        if (numShards == 0)
+          numShards = 1;
+
+        size_type perShard = (maxElements + numShards - 1) / numShards;
+        shards.reserve(numShards);
+        for (unsigned n = 0; n < numShards; ++n)
+          shards.push_back(new Shard(perShard, policy));
+
+        if (largeElements && numShards > 1)
+          large = new Shard(0, policy);
+      }
+
+      ~ShardedCache()
+      {
+        for (unsigned n = 0; n < shards.size(); ++n)
+          delete shards[n];
+        delete large;
+      }
+
+      /// returns the number of segments
+      unsigned getCountShards() const   { return shards.size(); }
+
+      /// returns the number of elements currently in the cache
+      size_type size() const
+      {
+        size_type ret = 0;
+        for (unsigned n = 0; n < shards.size(); ++n)
+        {
+          MutexLock lock(shards[n]->mutex);
+          ret += shards[n]->cache.size();
+        }
+        if (large)
+        {
+          MutexLock lock(large->mutex);
+          ret += large->cache.size();
+        }
+        return ret;
+      }
+
+      /// returns the maximum number of elements or sum of costs in the cache
+      size_type getMaxElements() const
+      {
+        if (large)
+        {
+          MutexLock lock(large->mutex);
+          return maxElements;
+        }
+
+        size_type ret = 0;
+        for (unsigned n = 0; n < shards.size(); ++n)
+        {
+          MutexLock lock(shards[n]->mutex);
+          ret += shards[n]->cache.getMaxElements();
+        }
+        return ret;
+      }
+
+      /// Changes the maximum size of the cache. It is split evenly between
+      /// the segments.
+      void setMaxElements(size_type maxElements_)
+      {
+        size_type perShard = (maxElements_ + shards.size() - 1) / shards.size();
+        for (unsigned n = 0; n < shards.size(); ++n)
+        {
+          MutexLock lock(shards[n]->mutex);
+          shards[n]->cache.setMaxElements(perShard);
+        }
+
+        if (large)
+        {
+          size_type used = regularCost();
+          MutexLock lock(large->mutex);
+          maxElements = maxElements_;
+          large->cache.setMaxElements(maxElements > used ? maxElements - used : 0);
+        }
+        else
+          maxElements = maxElements_;
+      }
+
+      /// returns the sum of the costs of the elements currently in the cache
+      size_type getCost() const
+      {
+        size_type ret = regularCost();
+        if (large)
+        {
+          MutexLock lock(large->mutex);
+          ret += large->cache.getCost();
+        }
+        return ret;
+      }
+
+      bool erase(const Key& key)
+      {
+        bool ret;
+        {
+          Shard& s = shard(key);
+          MutexLock lock(s.mutex);
+          ret = s.cache.erase(key);
+        }
+
+        if (!ret && large)
+        {
+          MutexLock lock(large->mutex);
+          ret = large->cache.erase(key);
+        }
+
+        return ret;
+      }
+
+      void clear(bool stats = false)
+      {
+        for (unsigned n = 0; n < shards.size(); ++n)
+        {
+          MutexLock lock(shards[n]->mutex);
+          shards[n]->cache.clear(stats);
+        }
+        if (large)
+        {
+          MutexLock lock(large->mutex);
+          large->cache.clear(stats);
+        }
+      }
+
+      void put(const Key& key, const Value& value, std::size_t cost = 1)
+      {
+        _put(key, value, cost, false);
+      }
+
+      void put_top(const Key& key, const Value& value, std::size_t cost = 1)
+      {
+        _put(key, value, cost, true);
+      }
+
+      std::pair<bool, Value> getx(const Key& key, Value def = Value())
+      {
+        {
+          Shard& s = shard(key);
+          MutexLock lock(s.mutex);
+          if (!large || s.cache.contains(key))
+            return s.cache.getx(key, def);
+        }
+
+        MutexLock lock(large->mutex);
+        return large->cache.getx(key, def);
+      }
+
+      Value get(const Key& key, Value def = Value())
+      {
+        return getx(key, def).second;
+      }
+
+      /// returns the number of hits of one segment.
+      unsigned getHits(unsigned shard) const
+      {
+        MutexLock lock(shards[shard]->mutex);
+        return shards[shard]->cache.getHits();
+      }
+
+      /// returns the number of misses of one segment.
+      unsigned getMisses(unsigned shard) const
+      {
+        MutexLock lock(shards[shard]->mutex);
+        return shards[shard]->cache.getMisses();
+      }
+
+      /// returns the number of hits of all segments.
+      unsigned getHits() const
+      {
+        unsigned ret = 0;
+        for (unsigned n = 0; n < shards.size(); ++n)
+          ret += getHits(n);
+        if (large)
+        {
+          MutexLock lock(large->mutex);
+          ret += large->cache.getHits();
+        }
+        return ret;
+      }
+
+      /// returns the number of misses of all segments.
+      unsigned getMisses() const
+      {
+        unsigned ret = 0;
+        for (unsigned n = 0; n < shards.size(); ++n)
+          ret += getMisses(n);
+        if (large)
+        {
+          MutexLock lock(large->mutex);
+          ret += large->cache.getMisses();
+        }
+        return ret;
+      }
+
+      /// returns the cache hit ratio between 0 and 1.
+      double hitRatio() const
+      {
+        unsigned hits = getHits();
+        unsigned misses = getMisses();
+        return hits+misses > 0 ? static_cast<double>(hits)/static_cast<double>(hits+misses) : 0;
+      }
+
+      /// returns the ratio, between held elements and maximum elements.
+      double fillfactor() const
+      {
+        size_type max = getMaxElements();
+        return max > 0 ? static_cast<double>(getCost()) / static_cast<double>(max) : 0;
+      }
+  };
+
+}
+
+#endif // ZIM_SHARDEDCACHE_H
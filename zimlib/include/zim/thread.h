@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_THREAD_H
+#define ZIM_THREAD_H
+
+#include <pthread.h>
+#include <stdexcept>
+#include <zim/noncopyable.h>
+
+namespace zim
+{
+  /// Base class for threads. The derived class implements run, which is
+  /// executed in a new thread after start is called. run must not throw.
+  /// A started thread must be joined before the object is destroyed.
+  class Thread : private NonCopyable
+  {
+      pthread_t thread;
+      bool started;
+
+      static void* start_routine(void* arg)
+      {
+        static_cast<Thread*>(arg)->run();
+        return 0;
+      }
+
+    protected:
+      virtual void run() = 0;
+
+    public:
+      Thread()
+        : started(false)
+        { }
+
+      virtual ~Thread()  { }
+
+      void start()
+      {
+        if (::pthread_create(&thread, 0, start_routine, this) != 0)
+          throw std::runtime_error("failed to create thread");
+        started = true;
+      }
+
+      void join()
+      {
+        if (started)
+        {
+          ::pthread_join(thread, 0);
+          started = false;
+        }
+      }
+
+      bool isStarted() const  { return started; }
+  };
+
+}
+
+#endif // ZIM_THREAD_H
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_UNLZ4STREAM_H
+#define ZIM_UNLZ4STREAM_H
+
+#include <iostream>
+#include <stdexcept>
+#include <lz4frame.h>
+
+namespace zim
+{
+  class Unlz4Error : public std::runtime_error
+  {
+      size_t ret;
+
+    public:
+      Unlz4Error(size_t ret_, const std::string& msg)
+        : std::runtime_error(msg),
+          ret(ret_)
+          { }
+
+      size_t getRetcode() const  { return ret; }
+  };
+
+  class Unlz4StreamBuf : public std::streambuf
+  {
+      LZ4F_dctx* stream;
+      const char* inputPtr;
+      const char* inputEnd;
+      bool finished;
+      // the last output buffer was filled, so the decoder may hold more
+      bool pending;
+      char_type* iobuffer;
+      unsigned bufsize;
+      std::streambuf* sinksource;
+
+      char_type* ibuffer()            { return iobuffer; }
+      std::streamsize ibuffer_size()  { return bufsize >> 1; }
+      char_type* obuffer()            { return iobuffer + ibuffer_size(); }
+      std::streamsize obuffer_size()  { return bufsize >> 1; }
+
+    public:
+      explicit Unlz4StreamBuf(std::streambuf* sinksource_, unsigned bufsize = 8192);
+      ~Unlz4StreamBuf();
+
+      /// see std::streambuf
+      int_type overflow(int_type c);
+      /// see std::streambuf
+      int_type underflow();
+      /// see std::streambuf
+      int sync();
+
+      void setSinksource(std::streambuf* sinksource_)   { sinksource = sinksource_; }
+
+      /// Prepares the decoder for a new stream read from sinksource. The
+      /// allocated decoder state is reused.
+      void reset(std::streambuf* sinksource_);
+  };
+
+  class Unlz4Stream : public std::iostream
+  {
+      Unlz4StreamBuf streambuf;
+
+    public:
+      explicit Unlz4Stream(std::streambuf* sinksource, unsigned bufsize = 8192)
+        : std::iostream(0),
+          streambuf(sinksource, bufsize)
+        { init(&streambuf); }
+      explicit Unlz4Stream(std::ios& sinksource, unsigned bufsize = 8192)
+        : std::iostream(0),
+          streambuf(sinksource.rdbuf(), bufsize)
+        { init(&streambuf); }
+
+      void setSinksource(std::streambuf* sinksource)   { streambuf.setSinksource(sinksource); }
+      void setSinksource(std::ios& sinksource)         { streambuf.setSinksource(sinksource.rdbuf()); }
+      void setSink(std::ostream& sink)                 { streambuf.setSinksource(sink.rdbuf()); }
+      void setSource(std::istream& source)             { streambuf.setSinksource(source.rdbuf()); }
+
+      /// Starts decompressing a new stream from source.
+      void reset(std::istream& source)                 { streambuf.reset(source.rdbuf()); clear(); }
+  };
+}
+
+#endif // ZIM_UNLZ4STREAM_H
@@ -64,6 +64,10 @@ namespace zim
       int sync();
 
       void setSinksource(std::streambuf* sinksource_)   { sinksource = sinksource_; }
+
+      /// Prepares the decoder for a new stream read from sinksource. The
+      /// allocated decoder state is reused.
+      void reset(std::streambuf* sinksource_);
   };
 
   class UnlzmaStream : public std::iostream
@@ -84,6 +88,9 @@ namespace zim
       void setSinksource(std::ios& sinksource)         { streambuf.setSinksource(sinksource.rdbuf()); }
       void setSink(std::ostream& sink)                 { streambuf.setSinksource(sink.rdbuf()); }
       void setSource(std::istream& source)             { streambuf.setSinksource(source.rdbuf()); }
+
+      /// Starts decompressing a new stream from source.
+      void reset(std::istream& source)                 { streambuf.reset(source.rdbuf()); clear(); }
   };
 }
 
@@ -34,6 +34,8 @@ namespace zim
     class Article
     {
       public:
+        virtual ~Article() { }
+
         virtual std::string getAid() const = 0;
         virtual char getNamespace() const = 0;
         virtual std::string getUrl() const = 0;
@@ -63,6 +65,8 @@ namespace zim
     class ArticleSource
     {
       public:
+        virtual ~ArticleSource() { }
+
         virtual void setFilename(const std::string& fname) { }
         virtual const Article* getNextArticle() = 0;
         virtual Uuid getUuid();
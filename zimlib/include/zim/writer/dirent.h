@@ -34,13 +34,20 @@ namespace zim
         bool compress;
 
       public:
-        Dirent() {}
+        Dirent()
+          : idx(0),
+            compress(false)
+          {}
 
         Dirent(const std::string& aid_)
-          : aid(aid_)
+          : aid(aid_),
+            idx(0),
+            compress(false)
           {}
 
         Dirent(char ns, const std::string& url)
+          : idx(0),
+            compress(false)
         { setUrl(ns, url); }
 
         void setAid(const std::string&  aid_)      { aid = aid_; }
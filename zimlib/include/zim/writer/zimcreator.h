@@ -22,6 +22,9 @@
 
 #include <zim/writer/articlesource.h>
 #include <zim/writer/dirent.h>
+#include <zim/cluster.h>
+#include <zim/dictionary.h>
+#include <zim/smartptr.h>
 #include <vector>
 #include <map>
 
@@ -29,6 +32,11 @@ namespace zim
 {
   namespace writer
   {
+    class ClusterCompressor;
+    class ExternalDirents;
+    class ArticleQueue;
+    class CreatorThread;
+
     class ZimCreator
     {
       public:
@@ -38,6 +46,8 @@ namespace zim
         typedef std::vector<offset_type> OffsetsType;
         typedef std::map<std::string, uint16_t> MimeTypes;
         typedef std::map<uint16_t, std::string> RMimeTypes;
+        typedef std::map<std::string, CompressionType> MimeTypeCompressions;
+        typedef std::map<char, CompressionType> NamespaceCompressions;
 
       private:
         unsigned minChunkSize;
@@ -51,19 +61,60 @@ namespace zim
         RMimeTypes rmimeTypes;
         uint16_t nextMimeIdx;
         CompressionType compression;
+        size_type frameSize;
+        unsigned compressionThreads;
+        bool deduplicate;
+        bool indexLast;
+        ClusterCompressor* compressor;
+        offset_type direntMemory;
+        offset_type direntsSize;
+        ExternalDirents* external;
+        unsigned queueSize;
+        ArticleQueue* articleQueue;
+        CreatorThread* creatorThread;
+        MimeTypeCompressions mimeTypeCompressions;
+        NamespaceCompressions namespaceCompressions;
         bool isEmpty;
         offset_type clustersSize;
         offset_type currentSize;
 
-        void createDirentsAndClusters(ArticleSource& src, const std::string& tmpfname);
+        // With zstd compression and a dictionary size set, a dictionary is
+        // trained over the first compressible articles. Clusters are held
+        // back until it is ready, but not more than twice the samples
+        // needed; then the dictionary is trained on the samples collected.
+        size_type dictionarySize;
+        SmartPtr<Dictionary> dictionary;
+        bool sampling;
+        std::string samples;
+        std::vector<size_type> sampleSizes;
+        std::vector<Cluster> pendingClusters;
+        offset_type pendingSize;
+
+        void writeCluster(std::ostream& out, Cluster& cluster);
+        void compressCluster(std::ostream& out, size_type idx, Cluster& cluster);
+        void writeCompressedClusters(std::ostream& out, bool all);
+        void addSample(const Blob& blob);
+        void createDictionary(std::ostream& out);
+
+        CompressionType getCompression(const Article& article) const;
+
+        void start(const std::string& fname, ArticleSource* src);
+
+        void createDirentsAndClusters(ArticleSource& src, const std::string& clusterfname);
+        void resolveRedirects();
         void createTitleIndex(ArticleSource& src);
         void fillHeader(ArticleSource& src);
         void write(const std::string& fname, const std::string& tmpfname);
+        void writeIndex(std::ostream& out);
+        void writeClusterPtrs(std::ostream& out);
 
         size_type clusterCount() const        { return clusterOffsets.size(); }
-        size_type articleCount() const        { return dirents.size(); }
+        size_type articleCount() const;
+        // the position of the cluster data in the file, they are written to
+        offset_type clusterFilePos() const    { return indexLast ? Fileheader::size : 0; }
+        offset_type clusterDataPos() const    { return indexLast ? Fileheader::size : clusterPtrPos() + clusterPtrSize(); }
         offset_type mimeListSize() const;
-        offset_type mimeListPos() const       { return Fileheader::size; }
+        offset_type mimeListPos() const       { return indexLast ? Fileheader::size + clustersSize : Fileheader::size; }
         offset_type urlPtrSize() const        { return articleCount() * sizeof(offset_type); }
         offset_type urlPtrPos() const         { return mimeListPos() + mimeListSize(); }
         offset_type titleIdxSize() const      { return articleCount() * sizeof(size_type); }
@@ -72,7 +123,8 @@ namespace zim
         offset_type indexPos() const          { return titleIdxPos() + titleIdxSize(); }
         offset_type clusterPtrSize() const    { return clusterCount() * sizeof(offset_type); }
         offset_type clusterPtrPos() const     { return indexPos() + indexSize(); }
-        offset_type checksumPos() const       { return clusterPtrPos() + clusterPtrSize() + clustersSize; }
+        offset_type checksumPos() const       { return indexLast ? clusterPtrPos() + clusterPtrSize()
+                                                           : clusterDataPos() + clustersSize; }
 
         uint16_t getMimeTypeIdx(const std::string& mimeType);
         const std::string& getMimeType(uint16_t mimeTypeIdx) const;
@@ -80,12 +132,91 @@ namespace zim
       public:
         ZimCreator();
         ZimCreator(int& argc, char* argv[]);
+        ~ZimCreator();
 
         unsigned getMinChunkSize()    { return minChunkSize; }
         void setMinChunkSize(int s)   { minChunkSize = s; }
 
+        /* The compression of clusters with compressible articles. The
+         * level of lzma and zstd is read from ZIM_LZMA_LEVEL and
+         * ZIM_ZSTD_LEVEL. */
+        CompressionType getCompression() const    { return compression; }
+        void setCompression(CompressionType c)    { compression = c; }
+
+        /* Compressible articles with the mime type or in the namespace are
+         * put in clusters of their own with the compression given here
+         * instead of the default. A compression set for the mime type takes
+         * precedence. This puts e.g. stylesheets and scripts, which are
+         * read on every page view, in fast decompressing lz4 clusters. */
+        void setMimeTypeCompression(const std::string& mimeType, CompressionType c)
+                                                  { mimeTypeCompressions[mimeType] = c; }
+        void setNamespaceCompression(char ns, CompressionType c)
+                                                  { namespaceCompressions[ns] = c; }
+
+        /* The size of the independently compressed frames of compressed
+         * clusters in bytes; 0 compresses each cluster as one stream. */
+        size_type getFrameSize() const            { return frameSize; }
+        void setFrameSize(size_type s)            { frameSize = s; }
+
+        /* The number of threads compressing clusters. With more than one,
+         * full clusters are compressed in the background, while the next
+         * ones are filled; they are written in the same order as with one
+         * thread, so the output does not change. The title index is sorted
+         * and the directory entries are serialized with the same number of
+         * threads. */
+        unsigned getCompressionThreads() const    { return compressionThreads; }
+        void setCompressionThreads(unsigned n)    { compressionThreads = n; }
+
+        /* With deduplication, articles with the same data as an article
+         * added before point to its blob instead of storing the data
+         * again. Blobs are compared by their sha256 sum and size. */
+        bool getDeduplicate() const               { return deduplicate; }
+        void setDeduplicate(bool sw)              { deduplicate = sw; }
+
+        /* With the index last, the clusters are written directly to the
+         * zim file, followed by the mime type list, the pointer lists and
+         * the directory entries. This avoids copying the clusters from a
+         * temporary file; the checksum is calculated by reading the file
+         * once more. Readers must take the position of the mime type list
+         * from the header. */
+        bool getIndexLast() const                 { return indexLast; }
+        void setIndexLast(bool sw)                { indexLast = sw; }
+
+        /* The memory in bytes for the directory entries; 0 keeps all of them
+         * in memory. With a limit, they are moved to sorted temporary files
+         * next to the zim file while the articles are collected and the
+         * index is written from these files. About 4 times the limit is
+         * used at most. */
+        offset_type getDirentMemory() const       { return direntMemory; }
+        void setDirentMemory(offset_type s)       { direntMemory = s; }
+
+        /* The maximum size of the zstd compression dictionary in bytes;
+         * 0 disables the dictionary. */
+        size_type getDictionarySize() const       { return dictionarySize; }
+        void setDictionarySize(size_type s)       { dictionarySize = s; }
+
         void create(const std::string& fname, ArticleSource& src);
 
+        /* Instead of pulling the articles from an article source with
+         * create, articles may be pushed with addArticle from any number
+         * of threads. start begins the creation in a background thread;
+         * the uuid and the main and layout page are taken from src, and
+         * its articles are added first. addArticle copies the article with
+         * its data, so the article may be destroyed, when it returns. It
+         * waits, while the queue of articles is full, and throws, if the
+         * creation failed. finish writes the index and throws the error of
+         * the creation, if any. The order of articles added concurrently
+         * is not defined. */
+        void start(const std::string& fname);
+        void start(const std::string& fname, ArticleSource& src);
+        void addArticle(const Article& article);
+        void finish();
+
+        /* The number of articles queued by addArticle, until the
+         * creator takes them. */
+        unsigned getQueueSize() const             { return queueSize; }
+        void setQueueSize(unsigned n)             { queueSize = n; }
+
         /* The user can query `currentSize` after each article has been
          * added to the ZIM file. */
         offset_type getCurrentSize() { return currentSize; }
@@ -120,7 +120,9 @@ namespace zim
     zimcompNone,
     zimcompZip,
     zimcompBzip2,
-    zimcompLzma
+    zimcompLzma,
+    zimcompZstd,
+    zimcompLz4
   };
 
   static const char MimeHtmlTemplate[] = "text/x-zim-htmltemplate";
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_ZSTDSTREAM_H
+#define ZIM_ZSTDSTREAM_H
+
+#include <iostream>
+#include <stdexcept>
+#include <zstd.h>
+#include <vector>
+
+namespace zim
+{
+  class ZstdError : public std::runtime_error
+  {
+      size_t ret;
+
+    public:
+      ZstdError(size_t ret_, const std::string& msg)
+        : std::runtime_error(msg),
+          ret(ret_)
+          { }
+
+      size_t getRetcode() const  { return ret; }
+  };
+
+  class ZstdStreamBuf : public std::streambuf
+  {
+      ZSTD_CStream* stream;
+      std::vector<char_type> obuffer;
+      std::streambuf* sink;
+
+      bool compressBuffer();
+      bool writeSink(const char* data, size_t size);
+
+    public:
+      /// When a dictionary is passed, the data is compressed with it; it
+      /// must stay valid, while the stream is used.
+      explicit ZstdStreamBuf(std::streambuf* sink_, int level = 19, unsigned bufsize = 8192,
+                             const void* dict = 0, size_t dictSize = 0);
+      ~ZstdStreamBuf();
+
+      /// see std::streambuf
+      int_type overflow(int_type c);
+      /// see std::streambuf
+      int_type underflow();
+      /// see std::streambuf
+      int sync();
+      /// end stream
+      int end();
+
+      void setSink(std::streambuf* sink_)   { sink = sink_; }
+  };
+
+  class ZstdStream : public std::ostream
+  {
+      ZstdStreamBuf streambuf;
+
+    public:
+      explicit ZstdStream(std::streambuf* sink, int level = 19, unsigned bufsize = 8192,
+                          const void* dict = 0, size_t dictSize = 0)
+        : std::ostream(0),
+          streambuf(sink, level, bufsize, dict, dictSize)
+        { init(&streambuf); }
+      explicit ZstdStream(std::ostream& sink, int level = 19, unsigned bufsize = 8192,
+                          const void* dict = 0, size_t dictSize = 0)
+        : std::ostream(0),
+          streambuf(sink.rdbuf(), level, bufsize, dict, dictSize)
+        { init(&streambuf); }
+
+      void end();
+      void setSink(std::streambuf* sink)   { streambuf.setSink(sink); }
+      void setSink(std::ostream& sink)     { streambuf.setSink(sink.rdbuf()); }
+  };
+}
+
+#endif // ZIM_ZSTDSTREAM_H
@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include "blockdecoder.h"
+#include <zim/dictionary.h>
+#include <zim/error.h>
+#include <stdexcept>
+#include <sstream>
+#include <cstring>
+#include "envvalue.h"
+#include "log.h"
+#include "config.h"
+
+#if defined(ENABLE_ZLIB)
+#include <zim/inflatestream.h>
+#endif
+
+#if defined(ENABLE_BZIP2)
+#include <zim/bunzip2stream.h>
+#endif
+
+#if defined(ENABLE_LZMA)
+#include <zim/unlzmastream.h>
+#endif
+
+#if defined(ENABLE_ZSTD)
+#include <zim/unzstdstream.h>
+#endif
+
+#if defined(ENABLE_LZ4)
+#include <zim/unlz4stream.h>
+#endif
+
+log_define("zim.blockdecoder")
+
+namespace zim
+{
+  namespace
+  {
+#if defined(ENABLE_ZLIB)
+    class ZlibBlockDecoder : public BlockDecoder
+    {
+        z_stream stream;
+
+      public:
+        ZlibBlockDecoder()
+        {
+          std::memset(&stream, 0, sizeof(stream));
+          int ret = ::inflateInit(&stream);
+          if (ret != Z_OK)
+            throw InflateError(ret, "inflateInit failed");
+        }
+
+        ~ZlibBlockDecoder()
+        {
+          ::inflateEnd(&stream);
+        }
+
+        void reset(const char* src, size_type size, const Dictionary*)
+        {
+          ::inflateReset(&stream);
+          stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(src));
+          stream.avail_in = size;
+        }
+
+        size_type readSome(char* dest, size_type n)
+        {
+          stream.next_out = reinterpret_cast<Bytef*>(dest);
+          stream.avail_out = n;
+
+          while (stream.avail_out > 0)
+          {
+            // zlib clusters end with a sync flush and not with the end of
+            // the stream, so running out of input is not an error here
+            int ret = ::inflate(&stream, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END || ret == Z_BUF_ERROR)
+              break;
+
+            if (ret != Z_OK)
+            {
+              std::ostringstream msg;
+              msg << "inflate-error " << ret;
+              if (stream.msg)
+                msg << ": " << stream.msg;
+              log_error(msg.str());
+              throw InflateError(ret, msg.str());
+            }
+          }
+
+          return n - stream.avail_out;
+        }
+    };
+#endif
+
+#if defined(ENABLE_BZIP2)
+    class Bzip2BlockDecoder : public BlockDecoder
+    {
+        bz_stream stream;
+
+        void init()
+        {
+          std::memset(&stream, 0, sizeof(stream));
+          int ret = ::BZ2_bzDecompressInit(&stream, 0, 0);
+          if (ret != BZ_OK)
+            throw Bzip2UncompressError(ret, Bzip2Error::getErrorString(ret));
+        }
+
+      public:
+        Bzip2BlockDecoder()
+        {
+          init();
+        }
+
+        ~Bzip2BlockDecoder()
+        {
+          ::BZ2_bzDecompressEnd(&stream);
+        }
+
+        void reset(const char* src, size_type size, const Dictionary*)
+        {
+          // bzip2 has no reset function
+          ::BZ2_bzDecompressEnd(&stream);
+          init();
+          stream.next_in = const_cast<char*>(src);
+          stream.avail_in = size;
+        }
+
+        size_type readSome(char* dest, size_type n)
+        {
+          stream.next_out = dest;
+          stream.avail_out = n;
+
+          while (stream.avail_out > 0)
+          {
+            unsigned avail_in = stream.avail_in;
+            unsigned avail_out = stream.avail_out;
+
+            int ret = ::BZ2_bzDecompress(&stream);
+            if (ret == BZ_STREAM_END)
+              break;
+
+            if (ret != BZ_OK)
+            {
+              std::ostringstream msg;
+              msg << "bzip2-error " << ret << ": " << Bzip2Error::getErrorString(ret);
+              log_error(msg.str());
+              throw Bzip2UncompressError(ret, msg.str());
+            }
+
+            if (stream.avail_in == avail_in && stream.avail_out == avail_out)
+              break;
+          }
+
+          return n - stream.avail_out;
+        }
+    };
+#endif
+
+#if defined(ENABLE_LZMA)
+    class LzmaBlockDecoder : public BlockDecoder
+    {
+        lzma_stream stream;
+
+        void init()
+        {
+          unsigned memsize = envMemSize("ZIM_LZMA_MEMORY_SIZE", LZMA_MEMORY_SIZE * 1024 * 1024);
+          lzma_ret ret = ::lzma_stream_decoder(&stream, memsize, 0);
+          if (ret != LZMA_OK)
+          {
+            std::ostringstream msg;
+            msg << "lzma_stream_decoder failed with " << ret;
+            throw UnlzmaError(ret, msg.str());
+          }
+        }
+
+      public:
+        LzmaBlockDecoder()
+        {
+          std::memset(&stream, 0, sizeof(stream));
+          init();
+        }
+
+        ~LzmaBlockDecoder()
+        {
+          ::lzma_end(&stream);
+        }
+
+        void reset(const char* src, size_type size, const Dictionary*)
+        {
+          // liblzma reuses the memory of an initialized stream
+          init();
+          stream.next_in = reinterpret_cast<const uint8_t*>(src);
+          stream.avail_in = size;
+        }
+
+        size_type readSome(char* dest, size_type n)
+        {
+          stream.next_out = reinterpret_cast<uint8_t*>(dest);
+          stream.avail_out = n;
+
+          while (stream.avail_out > 0)
+          {
+            lzma_ret ret = ::lzma_code(&stream, LZMA_RUN);
+            if (ret == LZMA_STREAM_END || ret == LZMA_BUF_ERROR)
+              break;
+
+            if (ret != LZMA_OK)
+            {
+              std::ostringstream msg;
+              msg << "inflate-error " << ret;
+              log_error(msg.str());
+              throw UnlzmaError(ret, msg.str());
+            }
+          }
+
+          return n - stream.avail_out;
+        }
+    };
+#endif
+
+#if defined(ENABLE_ZSTD)
+    class ZstdBlockDecoder : public BlockDecoder
+    {
+        ZSTD_DStream* stream;
+        ZSTD_inBuffer input;
+
+        static size_t checkError(size_t ret)
+        {
+          if (::ZSTD_isError(ret))
+          {
+            std::ostringstream msg;
+            msg << "unzstd-error: " << ::ZSTD_getErrorName(ret);
+            log_error(msg.str());
+            throw UnzstdError(ret, msg.str());
+          }
+          return ret;
+        }
+
+      public:
+        ZstdBlockDecoder()
+          : stream(::ZSTD_createDStream())
+        {
+          if (stream == 0)
+            throw UnzstdError(0, "failed to create zstd decompressor");
+          input.src = 0;
+          input.size = 0;
+          input.pos = 0;
+        }
+
+        ~ZstdBlockDecoder()
+        {
+          ::ZSTD_freeDStream(stream);
+        }
+
+        void reset(const char* src, size_type size, const Dictionary* dictionary)
+        {
+          checkError(::ZSTD_initDStream(stream));
+          if (dictionary && dictionary->getZstdDDict())
+            checkError(::ZSTD_DCtx_refDDict(stream, static_cast<const ZSTD_DDict*>(dictionary->getZstdDDict())));
+          input.src = src;
+          input.size = size;
+          input.pos = 0;
+        }
+
+        size_type readSome(char* dest, size_type n)
+        {
+          ZSTD_outBuffer out = { dest, n, 0 };
+
+          while (out.pos < out.size)
+          {
+            size_t pos = out.pos;
+            size_t ret = checkError(::ZSTD_decompressStream(stream, &out, &input));
+            if (ret == 0 || (out.pos == pos && input.pos >= input.size))
+              break;
+          }
+
+          return out.pos;
+        }
+    };
+#endif
+
+#if defined(ENABLE_LZ4)
+    class Lz4BlockDecoder : public BlockDecoder
+    {
+        LZ4F_dctx* stream;
+        const char* input;
+        const char* inputEnd;
+        bool finished;
+
+        static size_t checkError(size_t ret)
+        {
+          if (::LZ4F_isError(ret))
+          {
+            std::ostringstream msg;
+            msg << "unlz4-error: " << ::LZ4F_getErrorName(ret);
+            log_error(msg.str());
+            throw Unlz4Error(ret, msg.str());
+          }
+          return ret;
+        }
+
+      public:
+        Lz4BlockDecoder()
+          : stream(0),
+            input(0),
+            inputEnd(0),
+            finished(false)
+        {
+          checkError(::LZ4F_createDecompressionContext(&stream, LZ4F_VERSION));
+        }
+
+        ~Lz4BlockDecoder()
+        {
+          ::LZ4F_freeDecompressionContext(stream);
+        }
+
+        void reset(const char* src, size_type size, const Dictionary*)
+        {
+          ::LZ4F_resetDecompressionContext(stream);
+          input = src;
+          inputEnd = src + size;
+          finished = false;
+        }
+
+        size_type readSome(char* dest, size_type n)
+        {
+          size_type pos = 0;
+
+          while (pos < n && !finished && input < inputEnd)
+          {
+            size_t srcSize = inputEnd - input;
+            size_t dstSize = n - pos;
+            if (checkError(::LZ4F_decompress(stream, dest + pos, &dstSize, input, &srcSize, 0)) == 0)
+              finished = true;
+            input += srcSize;
+            pos += dstSize;
+          }
+
+          return pos;
+        }
+    };
+#endif
+  }
+
+  void BlockDecoder::read(char* dest, size_type n)
+  {
+    if (readSome(dest, n) < n)
+      throw ZimFileFormatError("compressed cluster data ends early");
+  }
+
+  BlockDecoder* BlockDecoder::create(CompressionType compression)
+  {
+    switch (compression)
+    {
+      case zimcompZip:
+#if defined(ENABLE_ZLIB)
+        log_debug("create zlib block decoder");
+        return new ZlibBlockDecoder();
+#else
+        throw std::runtime_error("zlib not enabled in this library");
+#endif
+
+      case zimcompBzip2:
+#if defined(ENABLE_BZIP2)
+        log_debug("create bzip2 block decoder");
+        return new Bzip2BlockDecoder();
+#else
+        throw std::runtime_error("bzip2 not enabled in this library");
+#endif
+
+      case zimcompLzma:
+#if defined(ENABLE_LZMA)
+        log_debug("create lzma block decoder");
+        return new LzmaBlockDecoder();
+#else
+        throw std::runtime_error("lzma not enabled in this library");
+#endif
+
+      case zimcompZstd:
+#if defined(ENABLE_ZSTD)
+        log_debug("create zstd block decoder");
+        return new ZstdBlockDecoder();
+#else
+        throw std::runtime_error("zstd not enabled in this library");
+#endif
+
+      case zimcompLz4:
+#if defined(ENABLE_LZ4)
+        log_debug("create lz4 block decoder");
+        return new Lz4BlockDecoder();
+#else
+        throw std::runtime_error("lz4 not enabled in this library");
+#endif
+
+      default:
+        log_error("invalid compression flag " << compression);
+        return 0;
+    }
+  }
+}
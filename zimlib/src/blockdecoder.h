@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_BLOCKDECODER_H
+#define ZIM_BLOCKDECODER_H
+
+#include <zim/zim.h>
+
+namespace zim
+{
+  class Dictionary;
+
+  /**
+     Decompresses a block of compressed data held in memory directly into
+     the buffers of the caller.
+
+     Unlike the decompressor streams there is no i/o buffer and no virtual
+     call per buffer refill; the input is consumed in place and the output
+     written straight to its destination.
+   */
+  class BlockDecoder
+  {
+    public:
+      virtual ~BlockDecoder() { }
+
+      /// Starts decompressing the data [src, src + size). The data and the
+      /// dictionary, which may be 0, must stay valid, while it is read.
+      virtual void reset(const char* src, size_type size, const Dictionary* dictionary) = 0;
+
+      /// Decompresses up to n bytes into dest and returns the number of
+      /// bytes decompressed, which is less only at the end of the data.
+      virtual size_type readSome(char* dest, size_type n) = 0;
+
+      /// Decompresses the next n bytes into dest. Throws
+      /// ZimFileFormatError, when the compressed data ends before.
+      void read(char* dest, size_type n);
+
+      /// Returns a new decoder or 0, if the compression type is unknown.
+      static BlockDecoder* create(CompressionType compression);
+  };
+}
+
+#endif // ZIM_BLOCKDECODER_H
@@ -48,16 +48,29 @@ namespace zim
     { return a <= b ? a : b; }
   }
 
-  Bunzip2StreamBuf::Bunzip2StreamBuf(std::streambuf* sinksource_, bool small, unsigned bufsize_)
+  Bunzip2StreamBuf::Bunzip2StreamBuf(std::streambuf* sinksource_, bool small_, unsigned bufsize_)
     : iobuffer(new char_type[bufsize_]),
       bufsize(bufsize_),
-      sinksource(sinksource_)
+      sinksource(sinksource_),
+      small(small_)
   {
     std::memset(&stream, 0, sizeof(bz_stream));
 
     checkError(::BZ2_bzDecompressInit(&stream, 0, static_cast<int>(small)), stream);
   }
 
+  void Bunzip2StreamBuf::reset(std::streambuf* sinksource_)
+  {
+    sinksource = sinksource_;
+    setg(0, 0, 0);
+    setp(0, 0);
+
+    // bzip2 has no reset function; only the i/o buffer is reused
+    ::BZ2_bzDecompressEnd(&stream);
+    std::memset(&stream, 0, sizeof(bz_stream));
+    checkError(::BZ2_bzDecompressInit(&stream, 0, static_cast<int>(small)), stream);
+  }
+
   Bunzip2StreamBuf::~Bunzip2StreamBuf()
   {
     ::BZ2_bzDecompressEnd(&stream);
@@ -22,9 +22,15 @@
 #include <zim/endian.h>
 #include <zim/error.h>
 #include <stdlib.h>
+#include <cstring>
 #include <sstream>
+#include <algorithm>
 
 #include "log.h"
+#include "ptrstream.h"
+#include "decoderpool.h"
+#include "blockdecoder.h"
+#include "envvalue.h"
 
 #include "config.h"
 
@@ -43,12 +49,26 @@
 #include <zim/unlzmastream.h>
 #endif
 
+#if defined(ENABLE_ZSTD)
+#include <zim/zstdstream.h>
+#endif
+
+#if defined(ENABLE_LZ4)
+#include <zim/lz4stream.h>
+#endif
+
 log_define("zim.cluster")
 
 #define log_debug1(e)
 
 namespace zim
 {
+  namespace
+  {
+    // flag in the compression byte of a cluster compressed in frames
+    const char framedFlag = 0x40;
+  }
+
   Cluster::Cluster()
     : impl(0)
     { }
@@ -63,11 +83,26 @@ namespace zim
   ClusterImpl::ClusterImpl()
     : compression(zimcompNone),
       startOffset(0),
-      lazy_read_stream(NULL)
+      lazy_read(false),
+      decoder_source(0),
+      decoder(0),
+      decoded(0),
+      mappedData(0),
+      frameSize(0),
+      frameData(0),
+      frameOffset(0),
+      headerSize(0)
   {
     offsets.push_back(0);
   }
 
+  ClusterImpl::~ClusterImpl()
+  {
+    DecoderPool::release(getCompression(), decoder);
+    delete decoder_source;
+    DecoderPool::releaseBuffer(_data);
+  }
+
   /* This return the number of char read */
   offset_type ClusterImpl::read_header(std::istream& in)
   {
@@ -117,24 +152,60 @@ namespace zim
       size_type n = offsets.back() - offsets.front();
       if (n > 0)
       {
-        _data.resize(n);
+        DecoderPool::acquireBuffer(_data, n);
         log_debug("read " << n << " bytes of data");
         in.read(&(_data[0]), n);
+        if (in.gcount() != static_cast<std::streamsize>(n))
+          throw ZimFileFormatError("cluster data ends early");
       }
       else
         log_warn("read empty cluster");
     }
   }
 
-  void ClusterImpl::finalise_read() {
-    if ( !lazy_read_stream )
+  void ClusterImpl::read_data(size_type end)
+  {
+    MutexLock lock(lazy_read_mutex);
+
+    if (lazy_read)
     {
-        std::cerr << "lazy_read null" << std::endl;
-        return;
+      log_debug("read " << offsets.back() << " bytes of uncompressed data at offset " << startOffset);
+      DecoderPool::acquireBuffer(_data, offsets.back());
+      if (!_data.empty())
+        lazy_read_file->read(&_data[0], startOffset, _data.size());
+      lazy_read = false;
+    }
+
+    if (decoder && decoded < end)
+    {
+      // decompress at least 64k at once, so that reading consecutive small
+      // blobs does not resume the decompressor each time
+      size_type until = decoded + 65536 < _data.size() ? decoded + 65536 : _data.size();
+      if (until < end)
+        until = end;
+
+      log_debug("decompress " << until - decoded << " bytes; " << until << " of " << _data.size() << " bytes done");
+      try
+      {
+        decoder->read(&_data[decoded], until - decoded);
+      }
+      catch (const std::ios_base::failure&)
+      {
+        throw ZimFileFormatError("error decompressing cluster data");
+      }
+
+      if (decoder->gcount() != static_cast<std::streamsize>(until - decoded))
+        throw ZimFileFormatError("compressed cluster data ends early");
+      decoded = until;
+
+      if (decoded >= _data.size())
+      {
+        DecoderPool::release(getCompression(), decoder);
+        delete decoder_source;
+        decoder = 0;
+        decoder_source = 0;
+      }
     }
-    lazy_read_stream->seekg(startOffset);
-    read_content(*lazy_read_stream);
-    lazy_read_stream = NULL;
   }
 
   void ClusterImpl::write(std::ostream& out) const
@@ -161,8 +232,44 @@ namespace zim
     offsets.push_back(_data.size());
   }
 
+  namespace
+  {
+    class BlobBuffer : public RefCounted
+    {
+      public:
+        std::vector<char> data;
+        explicit BlobBuffer(size_type size)
+          : data(size)
+          { }
+    };
+  }
+
   Blob ClusterImpl::getBlob(size_type n) const
   {
+    if (lazy_read_file)
+    {
+      // As long as the uncompressed cluster is not read, read just the
+      // requested blob instead of the whole cluster.
+      bool readBlob;
+      {
+        MutexLock lock(lazy_read_mutex);
+        readBlob = lazy_read;
+      }
+
+      if (readBlob)
+      {
+        size_type size = getSize(n);
+        if (size == 0)
+          return Blob();
+
+        log_debug("read blob " << n << " with " << size << " bytes at offset " << getOffset(n));
+        BlobBuffer* buffer = new BlobBuffer(size);
+        Blob blob(buffer, &buffer->data[0], size);
+        lazy_read_file->read(&buffer->data[0], getOffset(n), size);
+        return blob;
+      }
+    }
+
     size_type s = getSize();
     return s > 0 ? Blob(const_cast<ClusterImpl*>(this), getData(n), getSize(n))
                  : Blob();
@@ -173,6 +280,22 @@ namespace zim
     offsets.clear();
     _data.clear();
     offsets.push_back(0);
+    lazy_read_file = 0;
+    lazy_read = false;
+    DecoderPool::release(getCompression(), decoder);
+    delete decoder_source;
+    decoder = 0;
+    decoder_source = 0;
+    decoder_file = 0;
+    decoded = 0;
+    mappedFile = 0;
+    mappedData = 0;
+    frame_file = 0;
+    frameData = 0;
+    frameOffset = 0;
+    frameEnds.clear();
+    frameDecoded.clear();
+    headerSize = 0;
   }
 
   void ClusterImpl::addBlob(const char* data, unsigned size)
@@ -190,6 +313,12 @@ namespace zim
     getImpl()->init_from_stream(in, offset);
   }
 
+  void Cluster::init_from_file(FileCompound* file, offset_type offset, offset_type size, bool partial,
+                               Dictionary* dictionary)
+  {
+    getImpl()->init_from_file(file, offset, size, partial, dictionary);
+  }
+
   void ClusterImpl::init_from_stream(ifstream& in, offset_type offset)
   {
     log_trace("init_from_stream");
@@ -207,78 +336,376 @@ namespace zim
       case zimcompNone:
         startOffset = read_header(in);
         startOffset += sizeof(char) + offset;
-        set_lazy_read(&in);
+        read_content(in);
         break;
 
-      case zimcompZip:
-        {
-#if defined(ENABLE_ZLIB)
-          log_debug("uncompress data (zlib)");
-          zim::InflateStream is(in);
-          is.exceptions(std::ios::failbit | std::ios::badbit);
-          read_header(is);
-          read_content(is);
-#else
-          throw std::runtime_error("zlib not enabled in this library");
-#endif
-          break;
-        }
+      default:
+        read_compressed(in);
+        break;
+    }
+  }
 
-      case zimcompBzip2:
+  void ClusterImpl::init_from_file(FileCompound* file, offset_type offset, offset_type size, bool partial,
+                                   Dictionary* dictionary_)
+  {
+    log_trace("init_from_file");
+
+    clear();
+    dictionary = dictionary_;
+
+    char* p = size > 0 ? const_cast<char*>(file->getPtr(offset, size)) : 0;
+
+    char c;
+    if (p)
+      c = *p;
+    else
+      file->read(&c, offset, 1);
+
+    if (c & framedFlag)
+    {
+      setCompression(static_cast<CompressionType>(c & ~framedFlag));
+      if (!isCompressed())
+        throw ZimFileFormatError("invalid compression flag of framed cluster");
+      init_frames(file, offset + 1, p ? p + 1 : 0, size > 0 ? size - 1 : 0);
+      return;
+    }
+
+    frameSize = 0;
+    setCompression(static_cast<CompressionType>(c));
+
+    switch (static_cast<CompressionType>(c))
+    {
+      case zimcompDefault:
+      case zimcompNone:
+        if (p)
         {
-#if defined(ENABLE_BZIP2)
-          log_debug("uncompress data (bzip2)");
-          zim::Bunzip2Stream is(in);
-          is.exceptions(std::ios::failbit | std::ios::badbit);
-          read_header(is);
-          read_content(is);
-#else
-          throw std::runtime_error("bzip2 not enabled in this library");
-#endif
-          break;
+          ptrstream in(p + 1, p + size);
+          offset_type a = read_header(in);
+          if (sizeof(char) + a + offsets.back() > size)
+            throw ZimFileFormatError("uncompressed cluster exceeds file");
+          startOffset = offset + sizeof(char) + a;
+          mappedData = p + sizeof(char) + a;
+          mappedFile = file;
         }
-
-      case zimcompLzma:
+        else
         {
-#if defined(ENABLE_LZMA)
-          log_debug("uncompress data (lzma)");
-          zim::UnlzmaStream is(in);
-          is.exceptions(std::ios::failbit | std::ios::badbit);
-          read_header(is);
-          read_content(is);
-#else
-          throw std::runtime_error("lzma not enabled in this library");
-#endif
-          break;
+          compoundstream in(*file, offset + 1, 16384);
+          startOffset = read_header(in);
+          startOffset += sizeof(char) + offset;
+          lazy_read_file = file;
+          lazy_read = true;
         }
+        break;
 
       default:
-        log_error("invalid compression flag " << c);
-        in.setstate(std::ios::failbit);
+        {
+          if (!partial && size > sizeof(char))
+          {
+            if (p)
+            {
+              read_block(p + 1, size - 1);
+              break;
+            }
+
+            std::vector<char> buffer;
+            DecoderPool::acquireBuffer(buffer, size - 1);
+            try
+            {
+              file->read(&buffer[0], offset + 1, buffer.size());
+              read_block(&buffer[0], buffer.size());
+            }
+            catch (...)
+            {
+              DecoderPool::releaseBuffer(buffer);
+              throw;
+            }
+            DecoderPool::releaseBuffer(buffer);
+            break;
+          }
+
+          std::istream* source = p ? static_cast<std::istream*>(new ptrstream(p + 1, p + size))
+                                   : static_cast<std::istream*>(new compoundstream(*file, offset + 1, 16384));
+          if (partial)
+          {
+            start_decoder(file, source);
+            break;
+          }
+
+          try
+          {
+            read_compressed(*source);
+          }
+          catch (...)
+          {
+            delete source;
+            throw;
+          }
+
+          bool fail = source->fail();
+          delete source;
+          if (fail)
+            throw ZimFileFormatError("error reading cluster data");
+        }
         break;
     }
   }
 
-  std::ostream& operator<< (std::ostream& out, const ClusterImpl& clusterImpl)
+  void ClusterImpl::init_frames(FileCompound* file, offset_type offset, const char* p, offset_type size)
   {
-    log_trace("write cluster");
+    // The frame table has the uncompressed frame size, the number of
+    // frames and the end of each compressed frame. Without a size, the
+    // cluster may extend to the end of the file.
+    if (!p && size == 0)
+      size = file->fsize() > offset ? file->fsize() - offset : 0;
+
+    size_type head[2];
+    if (size < sizeof(head))
+      throw ZimFileFormatError("framed cluster exceeds file");
+    if (p)
+      std::memcpy(head, p, sizeof(head));
+    else
+      file->read(reinterpret_cast<char*>(head), offset, sizeof(head));
 
-    out.put(static_cast<char>(clusterImpl.getCompression()));
+    frameSize = fromLittleEndian(&head[0]);
+    size_type count = fromLittleEndian(&head[1]);
+    if (frameSize == 0 || count == 0)
+      throw ZimFileFormatError("invalid frame table");
 
-    switch(clusterImpl.getCompression())
+    // check the count before allocating the table
+    offset_type tableSize = sizeof(head) + offset_type(count) * sizeof(size_type);
+    if (tableSize > size)
+      throw ZimFileFormatError("framed cluster exceeds file");
+
+    frameEnds.resize(count);
+    if (p)
+      std::memcpy(&frameEnds[0], p + sizeof(head), count * sizeof(size_type));
+    else
+      file->read(reinterpret_cast<char*>(&frameEnds[0]), offset + sizeof(head), count * sizeof(size_type));
+
+    size_type last = 0;
+    for (size_type n = 0; n < count; ++n)
     {
-      case zimcompDefault:
-      case zimcompNone:
-        clusterImpl.write(out);
+      frameEnds[n] = fromLittleEndian(&frameEnds[n]);
+      if (frameEnds[n] <= last)
+        throw ZimFileFormatError("invalid frame table");
+      last = frameEnds[n];
+    }
+
+    if (tableSize + frameEnds.back() > size)
+      throw ZimFileFormatError("framed cluster exceeds file");
+
+    frame_file = file;
+    frameData = p ? p + tableSize : 0;
+    frameOffset = offset + tableSize;
+    frameDecoded.assign(count, false);
+
+    // decompress the leading frames up to the end of the offsets
+    std::vector<char> head_data;
+    size_type a = 0;
+    size_type n = 0;
+    while (n < count && (a == 0 || head_data.size() < a))
+    {
+      head_data.resize((n + 1) * frameSize);
+      size_type len = decode_frame(n, &head_data[n * frameSize], frameSize);
+      head_data.resize(n * frameSize + len);
+      ++n;
+
+      if (a == 0 && head_data.size() >= sizeof(size_type))
+      {
+        std::memcpy(&a, &head_data[0], sizeof(size_type));
+        a = fromLittleEndian(&a);
+        if (a < sizeof(size_type))
+          throw ZimFileFormatError("invalid first offset in cluster");
+      }
+
+      if (len < frameSize)
         break;
+    }
+
+    if (a == 0 || head_data.size() < a)
+      throw ZimFileFormatError("invalid framed cluster");
+
+    ptrstream in(&head_data[0], &head_data[0] + a);
+    headerSize = read_header(in);
+
+    offset_type total = offset_type(headerSize) + offsets.back();
+    if (total > offset_type(count) * frameSize
+      || head_data.size() != std::min<offset_type>(total, offset_type(n) * frameSize))
+      throw ZimFileFormatError("invalid framed cluster");
 
+    DecoderPool::acquireBuffer(_data, offsets.back());
+    std::copy(head_data.begin() + a, head_data.end(), _data.begin());
+    for (size_type i = 0; i < n; ++i)
+      frameDecoded[i] = true;
+
+    log_debug("framed cluster with " << count << " frames of " << frameSize << " bytes; " << n << " decompressed");
+  }
+
+  size_type ClusterImpl::decode_frame(size_type n, char* dest, size_type size)
+  {
+    size_type begin = n > 0 ? frameEnds[n - 1] : 0;
+    size_type length = frameEnds[n] - begin;
+
+    std::vector<char> buffer;
+    size_type count;
+    try
+    {
+      const char* src = frameData ? frameData + begin : 0;
+      if (!src)
+      {
+        DecoderPool::acquireBuffer(buffer, length);
+        frame_file->read(&buffer[0], frameOffset + begin, length);
+        src = &buffer[0];
+      }
+
+      BlockDecoder* decoder = DecoderPool::acquireBlockDecoder(getCompression(), src, length, dictionary);
+      if (!decoder)
+        throw ZimFileFormatError("error reading cluster data");
+
+      try
+      {
+        count = decoder->readSome(dest, size);
+      }
+      catch (...)
+      {
+        DecoderPool::releaseBlockDecoder(getCompression(), decoder);
+        throw;
+      }
+
+      DecoderPool::releaseBlockDecoder(getCompression(), decoder);
+    }
+    catch (...)
+    {
+      DecoderPool::releaseBuffer(buffer);
+      throw;
+    }
+
+    DecoderPool::releaseBuffer(buffer);
+    return count;
+  }
+
+  void ClusterImpl::read_frames(size_type begin, size_type end)
+  {
+    if (begin >= end)
+      return;
+
+    MutexLock lock(lazy_read_mutex);
+
+    // frames after the leading ones start in the data
+    offset_type total = offset_type(headerSize) + offsets.back();
+    for (offset_type n = (headerSize + begin) / frameSize; n * frameSize < headerSize + end; ++n)
+    {
+      if (frameDecoded[n])
+        continue;
+
+      offset_type start = n * frameSize;
+      size_type len = std::min<offset_type>(frameSize, total - start);
+      log_debug("decompress frame " << n << " of " << frameEnds.size());
+      if (decode_frame(n, &_data[start - headerSize], len) != len)
+        throw ZimFileFormatError("compressed cluster data ends early");
+      frameDecoded[n] = true;
+    }
+  }
+
+  void ClusterImpl::start_decoder(FileCompound* file, std::istream* source)
+  {
+    decoder_source = source;
+    decoder_file = file;
+
+    decoder = DecoderPool::acquire(getCompression(), *source, dictionary);
+    if (!decoder)
+      throw ZimFileFormatError("error reading cluster data");
+
+    read_header(*decoder);
+
+    // the data is decompressed into place, so that pointers into it stay
+    // valid, when more data is decompressed
+    DecoderPool::acquireBuffer(_data, offsets.back());
+    decoded = 0;
+
+    if (_data.empty())
+    {
+      DecoderPool::release(getCompression(), decoder);
+      delete decoder_source;
+      decoder = 0;
+      decoder_source = 0;
+    }
+  }
+
+  void ClusterImpl::read_compressed(std::istream& in)
+  {
+    std::istream* is = DecoderPool::acquire(getCompression(), in, dictionary);
+    if (!is)
+    {
+      in.setstate(std::ios::failbit);
+      return;
+    }
+
+    try
+    {
+      read_header(*is);
+      read_content(*is);
+    }
+    catch (...)
+    {
+      DecoderPool::release(getCompression(), is);
+      throw;
+    }
+
+    DecoderPool::release(getCompression(), is);
+  }
+
+  void ClusterImpl::read_block(const char* src, size_type size)
+  {
+    BlockDecoder* decoder = DecoderPool::acquireBlockDecoder(getCompression(), src, size, dictionary);
+    if (!decoder)
+      throw ZimFileFormatError("error reading cluster data");
+
+    try
+    {
+      // decompress the offsets and parse them, then the data straight into
+      // the cluster buffer
+      size_type offset;
+      decoder->read(reinterpret_cast<char*>(&offset), sizeof(offset));
+      size_type a = fromLittleEndian(&offset);
+      if (a < sizeof(size_type))
+        throw ZimFileFormatError("invalid first offset in cluster");
+
+      std::vector<char> header(a);
+      std::memcpy(&header[0], &offset, sizeof(offset));
+      decoder->read(&header[sizeof(offset)], a - sizeof(offset));
+
+      ptrstream in(&header[0], &header[0] + a);
+      read_header(in);
+
+      DecoderPool::acquireBuffer(_data, offsets.back());
+      if (!_data.empty())
+        decoder->read(&_data[0], _data.size());
+    }
+    catch (...)
+    {
+      DecoderPool::releaseBlockDecoder(getCompression(), decoder);
+      throw;
+    }
+
+    DecoderPool::releaseBlockDecoder(getCompression(), decoder);
+  }
+
+  void ClusterImpl::write_compressed(std::ostream& out, const char* data, size_type size) const
+  {
+    // compresses the cluster or, when given, just the data
+    switch(getCompression())
+    {
       case zimcompZip:
         {
 #if defined(ENABLE_ZLIB)
           log_debug("compress data (zlib)");
           zim::DeflateStream os(out);
           os.exceptions(std::ios::failbit | std::ios::badbit);
-          clusterImpl.write(os);
+          if (data)
+            os.write(data, size);
+          else
+            write(os);
           os.flush();
 #else
           throw std::runtime_error("zlib not enabled in this library");
@@ -292,7 +719,10 @@ namespace zim
           log_debug("compress data (bzip2)");
           zim::Bzip2Stream os(out);
           os.exceptions(std::ios::failbit | std::ios::badbit);
-          clusterImpl.write(os);
+          if (data)
+            os.write(data, size);
+          else
+            write(os);
           os.end();
 #else
           throw std::runtime_error("bzip2 not enabled in this library");
@@ -326,7 +756,10 @@ namespace zim
           log_debug("compress data (lzma, " << std::hex << lzmaPreset << ")");
           zim::LzmaStream os(out, lzmaPreset);
           os.exceptions(std::ios::failbit | std::ios::badbit);
-          clusterImpl.write(os);
+          if (data)
+            os.write(data, size);
+          else
+            write(os);
           os.end();
 #else
           throw std::runtime_error("lzma not enabled in this library");
@@ -334,12 +767,114 @@ namespace zim
           break;
         }
 
+      case zimcompZstd:
+        {
+#if defined(ENABLE_ZSTD)
+          // the compression level is read from ZIM_ZSTD_LEVEL
+          int zstdLevel = envValue("ZIM_ZSTD_LEVEL", 19);
+
+          const Dictionary* dict = getDictionary();
+          log_debug("compress data (zstd, " << zstdLevel << (dict ? ", with dictionary" : "") << ")");
+          zim::ZstdStream os(out, zstdLevel, 8192,
+                             dict ? dict->getData() : 0, dict ? dict->getSize() : 0);
+          os.exceptions(std::ios::failbit | std::ios::badbit);
+          if (data)
+            os.write(data, size);
+          else
+            write(os);
+          os.end();
+#else
+          throw std::runtime_error("zstd not enabled in this library");
+#endif
+          break;
+        }
+
+      case zimcompLz4:
+        {
+#if defined(ENABLE_LZ4)
+          // the compression level is read from ZIM_LZ4_LEVEL
+          int lz4Level = envValue("ZIM_LZ4_LEVEL", 9);
+
+          log_debug("compress data (lz4, " << lz4Level << ")");
+          zim::Lz4Stream os(out, lz4Level);
+          os.exceptions(std::ios::failbit | std::ios::badbit);
+          if (data)
+            os.write(data, size);
+          else
+            write(os);
+          os.end();
+#else
+          throw std::runtime_error("lz4 not enabled in this library");
+#endif
+          break;
+        }
+
       default:
         std::ostringstream msg;
-        msg << "invalid compression flag " << clusterImpl.getCompression();
+        msg << "invalid compression flag " << getCompression();
         log_error(msg.str());
         throw std::runtime_error(msg.str());
     }
+  }
+
+  void ClusterImpl::write_framed(std::ostream& out) const
+  {
+    std::ostringstream content;
+    write(content);
+    std::string raw = content.str();
+
+    std::vector<std::string> frames;
+    for (std::string::size_type pos = 0; pos < raw.size(); pos += frameSize)
+    {
+      std::ostringstream frame;
+      write_compressed(frame, raw.data() + pos, std::min<std::string::size_type>(frameSize, raw.size() - pos));
+      frames.push_back(frame.str());
+    }
+
+    log_debug("write " << frames.size() << " frames of " << frameSize << " bytes");
+
+    size_type v = fromLittleEndian(&frameSize);
+    out.write(reinterpret_cast<const char*>(&v), sizeof(size_type));
+    size_type count = frames.size();
+    v = fromLittleEndian(&count);
+    out.write(reinterpret_cast<const char*>(&v), sizeof(size_type));
+
+    size_type end = 0;
+    for (std::vector<std::string>::const_iterator it = frames.begin(); it != frames.end(); ++it)
+    {
+      end += it->size();
+      v = fromLittleEndian(&end);
+      out.write(reinterpret_cast<const char*>(&v), sizeof(size_type));
+    }
+
+    for (std::vector<std::string>::const_iterator it = frames.begin(); it != frames.end(); ++it)
+      out.write(it->data(), it->size());
+  }
+
+  std::ostream& operator<< (std::ostream& out, const ClusterImpl& clusterImpl)
+  {
+    log_trace("write cluster");
+
+    if (clusterImpl.getFrameSize() > 0 && clusterImpl.isCompressed())
+    {
+      out.put(static_cast<char>(clusterImpl.getCompression() | framedFlag));
+      clusterImpl.write_framed(out);
+      return out;
+    }
+
+    out.put(static_cast<char>(clusterImpl.getCompression()));
+
+    switch(clusterImpl.getCompression())
+    {
+      case zimcompDefault:
+      case zimcompNone:
+        clusterImpl.write(out);
+        break;
+
+      default:
+        clusterImpl.write_compressed(out);
+        break;
+    }
 
     return out;
   }
@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include "decoderpool.h"
+#include "blockdecoder.h"
+#include <zim/mutex.h>
+#include <pthread.h>
+#include <iostream>
+#include <stdexcept>
+#include "envvalue.h"
+#include "log.h"
+#include "config.h"
+
+#if defined(ENABLE_ZLIB)
+#include <zim/inflatestream.h>
+#endif
+
+#if defined(ENABLE_BZIP2)
+#include <zim/bunzip2stream.h>
+#endif
+
+#if defined(ENABLE_LZMA)
+#include <zim/unlzmastream.h>
+#endif
+
+#if defined(ENABLE_ZSTD)
+#include <zim/unzstdstream.h>
+#include <zim/dictionary.h>
+#endif
+
+#if defined(ENABLE_LZ4)
+#include <zim/unlz4stream.h>
+#endif
+
+log_define("zim.decoderpool")
+
+namespace zim
+{
+  namespace
+  {
+    typedef std::vector<std::istream*> Decoders;
+    typedef std::vector<BlockDecoder*> BlockDecoders;
+    typedef std::vector<std::vector<char>*> Buffers;
+
+    // The pools are never destroyed, so that clusters released by static
+    // objects at exit can still return their buffers.
+    struct Pools
+    {
+      Mutex mutex;
+      Decoders zipDecoders;
+      Decoders bzip2Decoders;
+      Decoders lzmaDecoders;
+      Decoders zstdDecoders;
+      Decoders lz4Decoders;
+      BlockDecoders zipBlockDecoders;
+      BlockDecoders bzip2BlockDecoders;
+      BlockDecoders lzmaBlockDecoders;
+      BlockDecoders zstdBlockDecoders;
+      BlockDecoders lz4BlockDecoders;
+      Buffers buffers;
+    };
+
+    Pools& pools()
+    {
+      static Pools* p = new Pools();
+      return *p;
+    }
+
+    unsigned maxPooled()
+    {
+      static unsigned n = envValue("ZIM_DECODERPOOL", 4);
+      return n;
+    }
+
+    Decoders* getDecoders(CompressionType compression)
+    {
+      switch (compression)
+      {
+        case zimcompZip:   return &pools().zipDecoders;
+        case zimcompBzip2: return &pools().bzip2Decoders;
+        case zimcompLzma:  return &pools().lzmaDecoders;
+        case zimcompZstd:  return &pools().zstdDecoders;
+        case zimcompLz4:   return &pools().lz4Decoders;
+        default:           return 0;
+      }
+    }
+
+    BlockDecoders* getBlockDecoders(CompressionType compression)
+    {
+      switch (compression)
+      {
+        case zimcompZip:   return &pools().zipBlockDecoders;
+        case zimcompBzip2: return &pools().bzip2BlockDecoders;
+        case zimcompLzma:  return &pools().lzmaBlockDecoders;
+        case zimcompZstd:  return &pools().zstdBlockDecoders;
+        case zimcompLz4:   return &pools().lz4BlockDecoders;
+        default:           return 0;
+      }
+    }
+
+    template <typename T>
+    T* takeShared(std::vector<T*>& pool)
+    {
+      MutexLock lock(pools().mutex);
+      if (pool.empty())
+        return 0;
+      T* ret = pool.back();
+      pool.pop_back();
+      return ret;
+    }
+
+    template <typename T>
+    void putShared(std::vector<T*>& pool, T* obj)
+    {
+      {
+        MutexLock lock(pools().mutex);
+        if (pool.size() < maxPooled())
+        {
+          pool.push_back(obj);
+          return;
+        }
+      }
+
+      delete obj;
+    }
+
+    void putSharedBuffer(std::vector<char>* buffer)
+    {
+      {
+        MutexLock lock(pools().mutex);
+        Buffers& buffers = pools().buffers;
+        if (buffers.size() < maxPooled())
+        {
+          buffers.push_back(buffer);
+          return;
+        }
+
+        // keep the larger buffers
+        for (Buffers::iterator it = buffers.begin(); it != buffers.end(); ++it)
+        {
+          if ((*it)->capacity() < buffer->capacity())
+            std::swap(*it, buffer);
+        }
+      }
+
+      delete buffer;
+    }
+
+    // the compression types, which have a slot in the pools of the threads
+    const CompressionType compressions[] = {
+      zimcompZip, zimcompBzip2, zimcompLzma, zimcompZstd, zimcompLz4
+    };
+    const unsigned countCompressions = sizeof(compressions) / sizeof(compressions[0]);
+
+    int slot(CompressionType compression)
+    {
+      for (unsigned n = 0; n < countCompressions; ++n)
+        if (compressions[n] == compression)
+          return static_cast<int>(n);
+      return -1;
+    }
+
+    // objects kept by one thread; they are used without locking
+    struct LocalPool
+    {
+      std::istream* decoders[countCompressions];
+      BlockDecoder* blockDecoders[countCompressions];
+      std::vector<char>* buffer;
+    };
+
+    pthread_key_t localKey;
+    pthread_once_t localOnce = PTHREAD_ONCE_INIT;
+
+    // called, when a thread exits; the thread specific value is already
+    // reset, so the objects go to the shared pools directly
+    void releaseLocalPool(void* arg)
+    {
+      LocalPool* local = static_cast<LocalPool*>(arg);
+      for (unsigned n = 0; n < countCompressions; ++n)
+      {
+        if (local->decoders[n])
+          putShared(*getDecoders(compressions[n]), local->decoders[n]);
+        if (local->blockDecoders[n])
+          putShared(*getBlockDecoders(compressions[n]), local->blockDecoders[n]);
+      }
+
+      if (local->buffer)
+        putSharedBuffer(local->buffer);
+
+      delete local;
+    }
+
+    void createLocalKey()
+    {
+      ::pthread_key_create(&localKey, releaseLocalPool);
+    }
+
+    LocalPool& localPool()
+    {
+      ::pthread_once(&localOnce, createLocalKey);
+      LocalPool* local = static_cast<LocalPool*>(::pthread_getspecific(localKey));
+      if (!local)
+      {
+        local = new LocalPool();
+        ::pthread_setspecific(localKey, local);
+      }
+      return *local;
+    }
+  }
+
+  std::istream* DecoderPool::acquire(CompressionType compression, std::istream& source,
+                                     const Dictionary* dictionary)
+  {
+    std::istream* is = 0;
+
+    int s = slot(compression);
+    if (s >= 0)
+    {
+      LocalPool& local = localPool();
+      is = local.decoders[s];
+      local.decoders[s] = 0;
+      if (!is)
+        is = takeShared(*getDecoders(compression));
+    }
+
+    try
+    {
+      switch (compression)
+      {
+        case zimcompZip:
+#if defined(ENABLE_ZLIB)
+          if (is)
+            static_cast<zim::InflateStream*>(is)->reset(source);
+          else
+          {
+            log_debug("create zlib decoder");
+            is = new zim::InflateStream(source);
+          }
+#else
+          throw std::runtime_error("zlib not enabled in this library");
+#endif
+          break;
+
+        case zimcompBzip2:
+#if defined(ENABLE_BZIP2)
+          if (is)
+            static_cast<zim::Bunzip2Stream*>(is)->reset(source);
+          else
+          {
+            log_debug("create bzip2 decoder");
+            is = new zim::Bunzip2Stream(source);
+          }
+#else
+          throw std::runtime_error("bzip2 not enabled in this library");
+#endif
+          break;
+
+        case zimcompLzma:
+#if defined(ENABLE_LZMA)
+          if (is)
+            static_cast<zim::UnlzmaStream*>(is)->reset(source);
+          else
+          {
+            log_debug("create lzma decoder");
+            is = new zim::UnlzmaStream(source);
+          }
+#else
+          throw std::runtime_error("lzma not enabled in this library");
+#endif
+          break;
+
+        case zimcompZstd:
+#if defined(ENABLE_ZSTD)
+          {
+            const ZSTD_DDict* dict = dictionary ? static_cast<const ZSTD_DDict*>(dictionary->getZstdDDict()) : 0;
+            if (is)
+              static_cast<zim::UnzstdStream*>(is)->reset(source, dict);
+            else
+            {
+              log_debug("create zstd decoder");
+              is = new zim::UnzstdStream(source, 8192, dict);
+            }
+          }
+#else
+          (void)dictionary;
+          throw std::runtime_error("zstd not enabled in this library");
+#endif
+          break;
+
+        case zimcompLz4:
+#if defined(ENABLE_LZ4)
+          if (is)
+            static_cast<zim::Unlz4Stream*>(is)->reset(source);
+          else
+          {
+            log_debug("create lz4 decoder");
+            is = new zim::Unlz4Stream(source);
+          }
+#else
+          throw std::runtime_error("lz4 not enabled in this library");
+#endif
+          break;
+
+        default:
+          log_error("invalid compression flag " << compression);
+          return 0;
+      }
+    }
+    catch (...)
+    {
+      delete is;
+      throw;
+    }
+
+    is->exceptions(std::ios::failbit | std::ios::badbit);
+    return is;
+  }
+
+  void DecoderPool::release(CompressionType compression, std::istream* decoder)
+  {
+    if (!decoder)
+      return;
+
+    int s = slot(compression);
+    if (s < 0)
+    {
+      delete decoder;
+      return;
+    }
+
+    LocalPool& local = localPool();
+    if (!local.decoders[s])
+      local.decoders[s] = decoder;
+    else
+      putShared(*getDecoders(compression), decoder);
+  }
+
+  BlockDecoder* DecoderPool::acquireBlockDecoder(CompressionType compression,
+                                                 const char* src, size_type size,
+                                                 const Dictionary* dictionary)
+  {
+    BlockDecoder* decoder = 0;
+
+    int s = slot(compression);
+    if (s >= 0)
+    {
+      LocalPool& local = localPool();
+      decoder = local.blockDecoders[s];
+      local.blockDecoders[s] = 0;
+      if (!decoder)
+        decoder = takeShared(*getBlockDecoders(compression));
+    }
+
+    if (!decoder)
+    {
+      decoder = BlockDecoder::create(compression);
+      if (!decoder)
+        return 0;
+    }
+
+    try
+    {
+      decoder->reset(src, size, dictionary);
+    }
+    catch (...)
+    {
+      delete decoder;
+      throw;
+    }
+
+    return decoder;
+  }
+
+  void DecoderPool::releaseBlockDecoder(CompressionType compression, BlockDecoder* decoder)
+  {
+    if (!decoder)
+      return;
+
+    int s = slot(compression);
+    if (s < 0)
+    {
+      delete decoder;
+      return;
+    }
+
+    LocalPool& local = localPool();
+    if (!local.blockDecoders[s])
+      local.blockDecoders[s] = decoder;
+    else
+      putShared(*getBlockDecoders(compression), decoder);
+  }
+
+  void DecoderPool::acquireBuffer(std::vector<char>& data, size_type size)
+  {
+    if (data.capacity() < size)
+    {
+      // Take the smallest buffer, which is large enough, but not more
+      // than twice the size: the cluster cache charges the size of the
+      // data, so a small cluster must not hold a large buffer.
+      LocalPool& local = localPool();
+      std::vector<char>* buffer = local.buffer;
+      if (buffer && buffer->capacity() >= size && buffer->capacity() / 2 <= size)
+        local.buffer = 0;
+      else
+      {
+        buffer = 0;
+        MutexLock lock(pools().mutex);
+        Buffers& buffers = pools().buffers;
+        Buffers::iterator best = buffers.end();
+        for (Buffers::iterator it = buffers.begin(); it != buffers.end(); ++it)
+        {
+          std::vector<char>::size_type capacity = (*it)->capacity();
+          if (capacity >= size && capacity / 2 <= size
+            && (best == buffers.end() || capacity < (*best)->capacity()))
+            best = it;
+        }
+
+        if (best != buffers.end())
+        {
+          buffer = *best;
+          buffers.erase(best);
+        }
+      }
+
+      if (buffer)
+      {
+        data.swap(*buffer);
+        releaseBuffer(*buffer);
+        delete buffer;
+      }
+    }
+
+    data.resize(size);
+  }
+
+  void DecoderPool::releaseBuffer(std::vector<char>& data)
+  {
+    if (data.capacity() == 0)
+      return;
+
+    std::vector<char>* buffer = new std::vector<char>();
+    buffer->swap(data);
+    buffer->clear();
+
+    LocalPool& local = localPool();
+    if (!local.buffer)
+      local.buffer = buffer;
+    else
+      putSharedBuffer(buffer);
+  }
+}
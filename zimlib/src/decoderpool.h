@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_DECODERPOOL_H
+#define ZIM_DECODERPOOL_H
+
+#include <zim/zim.h>
+#include <iosfwd>
+#include <vector>
+
+namespace zim
+{
+  class BlockDecoder;
+  class Dictionary;
+
+  /**
+     Keeps decompressor streams and cluster buffers for reuse.
+
+     Creating a decompressor allocates its i/o buffer and the decoder state,
+     which is the whole dictionary for lzma. Released decompressors are
+     reset instead when a cluster of the same compression type is read.
+
+     Each thread keeps the last released object of each kind for itself
+     and takes it back without locking. Further objects go to pools shared
+     by all threads, which hold at most ZIM_DECODERPOOL (default 4) idle
+     objects of each kind. A thread hands its objects to the shared pools,
+     when it exits.
+   */
+  class DecoderPool
+  {
+    public:
+      /// Returns a decompressor reading from source or 0, if the
+      /// compression type is unknown. The stream throws on errors. The
+      /// dictionary may be 0 and must stay valid, while the stream is used.
+      static std::istream* acquire(CompressionType compression, std::istream& source,
+                                   const Dictionary* dictionary = 0);
+
+      /// Takes back a decompressor returned by acquire. It is deleted, when
+      /// the pool is full.
+      static void release(CompressionType compression, std::istream* decoder);
+
+      /// Returns a block decoder for the data [src, src + size) or 0, if
+      /// the compression type is unknown.
+      static BlockDecoder* acquireBlockDecoder(CompressionType compression,
+                                               const char* src, size_type size,
+                                               const Dictionary* dictionary = 0);
+
+      /// Takes back a decoder returned by acquireBlockDecoder.
+      static void releaseBlockDecoder(CompressionType compression, BlockDecoder* decoder);
+
+      /// Resizes data to size, reusing the memory of a released buffer if
+      /// one is large enough.
+      static void acquireBuffer(std::vector<char>& data, size_type size);
+
+      /// Takes the memory of data for reuse and leaves data empty.
+      static void releaseBuffer(std::vector<char>& data);
+  };
+}
+
+#endif // ZIM_DECODERPOOL_H
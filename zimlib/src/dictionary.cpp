@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <zim/dictionary.h>
+#include <stdexcept>
+#include "log.h"
+#include "config.h"
+
+#if defined(ENABLE_ZSTD)
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+log_define("zim.dictionary")
+
+namespace zim
+{
+  const char* const Dictionary::url = "ZstdDictionary";
+
+  Dictionary::Dictionary(const char* data_, size_type size)
+    : data(data_, data_ + size),
+      zstdDDict(0)
+  {
+#if defined(ENABLE_ZSTD)
+    if (size > 0)
+    {
+      zstdDDict = ::ZSTD_createDDict(data_, size);
+      if (zstdDDict == 0)
+        throw std::runtime_error("failed to load zstd dictionary");
+    }
+#endif
+  }
+
+  Dictionary::~Dictionary()
+  {
+#if defined(ENABLE_ZSTD)
+    ::ZSTD_freeDDict(static_cast<ZSTD_DDict*>(zstdDDict));
+#endif
+  }
+
+  unsigned Dictionary::getId() const
+  {
+#if defined(ENABLE_ZSTD)
+    return data.empty() ? 0 : ::ZDICT_getDictID(&data[0], data.size());
+#else
+    return 0;
+#endif
+  }
+
+  Dictionary* Dictionary::train(const std::string& samples,
+                                const std::vector<size_type>& sampleSizes,
+                                size_type maxSize)
+  {
+#if defined(ENABLE_ZSTD)
+    if (samples.empty() || maxSize == 0)
+      return 0;
+
+    std::vector<size_t> sizes(sampleSizes.begin(), sampleSizes.end());
+    std::vector<char> buffer(maxSize);
+    size_t size = ::ZDICT_trainFromBuffer(&buffer[0], buffer.size(),
+                                          samples.data(), &sizes[0], sizes.size());
+    if (::ZDICT_isError(size))
+    {
+      log_warn("training dictionary failed: " << ::ZDICT_getErrorName(size));
+      return 0;
+    }
+
+    log_debug("trained dictionary of " << size << " bytes from " << sizes.size() << " samples");
+    return new Dictionary(&buffer[0], size);
+#else
+    (void)samples;
+    (void)sampleSizes;
+    (void)maxSize;
+    return 0;
+#endif
+  }
+}
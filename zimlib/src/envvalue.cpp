@@ -17,7 +17,9 @@
  *
  */
 
+#include "envvalue.h"
 #include <sstream>
+#include <string>
 #include <stdlib.h>
 
 namespace zim
@@ -33,7 +35,7 @@ namespace zim
     return def;
   }
 
-  unsigned envMemSize(const char* env, unsigned def)
+  offset_type envMemSize(const char* env, offset_type def)
   {
     const char* v = ::getenv(env);
     if (v)
@@ -49,10 +51,25 @@ namespace zim
         case 'm':
         case 'M': def *= 1024 * 1024; break;
         case 'g':
-        case 'G': def *= 1024 * 1024 * 1024; break;
+        case 'G': def *= 1024 * 1024 * 1024ull; break;
       }
     }
     return def;
   }
-}
 
+  CachePolicy envCachePolicy(const char* env, CachePolicy def)
+  {
+    const char* v = ::getenv(env);
+    if (v)
+    {
+      std::string s(v);
+      if (s == "winner")
+        def = CACHE_WINNER;
+      else if (s == "lru")
+        def = CACHE_LRU;
+      else if (s == "clock")
+        def = CACHE_CLOCK;
+    }
+    return def;
+  }
+}
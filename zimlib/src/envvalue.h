@@ -20,10 +20,15 @@
 #ifndef ZIM_ENVVALUE_H
 #define ZIM_ENVVALUE_H
 
+#include <zim/zim.h>
+#include <zim/cache.h>
+
 namespace zim
 {
   unsigned envValue(const char* env, unsigned def);
-  unsigned envMemSize(const char* env, unsigned def);
+  offset_type envMemSize(const char* env, offset_type def);
+  // accepts "winner", "lru" or "clock"
+  CachePolicy envCachePolicy(const char* env, CachePolicy def);
 }
 
 #endif // ZIM_ENVVALUE_H
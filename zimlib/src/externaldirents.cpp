@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include "externaldirents.h"
+#include <zim/endian.h>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include "log.h"
+
+log_define("zim.writer.externaldirents")
+
+namespace zim
+{
+  namespace
+  {
+    void writeString(std::ostream& out, const std::string& s)
+    {
+      size_type size = s.size();
+      out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+      out.write(s.data(), size);
+    }
+
+    bool readString(std::istream& in, std::string& s)
+    {
+      size_type size;
+      if (in.read(reinterpret_cast<char*>(&size), sizeof(size)).gcount() != sizeof(size))
+        return false;
+      s.resize(size);
+      return size == 0
+          || in.read(&s[0], size).gcount() == static_cast<std::streamsize>(size);
+    }
+
+    template <typename T>
+    void writeValue(std::ostream& out, T value)
+    {
+      out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    bool readValue(std::istream& in, T& value)
+    {
+      return in.read(reinterpret_cast<char*>(&value), sizeof(value)).gcount() == sizeof(value);
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // SortRecord
+  //
+  // The temporary files are read on the same machine, so numbers are
+  // stored in native byte order.
+  //
+  unsigned SortRecord<writer::Dirent>::size(const writer::Dirent& dirent)
+  {
+    return sizeof(dirent) + dirent.getAid().size() + dirent.getRedirectAid().size()
+         + dirent.getUrl().size() + dirent.getTitle().size() + dirent.getParameter().size();
+  }
+
+  void SortRecord<writer::Dirent>::write(std::ostream& out, const writer::Dirent& dirent)
+  {
+    writeValue(out, dirent.getMimeType());
+    writeValue(out, dirent.getVersion());
+    writeValue(out, dirent.getClusterNumber());
+    writeValue(out, dirent.getBlobNumber());
+    writeValue(out, dirent.getNamespace());
+    writeValue(out, dirent.isCompress());
+    writeString(out, dirent.getUrl());
+    writeString(out, dirent.getTitle());
+    writeString(out, dirent.getParameter());
+    writeString(out, dirent.getAid());
+    writeString(out, dirent.getRedirectAid());
+  }
+
+  bool SortRecord<writer::Dirent>::read(std::istream& in, writer::Dirent& dirent)
+  {
+    uint16_t mimeType;
+    size_type version, clusterNumber, blobNumber;
+    char ns;
+    bool compress;
+    std::string url, title, parameter, aid, redirectAid;
+
+    if (!readValue(in, mimeType)
+      || !readValue(in, version)
+      || !readValue(in, clusterNumber)
+      || !readValue(in, blobNumber)
+      || !readValue(in, ns)
+      || !readValue(in, compress)
+      || !readString(in, url)
+      || !readString(in, title)
+      || !readString(in, parameter)
+      || !readString(in, aid)
+      || !readString(in, redirectAid))
+      return false;
+
+    dirent = writer::Dirent();
+    dirent.setUrl(ns, url);
+    dirent.setTitle(title);
+    dirent.setParameter(parameter);
+    dirent.setAid(aid);
+    dirent.setRedirectAid(redirectAid);
+    dirent.setVersion(version);
+    dirent.setCompress(compress);
+
+    if (mimeType == Dirent::redirectMimeType)
+      dirent.setRedirect(0);
+    else if (mimeType == Dirent::linktargetMimeType)
+      dirent.setLinktarget();
+    else if (mimeType == Dirent::deletedMimeType)
+      dirent.setDeleted();
+    else
+      dirent.setArticle(mimeType, clusterNumber, blobNumber);
+
+    return true;
+  }
+
+  unsigned SortRecord<writer::ExternalDirents::KeyIdx>::size(const writer::ExternalDirents::KeyIdx& k)
+  {
+    return sizeof(k) + k.key.size();
+  }
+
+  void SortRecord<writer::ExternalDirents::KeyIdx>::write(std::ostream& out, const writer::ExternalDirents::KeyIdx& k)
+  {
+    writeString(out, k.key);
+    writeValue(out, k.idx);
+  }
+
+  bool SortRecord<writer::ExternalDirents::KeyIdx>::read(std::istream& in, writer::ExternalDirents::KeyIdx& k)
+  {
+    return readString(in, k.key) && readValue(in, k.idx);
+  }
+
+  namespace writer
+  {
+    //////////////////////////////////////////////////////////////////////
+    // ExternalDirents
+    //
+    ExternalDirents::ExternalDirents(const std::string& tmpprefix_, offset_type budget_)
+      : tmpprefix(tmpprefix_),
+        budget(budget_),
+        byAid(tmpprefix_ + ".aid", budget_),
+        byUrl(tmpprefix_ + ".url", budget_),
+        titles(tmpprefix_ + ".title", budget_),
+        redirects(tmpprefix_ + ".redirect", budget_),
+        articleCount(0),
+        indexSize(0),
+        mainPage(std::numeric_limits<size_type>::max()),
+        layoutPage(std::numeric_limits<size_type>::max())
+    { }
+
+    void ExternalDirents::add(const Dirent& dirent)
+    {
+      byAid.add(dirent);
+    }
+
+    void ExternalDirents::sort(const std::string& mainAid, const std::string& layoutAid)
+    {
+      log_debug("sort " << byAid.size() << " directory entries (aid)");
+      byAid.sort();
+
+      resolveRedirects();
+      byAid.clear();
+
+      log_debug("sort " << byUrl.size() << " directory entries (url)");
+      byUrl.sort();
+
+      setIndexes(mainAid, layoutAid);
+    }
+
+    void ExternalDirents::resolveRedirects()
+    {
+      // The dirents are numbered in aid order. The redirect targets with the
+      // numbers of the redirects are sorted and merged with the aids to find
+      // the numbers of the targets. One bit per dirent marks the redirects
+      // and another the invalid redirects.
+      std::vector<bool> redirect(byAid.size(), false);
+      std::vector<bool> invalid(byAid.size(), false);
+      size_type redirectCount = 0;
+
+      KeySorter targets(tmpprefix + ".target", budget);
+      {
+        AidSorter::Reader in(byAid);
+        Dirent dirent;
+        for (size_type n = 0; in.get(dirent); ++n)
+        {
+          if (dirent.isRedirect())
+          {
+            redirect[n] = true;
+            ++redirectCount;
+            targets.add(KeyIdx(dirent.getRedirectAid(), n));
+          }
+        }
+      }
+      targets.sort();
+
+      // pairs of redirect and target numbers, sorted by redirect
+      IdxSorter* pointers = new IdxSorter(tmpprefix + ".pointer0", budget);
+      try
+      {
+        {
+          KeySorter::Reader tin(targets);
+          AidSorter::Reader in(byAid);
+          KeyIdx target;
+          Dirent dirent;
+          size_type n = 0;
+          bool more = in.get(dirent);
+          while (tin.get(target))
+          {
+            while (more && dirent.getAid() < target.key)
+            {
+              more = in.get(dirent);
+              ++n;
+            }
+
+            if (!more || dirent.getAid() != target.key)
+            {
+              log_debug("remove invalid redirection to " << target.key);
+              invalid[target.idx] = true;
+            }
+            else
+              pointers->add(IdxPair(target.idx, n));
+          }
+        }
+        targets.clear();
+        pointers->sort();
+
+        // Replace the target of each redirect by the target of its target,
+        // until all point to articles, which doubles the length of the
+        // chains followed in each round. A redirect pointing to an invalid
+        // redirect is invalid. Redirects, which do not reach an article,
+        // when the length exceeds the number of redirects, are in a loop.
+        for (unsigned round = 1; ; ++round)
+        {
+          IdxSorter byTarget(tmpprefix + ".bytarget", budget);
+          {
+            IdxSorter::Reader in(*pointers);
+            IdxPair p;
+            while (in.get(p))
+              if (!invalid[p.first])
+                byTarget.add(IdxPair(p.second, p.first));
+          }
+          byTarget.sort();
+
+          std::ostringstream fname;
+          fname << tmpprefix << ".pointer" << round;
+          IdxSorter* next = new IdxSorter(fname.str(), budget);
+          bool unresolved = false;
+          {
+            IdxSorter::Reader tin(byTarget);
+            IdxSorter::Reader in(*pointers);
+            IdxPair t;
+            IdxPair p;
+            bool more = in.get(p);
+            while (tin.get(t))
+            {
+              // t.first is the target of the redirect t.second
+              if (invalid[t.first])
+                invalid[t.second] = true;
+              else if (!redirect[t.first])
+                next->add(IdxPair(t.second, t.first));
+              else
+              {
+                while (more && p.first < t.first)
+                  more = in.get(p);
+                if (more && p.first == t.first)
+                {
+                  next->add(IdxPair(t.second, p.second));
+                  unresolved = true;
+                }
+                else
+                  invalid[t.second] = true;
+              }
+            }
+          }
+          next->sort();
+          delete pointers;
+          pointers = next;
+
+          if (!unresolved)
+            break;
+
+          if (round >= std::numeric_limits<size_type>::digits
+            || (size_type(1) << round) > redirectCount)
+          {
+            IdxSorter::Reader in(*pointers);
+            IdxPair p;
+            while (in.get(p))
+            {
+              if (redirect[p.second])
+              {
+                log_debug("remove redirect loop");
+                invalid[p.first] = true;
+              }
+            }
+            break;
+          }
+        }
+
+        // The aids of the final targets replace the redirect aids, so that
+        // the redirects point directly to articles.
+        IdxKeySorter finalTargets(tmpprefix + ".final", budget);
+        {
+          IdxSorter byTarget(tmpprefix + ".bytarget", budget);
+          {
+            IdxSorter::Reader in(*pointers);
+            IdxPair p;
+            while (in.get(p))
+              if (!invalid[p.first])
+                byTarget.add(IdxPair(p.second, p.first));
+          }
+          byTarget.sort();
+
+          IdxSorter::Reader tin(byTarget);
+          AidSorter::Reader in(byAid);
+          IdxPair t;
+          Dirent dirent;
+          size_type n = 0;
+          bool more = in.get(dirent);
+          while (tin.get(t))
+          {
+            while (more && n < t.first)
+            {
+              more = in.get(dirent);
+              ++n;
+            }
+            finalTargets.add(KeyIdx(dirent.getAid(), t.second));
+          }
+        }
+        finalTargets.sort();
+
+        delete pointers;
+        pointers = 0;
+
+        // copy the valid dirents
+        IdxKeySorter::Reader tin(finalTargets);
+        AidSorter::Reader in(byAid);
+        KeyIdx target;
+        bool moreTargets = tin.get(target);
+        Dirent dirent;
+        for (size_type n = 0; in.get(dirent); ++n)
+        {
+          if (invalid[n])
+            continue;
+
+          if (redirect[n])
+          {
+            if (!moreTargets || target.idx != n)
+              throw std::runtime_error("internal error: redirect target not resolved");
+            dirent.setRedirectAid(target.key);
+            moreTargets = tin.get(target);
+          }
+
+          byUrl.add(dirent);
+        }
+      }
+      catch (...)
+      {
+        delete pointers;
+        throw;
+      }
+    }
+
+    void ExternalDirents::setIndexes(const std::string& mainAid, const std::string& layoutAid)
+    {
+      // The index of a dirent is its position in url order. The aids and the
+      // redirect targets are sorted with these indexes and merged to
+      // translate the redirect aids to indexes.
+      KeySorter aids(tmpprefix + ".aidindex", budget);
+      KeySorter targets(tmpprefix + ".target", budget);
+
+      {
+        UrlSorter::Reader in(byUrl);
+        Dirent dirent;
+        size_type idx;
+        for (idx = 0; in.get(dirent); ++idx)
+        {
+          aids.add(KeyIdx(dirent.getAid(), idx));
+          if (dirent.isRedirect())
+            targets.add(KeyIdx(dirent.getRedirectAid(), idx));
+          titles.add(KeyIdx(dirent.getNamespace() + dirent.getTitle(), idx));
+          indexSize += dirent.getDirentSize();
+
+          if (!mainAid.empty() && dirent.getAid() == mainAid)
+            mainPage = idx;
+          if (!layoutAid.empty() && dirent.getAid() == layoutAid)
+            layoutPage = idx;
+        }
+        articleCount = idx;
+      }
+
+      aids.sort();
+      targets.sort();
+
+      {
+        KeySorter::Reader ain(aids);
+        KeySorter::Reader tin(targets);
+        KeyIdx aid;
+        KeyIdx target;
+        bool more = ain.get(aid);
+        while (tin.get(target))
+        {
+          while (more && aid.key < target.key)
+            more = ain.get(aid);
+
+          if (!more || aid.key != target.key)
+          {
+            std::ostringstream msg;
+            msg << "internal error: redirect aid " << target.key << " not found";
+            log_fatal(msg.str());
+            throw std::runtime_error(msg.str());
+          }
+
+          redirects.add(IdxPair(target.idx, aid.idx));
+        }
+      }
+
+      redirects.sort();
+      titles.sort();
+    }
+
+    void ExternalDirents::writeUrlPtrs(std::ostream& out, offset_type indexPos) const
+    {
+      UrlSorter::Reader in(byUrl);
+      Dirent dirent;
+      offset_type off = indexPos;
+      while (in.get(dirent))
+      {
+        offset_type ptr0 = fromLittleEndian<offset_type>(&off);
+        out.write(reinterpret_cast<const char*>(&ptr0), sizeof(ptr0));
+        off += dirent.getDirentSize();
+      }
+    }
+
+    void ExternalDirents::writeTitleIdx(std::ostream& out) const
+    {
+      KeySorter::Reader in(titles);
+      KeyIdx title;
+      while (in.get(title))
+      {
+        size_type v = fromLittleEndian<size_type>(&title.idx);
+        out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+      }
+    }
+
+    void ExternalDirents::writeDirents(std::ostream& out, const std::vector<uint16_t>& mimeMapping) const
+    {
+      UrlSorter::Reader in(byUrl);
+      IdxSorter::Reader rin(redirects);
+      Dirent dirent;
+      IdxPair redirect;
+      bool moreRedirects = rin.get(redirect);
+      for (size_type idx = 0; in.get(dirent); ++idx)
+      {
+        if (dirent.isRedirect())
+        {
+          if (!moreRedirects || redirect.first != idx)
+            throw std::runtime_error("internal error: redirect index not found");
+          dirent.setRedirect(redirect.second);
+          moreRedirects = rin.get(redirect);
+        }
+        else if (dirent.isArticle())
+          dirent.setMimeType(mimeMapping[dirent.getMimeType()]);
+
+        out << dirent;
+      }
+    }
+
+  }
+}
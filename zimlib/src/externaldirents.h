@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_WRITER_EXTERNALDIRENTS_H
+#define ZIM_WRITER_EXTERNALDIRENTS_H
+
+#include <zim/writer/dirent.h>
+#include <zim/noncopyable.h>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "extsort.h"
+
+namespace zim
+{
+  namespace writer
+  {
+    /**
+       Keeps the directory entries of a zim file being created in sorted
+       temporary files, so that the memory used is bounded by a budget
+       instead of growing with the number of articles.
+
+       The dirents are added in any order. sort() points redirects directly
+       to the article at the end of their chain and removes redirects to
+       missing articles and redirect loops like it is done in memory. Then
+       it orders the dirents by url, numbers them and resolves the
+       redirects. Then the index parts of the zim file are
+       written by reading the sorted files.
+     */
+    class ExternalDirents : private NonCopyable
+    {
+      public:
+        struct CompareAid
+        {
+          bool operator() (const Dirent& d1, const Dirent& d2) const
+            { return compareAid(d1, d2); }
+        };
+
+        struct CompareUrl
+        {
+          bool operator() (const Dirent& d1, const Dirent& d2) const
+            { return compareUrl(d1, d2); }
+        };
+
+        // a string like an aid or a title with a dirent index
+        struct KeyIdx
+        {
+          std::string key;
+          size_type idx;
+
+          KeyIdx()
+            : idx(0)
+            { }
+          KeyIdx(const std::string& key_, size_type idx_)
+            : key(key_),
+              idx(idx_)
+            { }
+        };
+
+        struct CompareKey
+        {
+          bool operator() (const KeyIdx& k1, const KeyIdx& k2) const
+            { return k1.key < k2.key; }
+        };
+
+        struct CompareIdx
+        {
+          bool operator() (const KeyIdx& k1, const KeyIdx& k2) const
+            { return k1.idx < k2.idx; }
+        };
+
+        // e.g. the index of a redirect and the index of its target
+        struct IdxPair
+        {
+          size_type first;
+          size_type second;
+
+          IdxPair()
+            : first(0),
+              second(0)
+            { }
+          IdxPair(size_type first_, size_type second_)
+            : first(first_),
+              second(second_)
+            { }
+        };
+
+        struct CompareFirst
+        {
+          bool operator() (const IdxPair& p1, const IdxPair& p2) const
+            { return p1.first < p2.first; }
+        };
+
+        typedef ExternalSorter<Dirent, CompareAid> AidSorter;
+        typedef ExternalSorter<Dirent, CompareUrl> UrlSorter;
+        typedef ExternalSorter<KeyIdx, CompareKey> KeySorter;
+        typedef ExternalSorter<KeyIdx, CompareIdx> IdxKeySorter;
+        typedef ExternalSorter<IdxPair, CompareFirst> IdxSorter;
+
+      private:
+        std::string tmpprefix;
+        offset_type budget;
+
+        AidSorter byAid;
+        UrlSorter byUrl;
+        KeySorter titles;
+        IdxSorter redirects;
+
+        size_type articleCount;
+        offset_type indexSize;
+        size_type mainPage;
+        size_type layoutPage;
+
+        void resolveRedirects();
+        void setIndexes(const std::string& mainAid, const std::string& layoutAid);
+
+      public:
+        /// The names of the temporary files start with tmpprefix. About 4
+        /// times the budget is used in memory at most.
+        ExternalDirents(const std::string& tmpprefix, offset_type budget);
+
+        void add(const Dirent& dirent);
+
+        /// Prepares the index. The aids of the main and layout page are
+        /// looked up on the way.
+        void sort(const std::string& mainAid, const std::string& layoutAid);
+
+        size_type getArticleCount() const  { return articleCount; }
+        offset_type getIndexSize() const   { return indexSize; }
+        /// Returns the index of the main or layout page or
+        /// std::numeric_limits<size_type>::max(), if not found.
+        size_type getMainPage() const      { return mainPage; }
+        size_type getLayoutPage() const    { return layoutPage; }
+
+        /// Writes the url pointer list for dirents starting at indexPos.
+        void writeUrlPtrs(std::ostream& out, offset_type indexPos) const;
+        void writeTitleIdx(std::ostream& out) const;
+        /// Writes the dirents with their mime types translated by
+        /// mimeMapping.
+        void writeDirents(std::ostream& out, const std::vector<uint16_t>& mimeMapping) const;
+    };
+
+  }
+
+  template <>
+  struct SortRecord<writer::Dirent>
+  {
+    static unsigned size(const writer::Dirent& dirent);
+    static void write(std::ostream& out, const writer::Dirent& dirent);
+    static bool read(std::istream& in, writer::Dirent& dirent);
+  };
+
+  template <>
+  struct SortRecord<writer::ExternalDirents::KeyIdx>
+  {
+    static unsigned size(const writer::ExternalDirents::KeyIdx& k);
+    static void write(std::ostream& out, const writer::ExternalDirents::KeyIdx& k);
+    static bool read(std::istream& in, writer::ExternalDirents::KeyIdx& k);
+  };
+
+  template <>
+  struct SortRecord<writer::ExternalDirents::IdxPair>
+  {
+    static unsigned size(const writer::ExternalDirents::IdxPair& p)
+      { return sizeof(p); }
+    static void write(std::ostream& out, const writer::ExternalDirents::IdxPair& p)
+      { out.write(reinterpret_cast<const char*>(&p), sizeof(p)); }
+    static bool read(std::istream& in, writer::ExternalDirents::IdxPair& p)
+      { return in.read(reinterpret_cast<char*>(&p), sizeof(p)).gcount() == sizeof(p); }
+  };
+}
+
+#endif // ZIM_WRITER_EXTERNALDIRENTS_H
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_EXTSORT_H
+#define ZIM_EXTSORT_H
+
+#include <zim/zim.h>
+#include <zim/noncopyable.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+namespace zim
+{
+  /**
+     Describes how records of type T are stored by the ExternalSorter. It
+     must be specialized for each record type with the static methods
+
+       unsigned size(const T&)        the estimated memory used by a record
+       void write(std::ostream&, const T&)
+       bool read(std::istream&, T&)   returns false at the end of the file
+   */
+  template <typename T>
+  struct SortRecord;
+
+  /**
+     Sorts more records than fit in memory.
+
+     Records are collected in memory until their estimated size reaches the
+     budget. Then they are sorted and written to a temporary file as a run.
+     The sorted records are read by merging the runs, so the memory used is
+     bounded by the budget and a file buffer per run. When all records fit,
+     no file is written.
+
+     The sorted records may be read any number of times. The temporary files
+     are removed, when the sorter is cleared or destroyed.
+   */
+  template <typename T, typename Compare>
+  class ExternalSorter : private NonCopyable
+  {
+    public:
+      class Reader;
+      friend class Reader;
+
+    private:
+      std::string tmpprefix;
+      offset_type budget;
+      Compare compare;
+      std::vector<T> records;
+      offset_type recordsSize;
+      offset_type count;
+      std::vector<std::string> runs;
+
+      void writeRun()
+      {
+        std::sort(records.begin(), records.end(), compare);
+
+        std::ostringstream fname;
+        fname << tmpprefix << '.' << runs.size();
+        std::ofstream out(fname.str().c_str(), std::ios::out | std::ios::binary);
+        runs.push_back(fname.str());
+
+        for (typename std::vector<T>::const_iterator it = records.begin(); it != records.end(); ++it)
+          SortRecord<T>::write(out, *it);
+
+        if (!out)
+          throw std::runtime_error("failed to write temporary file " + fname.str());
+
+        records.clear();
+        recordsSize = 0;
+      }
+
+    public:
+      /// Temporary files are named tmpprefix followed by a number.
+      ExternalSorter(const std::string& tmpprefix_, offset_type budget_, Compare compare_ = Compare())
+        : tmpprefix(tmpprefix_),
+          budget(budget_),
+          compare(compare_),
+          recordsSize(0),
+          count(0)
+        { }
+
+      ~ExternalSorter()
+        { clear(); }
+
+      void add(const T& record)
+      {
+        records.push_back(record);
+        recordsSize += SortRecord<T>::size(record);
+        ++count;
+        if (recordsSize >= budget)
+          writeRun();
+      }
+
+      /// Sorts the records added. After that records are read with a
+      /// Reader and no more records may be added.
+      void sort()
+      {
+        if (runs.empty())
+          std::sort(records.begin(), records.end(), compare);
+        else if (!records.empty())
+          writeRun();
+      }
+
+      void clear()
+      {
+        std::vector<T>().swap(records);
+        recordsSize = 0;
+        count = 0;
+        for (std::vector<std::string>::const_iterator it = runs.begin(); it != runs.end(); ++it)
+          ::remove(it->c_str());
+        runs.clear();
+      }
+
+      offset_type size() const   { return count; }
+
+      /// Reads the sorted records.
+      class Reader : private NonCopyable
+      {
+          const ExternalSorter& sorter;
+          typename std::vector<T>::const_iterator it;
+          std::vector<std::ifstream*> files;
+          std::vector<T> heads;
+          std::vector<unsigned> heap;
+
+          // orders the heap, so that the run with the smallest head is on top
+          struct CompareHeads
+          {
+            const Reader& reader;
+            explicit CompareHeads(const Reader& reader_)
+              : reader(reader_)
+              { }
+            bool operator() (unsigned a, unsigned b) const
+              { return reader.sorter.compare(reader.heads[b], reader.heads[a]); }
+          };
+
+        public:
+          explicit Reader(const ExternalSorter& sorter_)
+            : sorter(sorter_),
+              it(sorter_.records.begin())
+          {
+            heads.resize(sorter.runs.size());
+            for (unsigned n = 0; n < sorter.runs.size(); ++n)
+            {
+              files.push_back(new std::ifstream(sorter.runs[n].c_str(), std::ios::in | std::ios::binary));
+              if (!*files.back())
+              {
+                close();
+                throw std::runtime_error("failed to read temporary file " + sorter.runs[n]);
+              }
+              if (SortRecord<T>::read(*files.back(), heads[n]))
+                heap.push_back(n);
+            }
+            std::make_heap(heap.begin(), heap.end(), CompareHeads(*this));
+          }
+
+          ~Reader()
+            { close(); }
+
+          void close()
+          {
+            for (std::vector<std::ifstream*>::iterator f = files.begin(); f != files.end(); ++f)
+              delete *f;
+            files.clear();
+            heap.clear();
+          }
+
+          /// Reads the next record; returns false at the end.
+          bool get(T& record)
+          {
+            if (sorter.runs.empty())
+            {
+              if (it == sorter.records.end())
+                return false;
+              record = *it++;
+              return true;
+            }
+
+            if (heap.empty())
+              return false;
+
+            std::pop_heap(heap.begin(), heap.end(), CompareHeads(*this));
+            unsigned n = heap.back();
+            record = heads[n];
+            if (SortRecord<T>::read(*files[n], heads[n]))
+              std::push_heap(heap.begin(), heap.end(), CompareHeads(*this));
+            else
+              heap.pop_back();
+            return true;
+          }
+      };
+  };
+
+}
+
+#endif // ZIM_EXTSORT_H
@@ -22,6 +22,10 @@
 #include "log.h"
 #include <zim/fileiterator.h>
 #include <zim/error.h>
+#include <zim/mutex.h>
+#include <zim/thread.h>
+#include <algorithm>
+#include <deque>
 
 log_define("zim.file")
 
@@ -39,6 +43,20 @@ namespace zim
         return ch - 'A' + 10;
       return -1;
     }
+
+    struct BlobRef
+    {
+      size_type cluster;
+      size_type blob;
+      size_type pos;
+
+      BlobRef(size_type cluster_, size_type blob_, size_type pos_)
+        : cluster(cluster_), blob(blob_), pos(pos_)
+        { }
+
+      bool operator< (const BlobRef& r) const
+        { return cluster < r.cluster || (cluster == r.cluster && blob < r.blob); }
+    };
   }
 
   Article File::getArticle(size_type idx) const
@@ -74,6 +92,314 @@ namespace zim
     return r.first ? *r.second : Article();
   }
 
+  std::vector<Blob> File::getArticleData(const std::vector<size_type>& idx)
+  {
+    std::vector<Blob> ret(idx.size());
+
+    std::vector<BlobRef> refs;
+    refs.reserve(idx.size());
+    for (size_type n = 0; n < idx.size(); ++n)
+    {
+      Dirent d = getDirent(idx[n]);
+      if (!d.isRedirect() && !d.isLinktarget() && !d.isDeleted())
+        refs.push_back(BlobRef(d.getClusterNumber(), d.getBlobNumber(), n));
+    }
+
+    std::sort(refs.begin(), refs.end());
+
+    Cluster cluster;
+    for (std::vector<BlobRef>::const_iterator it = refs.begin(); it != refs.end(); ++it)
+    {
+      if (it == refs.begin() || it->cluster != (it - 1)->cluster)
+        cluster = getCluster(it->cluster);
+      ret[it->pos] = cluster.getBlob(it->blob);
+    }
+
+    return ret;
+  }
+
+  namespace
+  {
+    // Collects the blobs of all articles in cluster and blob order. The
+    // dirents are read past the cache, like the clusters of a scan.
+    void getBlobRefsByCluster(FileImpl& impl, std::vector<BlobRef>& refs)
+    {
+      refs.reserve(impl.getCountArticles());
+      for (size_type idx = 0; idx < impl.getCountArticles(); ++idx)
+      {
+        Dirent d = impl.readDirent(idx);
+        if (!d.isRedirect() && !d.isLinktarget() && !d.isDeleted())
+          refs.push_back(BlobRef(d.getClusterNumber(), d.getBlobNumber(), idx));
+      }
+
+      std::sort(refs.begin(), refs.end());
+    }
+
+    class ScanThread : public Thread
+    {
+        File& file;
+        FileImpl& impl;
+        ArticleVisitor& visitor;
+        const std::vector<BlobRef>& refs;
+        // start of each cluster in refs; the last entry is refs.size()
+        const std::vector<size_type>& clusterStart;
+        size_type& nextCluster;
+        Mutex& mutex;
+        std::string& error;
+
+      protected:
+        void run();
+
+      public:
+        ScanThread(File& file_, FileImpl& impl_, ArticleVisitor& visitor_,
+                   const std::vector<BlobRef>& refs_,
+                   const std::vector<size_type>& clusterStart_,
+                   size_type& nextCluster_, Mutex& mutex_, std::string& error_)
+          : file(file_),
+            impl(impl_),
+            visitor(visitor_),
+            refs(refs_),
+            clusterStart(clusterStart_),
+            nextCluster(nextCluster_),
+            mutex(mutex_),
+            error(error_)
+          { }
+    };
+
+    void ScanThread::run()
+    {
+      try
+      {
+        while (true)
+        {
+          size_type n;
+
+          {
+            MutexLock lock(mutex);
+            if (!error.empty() || nextCluster + 1 >= clusterStart.size())
+              return;
+            n = nextCluster++;
+          }
+
+          // a scan reads every cluster once, so it bypasses the cache
+          Cluster cluster = impl.readCluster(refs[clusterStart[n]].cluster);
+          for (size_type r = clusterStart[n]; r < clusterStart[n + 1]; ++r)
+            visitor.visit(Article(file, refs[r].pos), cluster.getBlob(refs[r].blob));
+        }
+      }
+      catch (const std::exception& e)
+      {
+        MutexLock lock(mutex);
+        if (error.empty())
+          error = e.what();
+      }
+      catch (...)
+      {
+        MutexLock lock(mutex);
+        if (error.empty())
+          error = "unknown error";
+      }
+    }
+  }
+
+  namespace
+  {
+    // Reads the clusters of a scan in a background thread, up to readahead
+    // clusters ahead of the visitor. The clusters are handed over in order
+    // without going through the cache.
+    class ScanReader : public Thread
+    {
+        FileImpl& impl;
+        const std::vector<size_type>& clusters;
+        unsigned readahead;
+        Mutex mutex;
+        Condition cond;
+        std::deque<Cluster> ready;
+        bool stopped;
+        std::string error;
+
+      protected:
+        void run();
+
+      public:
+        ScanReader(FileImpl& impl_, const std::vector<size_type>& clusters_,
+                   unsigned readahead_)
+          : impl(impl_),
+            clusters(clusters_),
+            readahead(readahead_),
+            stopped(false)
+          { }
+
+        // returns the next cluster or throws the error of reading it
+        Cluster get();
+        void stop();
+    };
+
+    void ScanReader::run()
+    {
+      try
+      {
+        for (size_type n = 0; n < clusters.size(); ++n)
+        {
+          {
+            MutexLock lock(mutex);
+            while (ready.size() >= readahead && !stopped)
+              cond.wait(mutex);
+            if (stopped)
+              return;
+          }
+
+          Cluster cluster = impl.readCluster(clusters[n]);
+          impl.addPrefetched();
+
+          MutexLock lock(mutex);
+          ready.push_back(cluster);
+          cond.broadcast();
+        }
+      }
+      catch (const std::exception& e)
+      {
+        MutexLock lock(mutex);
+        error = e.what();
+        cond.broadcast();
+      }
+      catch (...)
+      {
+        MutexLock lock(mutex);
+        error = "unknown error";
+        cond.broadcast();
+      }
+    }
+
+    Cluster ScanReader::get()
+    {
+      MutexLock lock(mutex);
+      while (ready.empty() && error.empty())
+        cond.wait(mutex);
+      if (ready.empty())
+        throw std::runtime_error(error);
+
+      Cluster cluster = ready.front();
+      ready.pop_front();
+      cond.broadcast();
+      return cluster;
+    }
+
+    void ScanReader::stop()
+    {
+      {
+        MutexLock lock(mutex);
+        stopped = true;
+        cond.broadcast();
+      }
+      join();
+    }
+  }
+
+  void File::forEachArticleByCluster(ArticleVisitor& visitor)
+  {
+    std::vector<BlobRef> refs;
+    getBlobRefsByCluster(*impl, refs);
+
+    log_debug("visit " << refs.size() << " articles by cluster");
+
+    std::vector<size_type> clusters;
+    ScanReader* reader = 0;
+    unsigned readahead = impl->getReadahead();
+    if (readahead > 0)
+    {
+      for (std::vector<BlobRef>::const_iterator it = refs.begin(); it != refs.end(); ++it)
+        if (it == refs.begin() || it->cluster != (it - 1)->cluster)
+          clusters.push_back(it->cluster);
+
+      reader = new ScanReader(*impl, clusters, readahead);
+      try
+      {
+        reader->start();
+      }
+      catch (...)
+      {
+        delete reader;
+        throw;
+      }
+    }
+
+    try
+    {
+      Cluster cluster;
+      for (std::vector<BlobRef>::const_iterator it = refs.begin(); it != refs.end(); ++it)
+      {
+        if (it == refs.begin() || it->cluster != (it - 1)->cluster)
+        {
+          cluster = Cluster();   // release the previous cluster before reading the next
+          cluster = reader ? reader->get() : impl->readCluster(it->cluster);
+        }
+        visitor.visit(Article(*this, it->pos), cluster.getBlob(it->blob));
+      }
+    }
+    catch (...)
+    {
+      if (reader)
+      {
+        reader->stop();
+        delete reader;
+      }
+      throw;
+    }
+
+    if (reader)
+    {
+      reader->stop();
+      delete reader;
+    }
+  }
+
+  void File::parallelForEachArticle(const std::vector<ArticleVisitor*>& visitors)
+  {
+    if (visitors.empty())
+      return;
+
+    std::vector<BlobRef> refs;
+    getBlobRefsByCluster(*impl, refs);
+
+    std::vector<size_type> clusterStart;
+    for (size_type r = 0; r < refs.size(); ++r)
+      if (r == 0 || refs[r].cluster != refs[r - 1].cluster)
+        clusterStart.push_back(r);
+    clusterStart.push_back(refs.size());
+
+    log_debug("visit " << refs.size() << " articles in " << clusterStart.size() - 1 << " clusters with " << visitors.size() << " threads");
+
+    size_type nextCluster = 0;
+    Mutex mutex;
+    std::string error;
+
+    std::vector<ScanThread*> threads;
+    try
+    {
+      for (unsigned n = 0; n < visitors.size(); ++n)
+      {
+        threads.push_back(new ScanThread(*this, *impl, *visitors[n], refs, clusterStart, nextCluster, mutex, error));
+        threads.back()->start();
+      }
+    }
+    catch (const std::exception& e)
+    {
+      MutexLock lock(mutex);
+      if (error.empty())
+        error = e.what();
+    }
+
+    for (unsigned n = 0; n < threads.size(); ++n)
+    {
+      threads[n]->join();
+      delete threads[n];
+    }
+
+    if (!error.empty())
+      throw std::runtime_error(error);
+  }
+
   bool File::hasNamespace(char ch)
   {
     size_type off = getNamespaceBeginOffset(ch);
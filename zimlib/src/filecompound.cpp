@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <zim/filecompound.h>
+#include "log.h"
+#include "config.h"
+#include <sstream>
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifndef O_LARGEFILE
+#define O_LARGEFILE 0
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+log_define("zim.filecompound")
+
+namespace zim
+{
+  FileCompound::FileCompound(const std::string& fname)
+    : _fsize(0),
+      mapped(false)
+  {
+    log_debug("open file compound " << fname);
+
+    if (!addPart(fname))
+    {
+      int errnoSave = errno;
+
+      // look for a split file fname+"aa", fname+"ab", ...
+      for (char ch0 = 'a'; ch0 <= 'z'; ++ch0)
+      {
+        std::string fname0 = fname + ch0;
+        char ch1;
+        for (ch1 = 'a'; ch1 <= 'z'; ++ch1)
+          if (!addPart(fname0 + ch1))
+            break;
+
+        if (ch1 <= 'z')
+          break;
+      }
+
+      if (parts.empty())
+      {
+        std::ostringstream msg;
+        msg << "error " << errnoSave << " opening file \"" << fname << "\": " << strerror(errnoSave);
+        throw std::runtime_error(msg.str());
+      }
+    }
+  }
+
+  FileCompound::~FileCompound()
+  {
+    for (PartsType::iterator it = parts.begin(); it != parts.end(); ++it)
+    {
+#ifndef _WIN32
+      if (it->addr)
+        ::munmap(it->addr, static_cast<size_t>(it->size));
+#endif
+      ::close(it->fd);
+    }
+  }
+
+  bool FileCompound::addPart(const std::string& fname)
+  {
+#ifdef HAVE_OPEN64
+    int fd = ::open64(fname.c_str(), O_RDONLY | O_LARGEFILE | O_BINARY);
+#else
+    int fd = ::open(fname.c_str(), O_RDONLY | O_LARGEFILE | O_BINARY);
+#endif
+    if (fd < 0)
+      return false;
+
+#if defined(_WIN32)
+    __int64 ret = ::_lseeki64(fd, 0, SEEK_END);
+#elif defined(HAVE_LSEEK64)
+    off64_t ret = ::lseek64(fd, 0, SEEK_END);
+#else
+    off_t ret = ::lseek(fd, 0, SEEK_END);
+#endif
+    if (ret < 0)
+    {
+      int errnoSave = errno;
+      ::close(fd);
+      std::ostringstream msg;
+      msg << "error " << errnoSave << " seeking to end in file " << fname << ": " << strerror(errnoSave);
+      throw std::runtime_error(msg.str());
+    }
+
+    Part part;
+    part.fname = fname;
+    part.fd = fd;
+    part.offset = _fsize;
+    part.size = static_cast<offset_type>(ret);
+    part.addr = 0;
+    parts.push_back(part);
+
+    _fsize += part.size;
+
+    log_debug("part " << fname << " with " << part.size << " bytes at offset " << part.offset);
+    return true;
+  }
+
+  bool FileCompound::map()
+  {
+    if (mapped)
+      return true;
+
+#ifdef _WIN32
+    log_warn("mmap not supported on this platform");
+    return false;
+#else
+    for (PartsType::iterator it = parts.begin(); it != parts.end(); ++it)
+    {
+      void* addr = MAP_FAILED;
+      if (it->size > 0
+        && it->size <= static_cast<offset_type>(std::numeric_limits<size_t>::max()))
+        addr = ::mmap(0, static_cast<size_t>(it->size), PROT_READ, MAP_SHARED, it->fd, 0);
+
+      if (addr == MAP_FAILED)
+      {
+        log_warn("failed to map " << it->fname << ": " << strerror(errno));
+        for (PartsType::iterator u = parts.begin(); u != it; ++u)
+        {
+          ::munmap(u->addr, static_cast<size_t>(u->size));
+          u->addr = 0;
+        }
+        return false;
+      }
+
+      it->addr = static_cast<char*>(addr);
+    }
+
+    mapped = true;
+    return true;
+#endif
+  }
+
+  const FileCompound::Part* FileCompound::findPart(offset_type off) const
+  {
+    // binary search for the last part starting at or before off
+    PartsType::size_type l = 0;
+    PartsType::size_type u = parts.size();
+    while (u - l > 1)
+    {
+      PartsType::size_type m = l + (u - l) / 2;
+      if (parts[m].offset <= off)
+        l = m;
+      else
+        u = m;
+    }
+
+    const Part& part = parts[l];
+    return off >= part.offset && off - part.offset < part.size ? &part : 0;
+  }
+
+  const char* FileCompound::getPtr(offset_type off, offset_type size) const
+  {
+    if (!mapped)
+      return 0;
+
+    const Part* part = findPart(off);
+    if (part == 0 || size > part->size - (off - part->offset))
+      return 0;
+
+    return part->addr + (off - part->offset);
+  }
+
+  offset_type FileCompound::available(offset_type off) const
+  {
+    if (!mapped)
+      return 0;
+
+    const Part* part = findPart(off);
+    return part ? part->size - (off - part->offset) : 0;
+  }
+
+  void FileCompound::read(char* dest, offset_type off, offset_type size) const
+  {
+    while (size > 0)
+    {
+      const Part* part = findPart(off);
+      if (part == 0)
+      {
+        std::ostringstream msg;
+        msg << "error reading " << size << " bytes at offset " << off << ": beyond end of file";
+        throw std::runtime_error(msg.str());
+      }
+
+      offset_type pos = off - part->offset;
+      offset_type n = std::min(size, part->size - pos);
+
+      if (part->addr)
+      {
+        std::memcpy(dest, part->addr + pos, static_cast<size_t>(n));
+      }
+      else
+      {
+        offset_type done = 0;
+        while (done < n)
+        {
+          size_t count = static_cast<size_t>(std::min(n - done, static_cast<offset_type>(1 << 30)));
+#if defined(_WIN32)
+          MutexLock lock(seekMutex);
+          ::_lseeki64(part->fd, pos + done, SEEK_SET);
+          int ret = ::_read(part->fd, dest + done, static_cast<unsigned>(count));
+#elif defined(HAVE_PREAD64)
+          ssize_t ret = ::pread64(part->fd, dest + done, count, pos + done);
+#else
+          ssize_t ret = ::pread(part->fd, dest + done, count, pos + done);
+#endif
+          if (ret < 0 && errno == EINTR)
+            continue;
+
+          if (ret <= 0)
+          {
+            std::ostringstream msg;
+            if (ret < 0)
+              msg << "error " << errno << " reading from file " << part->fname << ": " << strerror(errno);
+            else
+              msg << "unexpected end of file " << part->fname << " at offset " << (pos + done);
+            throw std::runtime_error(msg.str());
+          }
+
+          done += ret;
+        }
+      }
+
+      dest += n;
+      off += n;
+      size -= n;
+    }
+  }
+
+  time_t FileCompound::getMTime() const
+  {
+#if defined(HAVE_STAT64) && ! defined(__APPLE__)
+    struct stat64 st;
+    int ret = ::fstat64(parts.front().fd, &st);
+#else
+    struct stat st;
+    int ret = ::fstat(parts.front().fd, &st);
+#endif
+    if (ret != 0)
+    {
+      std::ostringstream msg;
+      msg << "stat failed with errno " << errno << " : " << strerror(errno);
+      throw std::runtime_error(msg.str());
+    }
+
+    return st.st_mtime;
+  }
+
+  ////////////////////////////////////////////////////////////
+  // compoundstreambuf
+  //
+  std::streambuf::int_type compoundstreambuf::underflow()
+  {
+    if (pos >= file.fsize())
+      return traits_type::eof();
+
+    offset_type n = std::min(static_cast<offset_type>(buffer.size()), file.fsize() - pos);
+    file.read(&buffer[0], pos, n);
+    pos += n;
+
+    char* p = &buffer[0];
+    setg(p, p, p + n);
+    return traits_type::to_int_type(*gptr());
+  }
+
+}
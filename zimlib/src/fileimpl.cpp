@@ -21,39 +21,179 @@
 #include <zim/error.h>
 #include <zim/dirent.h>
 #include <zim/endian.h>
+#include <zim/blob.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sstream>
 #include <errno.h>
 #include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <limits>
+#include <deque>
+#include <set>
+#include <zim/thread.h>
 #include "config.h"
 #include "log.h"
 #include "envvalue.h"
 #include "md5stream.h"
+#include "ptrstream.h"
 
 log_define("zim.file.impl")
 
 namespace zim
 {
+  namespace
+  {
+    // Each segment of the cluster cache should hold a couple of large
+    // clusters, so small budgets are split into fewer segments.
+    unsigned clusterCacheShards(offset_type budget, unsigned shards)
+    {
+      const offset_type minShardSize = 8 * 1024 * 1024;
+      offset_type maxShards = budget / minShardSize;
+      if (maxShards < shards)
+        shards = maxShards > 0 ? static_cast<unsigned>(maxShards) : 1;
+      return shards;
+    }
+
+    // ZIM_CLUSTERCACHE used to give the number of cached clusters. It is
+    // taken as that many clusters of 1MB, the default cluster size of the
+    // writer, unless ZIM_CLUSTERCACHESIZE is set.
+    offset_type clusterCacheMemory()
+    {
+      offset_type def = CLUSTER_CACHE_MEMORY * 1024 * 1024ull;
+      if (::getenv("ZIM_CLUSTERCACHE"))
+        def = envValue("ZIM_CLUSTERCACHE", 0) * 1024 * 1024ull;
+      return envMemSize("ZIM_CLUSTERCACHESIZE", def);
+    }
+
+    // The cache counts in size_t, which is smaller than offset_type on 32
+    // bit systems. Larger budgets are clamped; half the range leaves room
+    // for rounding up per segment.
+    std::size_t clusterCacheBudget(offset_type bytes)
+    {
+      const offset_type maxBudget = std::numeric_limits<std::size_t>::max() / 2;
+      return static_cast<std::size_t>(std::min(bytes, maxBudget));
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // ClusterPrefetcher
+  //
+  class ClusterPrefetcher : public Thread
+  {
+      FileImpl& file;
+      Mutex mutex;
+      Condition cond;
+      std::deque<size_type> queue;
+      std::set<size_type> queued;
+      bool stopped;
+
+      // hints are dropped, when the prefetcher falls behind that much
+      static const unsigned maxQueued = 256;
+
+    protected:
+      void run();
+
+    public:
+      explicit ClusterPrefetcher(FileImpl& file_)
+        : file(file_),
+          stopped(false)
+        { }
+
+      void add(size_type idx);
+      void stop();
+  };
+
+  void ClusterPrefetcher::add(size_type idx)
+  {
+    MutexLock lock(mutex);
+    if (queue.size() >= maxQueued || !queued.insert(idx).second)
+      return;
+    queue.push_back(idx);
+    cond.signal();
+  }
+
+  void ClusterPrefetcher::stop()
+  {
+    {
+      MutexLock lock(mutex);
+      stopped = true;
+      cond.signal();
+    }
+    join();
+  }
+
+  void ClusterPrefetcher::run()
+  {
+    while (true)
+    {
+      size_type idx;
+
+      {
+        MutexLock lock(mutex);
+        while (queue.empty() && !stopped)
+          cond.wait(mutex);
+        if (stopped)
+          return;
+        idx = queue.front();
+        queue.pop_front();
+        queued.erase(idx);
+      }
+
+      try
+      {
+        log_debug("prefetch cluster " << idx);
+        file.loadCluster(idx);
+        file.addPrefetched();
+      }
+      catch (const std::exception& e)
+      {
+        log_warn("prefetch of cluster " << idx << " failed: " << e.what());
+      }
+    }
+  }
+
   //////////////////////////////////////////////////////////////////////
   // FileImpl
   //
-  FileImpl::FileImpl(const char* fname)
-    : zimFile(fname),
-      direntCache(envValue("ZIM_DIRENTCACHE", DIRENT_CACHE_SIZE)),
-      clusterCache(envValue("ZIM_CLUSTERCACHE", CLUSTER_CACHE_SIZE)),
-      cacheUncompressedCluster(envValue("ZIM_CACHEUNCOMPRESSEDCLUSTER", false))
+  FileImpl::FileImpl(const char* fname, bool mmap)
+    : zimFile(new FileCompound(fname)),
+      direntCache(envValue("ZIM_DIRENTCACHE", DIRENT_CACHE_SIZE),
+                  envValue("ZIM_CACHESHARDS", CACHE_SHARDS),
+                  envCachePolicy("ZIM_CACHEPOLICY", CACHE_WINNER)),
+      clusterCache(clusterCacheBudget(clusterCacheMemory()),
+                   clusterCacheShards(clusterCacheMemory(),
+                                      envValue("ZIM_CACHESHARDS", CACHE_SHARDS)),
+                   envCachePolicy("ZIM_CACHEPOLICY", CACHE_WINNER),
+                   true),
+      cacheUncompressedCluster(envValue("ZIM_CACHEUNCOMPRESSEDCLUSTER", false)),
+      partialDecompression(envValue("ZIM_PARTIALDECOMPRESSION", false)),
+      clusterReads(0),
+      dictionaryLoaded(false),
+      prefetcher(0),
+      readahead(envValue("ZIM_READAHEAD", 0)),
+      lastCluster(0),
+      prefetched(0)
   {
     log_trace("read file \"" << fname << '"');
 
-    if (!zimFile)
-      throw ZimFileFormatError(std::string("can't open zim-file \"") + fname + '"');
-
     filename = fname;
 
+    if (::getenv("ZIM_CLUSTERCACHE"))
+    {
+      log_warn("ZIM_CLUSTERCACHE is deprecated; use ZIM_CLUSTERCACHESIZE with a size in bytes");
+    }
+
+    if (envValue("ZIM_MMAP", mmap) && !zimFile->map())
+    {
+      log_warn("can't map zim-file \"" << fname << "\" - fall back to read");
+    }
+
     // read header
-    zimFile >> header;
-    if (zimFile.fail())
+    compoundstream in(*zimFile, 0, 256);
+    in >> header;
+    if (in.fail())
       throw ZimFileFormatError("error reading zim-file header");
 
     if (getCountClusters() == 0)
@@ -61,22 +201,22 @@ namespace zim
     else
     {
       offset_type lastOffset = getClusterOffset(getCountClusters() - 1);
-      log_debug("last offset=" << lastOffset << " file size=" << zimFile.fsize());
-      if (lastOffset > static_cast<offset_type>(zimFile.fsize()))
+      log_debug("last offset=" << lastOffset << " file size=" << getFilesize());
+      if (lastOffset > getFilesize())
       {
-        log_fatal("last offset (" << lastOffset << ") larger than file size (" << zimFile.fsize() << ')');
+        log_fatal("last offset (" << lastOffset << ") larger than file size (" << getFilesize() << ')');
         throw ZimFileFormatError("last cluster offset larger than file size; file corrupt");
       }
     }
 
     // read mime types
-    zimFile.seekg(header.getMimeListPos());
+    compoundstream mimeIn(*zimFile, header.getMimeListPos(), 1024);
     std::string mimeType;
     while (true)
     {
-      std::getline(zimFile, mimeType, '\0');
+      std::getline(mimeIn, mimeType, '\0');
 
-      if (zimFile.fail())
+      if (mimeIn.fail())
         throw ZimFileFormatError("error reading mime type list");
 
       if (mimeType.empty())
@@ -90,17 +230,9 @@ namespace zim
   {
     log_trace("FileImpl::getDirent(" << idx << ')');
 
-    zimFile.setBufsize(64);
-
     if (idx >= getCountArticles())
       throw ZimFileFormatError("article index out of range");
 
-    if (!zimFile)
-    {
-      log_warn("file in error state");
-      throw ZimFileFormatError("file in error state");
-    }
-
     std::pair<bool, Dirent> v = direntCache.getx(idx);
     if (v.first)
     {
@@ -110,26 +242,45 @@ namespace zim
 
     log_debug("dirent " << idx << " not found in cache; hits " << direntCache.getHits() << " misses " << direntCache.getMisses() << " ratio " << direntCache.hitRatio() * 100 << "% fillfactor " << direntCache.fillfactor());
 
+    Dirent dirent = readDirent(idx);
+    direntCache.put(idx, dirent);
+    return dirent;
+  }
+
+  Dirent FileImpl::readDirent(size_type idx)
+  {
+    if (idx >= getCountArticles())
+      throw ZimFileFormatError("article index out of range");
+
     offset_type indexOffset = getOffset(header.getUrlPtrPos(), idx);
 
-    zimFile.seekg(indexOffset);
-    if (!zimFile)
+    Dirent dirent;
+
+    offset_type avail = zimFile->available(indexOffset);
+    if (avail > 0)
     {
-      log_warn("failed to seek to directory entry");
-      throw ZimFileFormatError("failed to seek to directory entry");
+      // parse directly from the mapping; a dirent crossing a part boundary
+      // fails here and is read from the file below
+      char* p = const_cast<char*>(zimFile->getPtr(indexOffset, avail));
+      ptrstream in(p, p + avail);
+      in >> dirent;
+      if (in.fail())
+        avail = 0;
     }
 
-    Dirent dirent;
-    zimFile >> dirent;
-
-    if (!zimFile)
+    if (avail == 0)
     {
-      log_warn("failed to read to directory entry");
-      throw ZimFileFormatError("failed to read directory entry");
+      compoundstream in(*zimFile, indexOffset, 256);
+      in >> dirent;
+
+      if (in.fail())
+      {
+        log_warn("failed to read to directory entry");
+        throw ZimFileFormatError("failed to read directory entry");
+      }
     }
 
     log_debug("dirent read from " << indexOffset);
-    direntCache.put(idx, dirent);
 
     return dirent;
   }
@@ -146,12 +297,14 @@ namespace zim
     if (idx >= getCountArticles())
       throw ZimFileFormatError("article index out of range");
 
-    zimFile.seekg(header.getTitleIdxPos() + sizeof(size_type) * idx);
+    offset_type pos = header.getTitleIdxPos() + sizeof(size_type) * idx;
     size_type ret;
-    zimFile.read(reinterpret_cast<char*>(&ret), sizeof(size_type));
 
-    if (!zimFile)
-      throw ZimFileFormatError("error reading title index");
+    const char* p = zimFile->getPtr(pos, sizeof(size_type));
+    if (p)
+      std::memcpy(&ret, p, sizeof(size_type));
+    else
+      zimFile->read(reinterpret_cast<char*>(&ret), pos, sizeof(size_type));
 
     if (isBigEndian())
       ret = fromLittleEndian(&ret);
@@ -159,6 +312,62 @@ namespace zim
     return ret;
   }
 
+  FileImpl::~FileImpl()
+  {
+    if (prefetcher)
+    {
+      prefetcher->stop();
+      delete prefetcher;
+    }
+  }
+
+  void FileImpl::prefetch(size_type idx)
+  {
+    if (idx >= getCountClusters())
+      return;
+
+    MutexLock lock(prefetchMutex);
+    if (!prefetcher)
+    {
+      prefetcher = new ClusterPrefetcher(*this);
+      try
+      {
+        prefetcher->start();
+      }
+      catch (...)
+      {
+        delete prefetcher;
+        prefetcher = 0;
+        throw;
+      }
+    }
+
+    prefetcher->add(idx);
+  }
+
+  void FileImpl::setClusterCacheSize(offset_type bytes)
+  {
+    clusterCache.setMaxElements(clusterCacheBudget(bytes));
+  }
+
+  void FileImpl::addPrefetched()
+  {
+    MutexLock lock(prefetchMutex);
+    ++prefetched;
+  }
+
+  size_type FileImpl::getClusterReads()
+  {
+    MutexLock lock(clusterLoadMutex);
+    return clusterReads;
+  }
+
+  size_type FileImpl::getPrefetched()
+  {
+    MutexLock lock(prefetchMutex);
+    return prefetched;
+  }
+
   Cluster FileImpl::getCluster(size_type idx)
   {
     log_trace("getCluster(" << idx << ')');
@@ -166,6 +375,26 @@ namespace zim
     if (idx >= getCountClusters())
       throw ZimFileFormatError("cluster index out of range");
 
+    if (readahead > 0)
+    {
+      bool sequential;
+
+      {
+        MutexLock lock(prefetchMutex);
+        sequential = (idx == lastCluster + 1);
+        lastCluster = idx;
+      }
+
+      if (sequential)
+        for (unsigned n = 1; n <= readahead; ++n)
+          prefetch(idx + n);
+    }
+
+    return loadCluster(idx);
+  }
+
+  Cluster FileImpl::loadCluster(size_type idx)
+  {
     Cluster cluster = clusterCache.get(idx);
     if (cluster)
     {
@@ -173,34 +402,167 @@ namespace zim
       return cluster;
     }
 
-    zimFile.setBufsize(16384);
+    SmartPtr<ClusterLoad> load;
+    bool reader = false;
+
+    {
+      MutexLock lock(clusterLoadMutex);
+      ClusterLoads::iterator it = clusterLoads.find(idx);
+      if (it == clusterLoads.end())
+      {
+        // Another thread may have finished reading the cluster since the
+        // lookup above; it puts the cluster into the cache before it
+        // removes its load.
+        cluster = clusterCache.get(idx);
+        if (cluster)
+          return cluster;
+
+        load = new ClusterLoad();
+        clusterLoads.insert(ClusterLoads::value_type(idx, load));
+        reader = true;
+      }
+      else
+      {
+        log_debug("cluster " << idx << " is read by another thread - wait");
+        load = it->second;
+        while (!load->done)
+          clusterLoadDone.wait(clusterLoadMutex);
+      }
+    }
+
+    if (!reader)
+    {
+      if (load->cluster)
+        return load->cluster;
+      if (load->formatError)
+        throw ZimFileFormatError(load->error);
+      throw std::runtime_error(load->error);
+    }
+
+    try
+    {
+      cluster = readCluster(idx);
+
+      if (cacheUncompressedCluster || cluster.isCompressed())
+      {
+        log_debug("put cluster " << idx << " into cluster cache; hits " << clusterCache.getHits() << " misses " << clusterCache.getMisses() << " ratio " << clusterCache.hitRatio() * 100 << "% fillfactor " << clusterCache.fillfactor());
+        clusterCache.put(idx, cluster, cluster.size());
+      }
+      else
+      {
+        log_debug("cluster " << idx << " is not compressed - do not cache");
+      }
+    }
+    catch (const ZimFileFormatError& e)
+    {
+      failClusterLoad(idx, *load, e.what(), true);
+      throw;
+    }
+    catch (const std::exception& e)
+    {
+      failClusterLoad(idx, *load, e.what(), false);
+      throw;
+    }
+    catch (...)
+    {
+      // the waiting threads must not block forever
+      failClusterLoad(idx, *load, "unknown error reading cluster", false);
+      throw;
+    }
+
+    MutexLock lock(clusterLoadMutex);
+    load->cluster = cluster;
+    load->done = true;
+    clusterLoads.erase(idx);
+    clusterLoadDone.broadcast();
+
+    return cluster;
+  }
+
+  void FileImpl::failClusterLoad(size_type idx, ClusterLoad& load,
+                                 const std::string& error, bool formatError)
+  {
+    MutexLock lock(clusterLoadMutex);
+    load.error = error;
+    load.formatError = formatError;
+    load.done = true;
+    clusterLoads.erase(idx);
+    clusterLoadDone.broadcast();
+  }
+
+  Cluster FileImpl::readCluster(size_type idx)
+  {
+    if (idx >= getCountClusters())
+      throw ZimFileFormatError("cluster index out of range");
+
+    Cluster cluster;
 
     offset_type clusterOffset = getClusterOffset(idx);
     log_debug("read cluster " << idx << " from offset " << clusterOffset);
-    cluster.init_from_stream(zimFile, clusterOffset);
+    cluster.init_from_file(zimFile, clusterOffset, getClusterSize(idx), partialDecompression,
+                           getDictionary());
 
-    if (zimFile.fail())
-      throw ZimFileFormatError("error reading cluster data");
+    MutexLock lock(clusterLoadMutex);
+    ++clusterReads;
+    return cluster;
+  }
 
-    if (cacheUncompressedCluster || cluster.isCompressed())
+  Dictionary* FileImpl::getDictionary()
+  {
+    MutexLock lock(dictionaryMutex);
+    if (!dictionaryLoaded)
     {
-      log_debug("put cluster " << idx << " into cluster cache; hits " << clusterCache.getHits() << " misses " << clusterCache.getMisses() << " ratio " << clusterCache.hitRatio() * 100 << "% fillfactor " << clusterCache.fillfactor());
-      clusterCache.put(idx, cluster);
+      dictionary = loadDictionary();
+      dictionaryLoaded = true;
     }
-    else
-      log_debug("cluster " << idx << " is not compressed - do not cache");
+    return dictionary;
+  }
 
-    return cluster;
+  Dictionary* FileImpl::loadDictionary()
+  {
+    if (getCountArticles() == 0)
+      return 0;
+
+    size_type l = getNamespaceBeginOffset(Dictionary::ns);
+    size_type u = getNamespaceEndOffset(Dictionary::ns);
+    while (l < u)
+    {
+      size_type p = l + (u - l) / 2;
+      Dirent d = getDirent(p);
+      int c = d.getUrl().compare(Dictionary::url);
+      if (c < 0)
+        l = p + 1;
+      else if (c > 0)
+        u = p;
+      else
+      {
+        if (!d.isArticle())
+          return 0;
+
+        // The dictionary is read directly, since this is called while
+        // reading a cluster.
+        Cluster cluster;
+        size_type idx = d.getClusterNumber();
+        cluster.init_from_file(zimFile, getClusterOffset(idx), getClusterSize(idx));
+        Blob blob = cluster.getBlob(d.getBlobNumber());
+        log_debug("compression dictionary with " << blob.size() << " bytes loaded");
+        return new Dictionary(blob.data(), blob.size());
+      }
+    }
+
+    return 0;
   }
 
   offset_type FileImpl::getOffset(offset_type ptrOffset, size_type idx)
   {
-    zimFile.seekg(ptrOffset + sizeof(offset_type) * idx);
+    offset_type pos = ptrOffset + sizeof(offset_type) * idx;
     offset_type offset;
-    zimFile.read(reinterpret_cast<char*>(&offset), sizeof(offset_type));
 
-    if (!zimFile)
-      throw ZimFileFormatError("error reading offset");
+    const char* p = zimFile->getPtr(pos, sizeof(offset_type));
+    if (p)
+      std::memcpy(&offset, p, sizeof(offset_type));
+    else
+      zimFile->read(reinterpret_cast<char*>(&offset), pos, sizeof(offset_type));
 
     if (isBigEndian())
       offset = fromLittleEndian(&offset);
@@ -208,13 +570,37 @@ namespace zim
     return offset;
   }
 
+  offset_type FileImpl::getClusterSize(size_type idx)
+  {
+    // Clusters are stored consecutively. The last one ends, where the next
+    // part of the file starts: the checksum, or the mime type list, when
+    // the index is written after the clusters.
+    offset_type begin = getClusterOffset(idx);
+    offset_type end;
+    if (idx + 1 < getCountClusters())
+      end = getClusterOffset(idx + 1);
+    else
+    {
+      end = getFilesize();
+      offset_type parts[] = { header.getMimeListPos(), header.getUrlPtrPos(), header.getTitleIdxPos(),
+                              header.getClusterPtrPos(), header.getChecksumPos() };
+      for (unsigned n = 0; n < sizeof(parts) / sizeof(parts[0]); ++n)
+        if (parts[n] > begin && parts[n] < end)
+          end = parts[n];
+    }
+    return end > begin ? end - begin : 0;
+  }
+
   size_type FileImpl::getNamespaceBeginOffset(char ch)
   {
     log_trace("getNamespaceBeginOffset(" << ch << ')');
 
-    NamespaceCache::const_iterator it = namespaceBeginCache.find(ch);
-    if (it != namespaceBeginCache.end())
-      return it->second;
+    {
+      MutexLock lock(cacheMutex);
+      NamespaceCache::const_iterator it = namespaceBeginCache.find(ch);
+      if (it != namespaceBeginCache.end())
+        return it->second;
+    }
 
     size_type lower = 0;
     size_type upper = getCountArticles();
@@ -230,6 +616,8 @@ namespace zim
     }
 
     size_type ret = d.getNamespace() < ch ? upper : lower;
+
+    MutexLock lock(cacheMutex);
     namespaceBeginCache[ch] = ret;
 
     return ret;
@@ -239,9 +627,12 @@ namespace zim
   {
     log_trace("getNamespaceEndOffset(" << ch << ')');
 
-    NamespaceCache::const_iterator it = namespaceEndCache.find(ch);
-    if (it != namespaceEndCache.end())
-      return it->second;
+    {
+      MutexLock lock(cacheMutex);
+      NamespaceCache::const_iterator it = namespaceEndCache.find(ch);
+      if (it != namespaceEndCache.end())
+        return it->second;
+    }
 
     size_type lower = 0;
     size_type upper = getCountArticles();
@@ -257,6 +648,7 @@ namespace zim
       log_debug("namespace " << d.getNamespace() << " m=" << m << " lower=" << lower << " upper=" << upper);
     }
 
+    MutexLock lock(cacheMutex);
     namespaceEndCache[ch] = upper;
 
     return upper;
@@ -265,20 +657,25 @@ namespace zim
 
   std::string FileImpl::getNamespaces()
   {
-    if (namespaces.empty())
     {
-      Dirent d = getDirent(0);
-      namespaces = d.getNamespace();
+      MutexLock lock(cacheMutex);
+      if (!namespaces.empty())
+        return namespaces;
+    }
 
-      size_type idx;
-      while ((idx = getNamespaceEndOffset(d.getNamespace())) < getCountArticles())
-      {
-        d = getDirent(idx);
-        namespaces += d.getNamespace();
-      }
+    Dirent d = getDirent(0);
+    std::string ret(1, d.getNamespace());
 
+    size_type idx;
+    while ((idx = getNamespaceEndOffset(d.getNamespace())) < getCountArticles())
+    {
+      d = getDirent(idx);
+      ret += d.getNamespace();
     }
-    return namespaces;
+
+    MutexLock lock(cacheMutex);
+    namespaces = ret;
+    return ret;
   }
 
   const std::string& FileImpl::getMimeType(uint16_t idx) const
@@ -298,12 +695,14 @@ namespace zim
     if (!header.hasChecksum())
       return std::string();
 
-    zimFile.seekg(header.getChecksumPos());
     unsigned char chksum[16];
-    zimFile.read(reinterpret_cast<char*>(chksum), 16);
-    if (!zimFile)
+    try
+    {
+      zimFile->read(reinterpret_cast<char*>(chksum), header.getChecksumPos(), 16);
+    }
+    catch (const std::exception& e)
     {
-      log_warn("error reading checksum");
+      log_warn("error reading checksum: " << e.what());
       return std::string();
     }
 
@@ -327,18 +726,27 @@ namespace zim
 
     Md5stream md5;
 
-    zimFile.seekg(0);
-    char ch;
-    for (offset_type n = 0; n < header.getChecksumPos() && zimFile.get(ch); ++n)
-      md5 << ch;
+    std::vector<char> buffer(65536);
+    offset_type checksumPos = header.getChecksumPos();
+    for (offset_type n = 0; n < checksumPos; )
+    {
+      offset_type count = std::min(static_cast<offset_type>(buffer.size()), checksumPos - n);
+      zimFile->read(&buffer[0], n, count);
+      md5.write(&buffer[0], count);
+      n += count;
+    }
 
     unsigned char chksumFile[16];
     unsigned char chksumCalc[16];
 
-    zimFile.read(reinterpret_cast<char*>(chksumFile), 16);
-
-    if (!zimFile)
+    try
+    {
+      zimFile->read(reinterpret_cast<char*>(chksumFile), checksumPos, 16);
+    }
+    catch (const std::exception&)
+    {
       throw ZimFileFormatError("failed to read checksum from zim file");
+    }
 
     md5.getDigest(chksumCalc);
     if (std::memcmp(chksumFile, chksumCalc, 16) != 0)
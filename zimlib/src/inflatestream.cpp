@@ -59,6 +59,17 @@ namespace zim
     checkError(::inflateInit(&stream), stream);
   }
 
+  void InflateStreamBuf::reset(std::streambuf* sinksource_)
+  {
+    sinksource = sinksource_;
+    stream.next_in = Z_NULL;
+    stream.avail_in = 0;
+    setg(0, 0, 0);
+    setp(0, 0);
+
+    checkError(::inflateReset(&stream), stream);
+  }
+
   InflateStreamBuf::~InflateStreamBuf()
   {
     ::inflateEnd(&stream);
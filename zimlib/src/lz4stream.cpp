@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <zim/lz4stream.h>
+#include "log.h"
+#include <sstream>
+#include <cstring>
+
+log_define("zim.lz4.compress")
+
+namespace zim
+{
+  namespace
+  {
+    size_t checkError(size_t ret)
+    {
+      if (::LZ4F_isError(ret))
+      {
+        std::ostringstream msg;
+        msg << "lz4-error: " << ::LZ4F_getErrorName(ret);
+        log_error(msg.str());
+        throw Lz4Error(ret, msg.str());
+      }
+      return ret;
+    }
+  }
+
+  Lz4StreamBuf::Lz4StreamBuf(std::streambuf* sink_, int level, unsigned bufsize_)
+    : stream(0),
+      started(false),
+      obuffer(bufsize_),
+      sink(sink_)
+  {
+    checkError(::LZ4F_createCompressionContext(&stream, LZ4F_VERSION));
+
+    std::memset(&prefs, 0, sizeof(prefs));
+    prefs.compressionLevel = level;
+
+    // room for the frame header and trailer or one full input buffer
+    zbuffer.resize(::LZ4F_compressBound(bufsize_, &prefs) + LZ4F_HEADER_SIZE_MAX);
+
+    setp(&obuffer[0], &obuffer[0] + obuffer.size());
+  }
+
+  Lz4StreamBuf::~Lz4StreamBuf()
+  {
+    ::LZ4F_freeCompressionContext(stream);
+  }
+
+  bool Lz4StreamBuf::writeSink(const char* data, size_t size)
+  {
+    return size == 0
+        || sink->sputn(data, size) == static_cast<std::streamsize>(size);
+  }
+
+  bool Lz4StreamBuf::begin()
+  {
+    if (started)
+      return true;
+
+    started = true;
+    size_t n = checkError(::LZ4F_compressBegin(stream, &zbuffer[0], zbuffer.size(), &prefs));
+    return writeSink(&zbuffer[0], n);
+  }
+
+  bool Lz4StreamBuf::compressBuffer()
+  {
+    if (!begin())
+      return false;
+
+    size_t size = pptr() - &obuffer[0];
+    if (size > 0)
+    {
+      size_t n = checkError(::LZ4F_compressUpdate(stream, &zbuffer[0], zbuffer.size(),
+                                                 &obuffer[0], size, 0));
+      if (!writeSink(&zbuffer[0], n))
+        return false;
+    }
+
+    setp(&obuffer[0], &obuffer[0] + obuffer.size());
+    return true;
+  }
+
+  Lz4StreamBuf::int_type Lz4StreamBuf::overflow(int_type c)
+  {
+    if (!compressBuffer())
+      return traits_type::eof();
+
+    if (c != traits_type::eof())
+      sputc(traits_type::to_char_type(c));
+
+    return 0;
+  }
+
+  Lz4StreamBuf::int_type Lz4StreamBuf::underflow()
+  {
+    return traits_type::eof();
+  }
+
+  int Lz4StreamBuf::sync()
+  {
+    if (!compressBuffer())
+      return -1;
+
+    size_t n = checkError(::LZ4F_flush(stream, &zbuffer[0], zbuffer.size(), 0));
+    return writeSink(&zbuffer[0], n) ? 0 : -1;
+  }
+
+  int Lz4StreamBuf::end()
+  {
+    if (!compressBuffer())
+      throw Lz4Error(0, "failed to send compressed data to sink in lz4stream");
+
+    size_t n = checkError(::LZ4F_compressEnd(stream, &zbuffer[0], zbuffer.size(), 0));
+    if (!writeSink(&zbuffer[0], n))
+      throw Lz4Error(0, "failed to send compressed data to sink in lz4stream");
+
+    return 0;
+  }
+
+  void Lz4Stream::end()
+  {
+    if (streambuf.end() != 0)
+      setstate(failbit);
+  }
+
+}
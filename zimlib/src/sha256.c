@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include "sha256.h"
+#include <string.h>
+
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* processes one block of 64 bytes */
+static void transform(uint32_t state[8], const unsigned char block[64])
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h;
+  unsigned i;
+
+  for (i = 0; i < 16; ++i)
+    w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16)
+         | ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+
+  for (i = 16; i < 64; ++i)
+  {
+    uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  a = state[0]; b = state[1]; c = state[2]; d = state[3];
+  e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+  for (i = 0; i < 64; ++i)
+  {
+    uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + K[i] + w[i];
+    uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void zim_SHA256Init(struct zim_SHA256_CTX *context)
+{
+  context->state[0] = 0x6a09e667;
+  context->state[1] = 0xbb67ae85;
+  context->state[2] = 0x3c6ef372;
+  context->state[3] = 0xa54ff53a;
+  context->state[4] = 0x510e527f;
+  context->state[5] = 0x9b05688c;
+  context->state[6] = 0x1f83d9ab;
+  context->state[7] = 0x5be0cd19;
+  context->count = 0;
+}
+
+void zim_SHA256Update(struct zim_SHA256_CTX *context, const unsigned char *input, size_t len)
+{
+  size_t used = (size_t)(context->count % 64);
+  context->count += len;
+
+  if (used > 0)
+  {
+    size_t fill = 64 - used;
+    if (len < fill)
+    {
+      memcpy(context->buffer + used, input, len);
+      return;
+    }
+
+    memcpy(context->buffer + used, input, fill);
+    transform(context->state, context->buffer);
+    input += fill;
+    len -= fill;
+  }
+
+  for (; len >= 64; input += 64, len -= 64)
+    transform(context->state, input);
+
+  memcpy(context->buffer, input, len);
+}
+
+void zim_SHA256Final(unsigned char digest[32], struct zim_SHA256_CTX *context)
+{
+  uint64_t bits = context->count * 8;
+  unsigned char length[8];
+  static const unsigned char padding[64] = { 0x80 };
+  size_t used = (size_t)(context->count % 64);
+  unsigned i;
+
+  for (i = 0; i < 8; ++i)
+    length[i] = (unsigned char)(bits >> (56 - i * 8));
+
+  /* pad to 56 bytes modulo 64, then append the length in bits */
+  zim_SHA256Update(context, padding, used < 56 ? 56 - used : 120 - used);
+  zim_SHA256Update(context, length, 8);
+
+  for (i = 0; i < 8; ++i)
+  {
+    digest[i * 4]     = (unsigned char)(context->state[i] >> 24);
+    digest[i * 4 + 1] = (unsigned char)(context->state[i] >> 16);
+    digest[i * 4 + 2] = (unsigned char)(context->state[i] >> 8);
+    digest[i * 4 + 3] = (unsigned char)context->state[i];
+  }
+
+  memset(context, 0, sizeof(*context));
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef ZIM_SHA256_H
+#define ZIM_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* SHA-256 message digest as specified in FIPS 180-4 */
+
+struct zim_SHA256_CTX {
+  uint32_t state[8];
+  uint64_t count;                       /* number of bytes processed */
+  unsigned char buffer[64];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void zim_SHA256Init(struct zim_SHA256_CTX *);
+void zim_SHA256Update(struct zim_SHA256_CTX *, const unsigned char *, size_t);
+void zim_SHA256Final(unsigned char [32], struct zim_SHA256_CTX *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZIM_SHA256_H */
@@ -291,6 +291,8 @@ void ZimDumper::listArticle(const zim::Article& article, bool extra)
         case zim::zimcompZip:     std::cout << "zip"; break;
         case zim::zimcompBzip2:   std::cout << "bzip2"; break;
         case zim::zimcompLzma:    std::cout << "lzma"; break;
+        case zim::zimcompZstd:    std::cout << "zstd"; break;
+        case zim::zimcompLz4:     std::cout << "lz4"; break;
         default:                  std::cout << "unknown (" << static_cast<unsigned>(cluster.getCompression()) << ')'; break;
       }
       std::cout << "\n";
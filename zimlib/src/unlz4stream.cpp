@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <zim/unlz4stream.h>
+#include "log.h"
+#include <sstream>
+#include <algorithm>
+
+log_define("zim.lz4.uncompress")
+
+namespace zim
+{
+  namespace
+  {
+    size_t checkError(size_t ret)
+    {
+      if (::LZ4F_isError(ret))
+      {
+        std::ostringstream msg;
+        msg << "unlz4-error: " << ::LZ4F_getErrorName(ret);
+        log_error(msg.str());
+        throw Unlz4Error(ret, msg.str());
+      }
+      return ret;
+    }
+  }
+
+  Unlz4StreamBuf::Unlz4StreamBuf(std::streambuf* sinksource_, unsigned bufsize_)
+    : stream(0),
+      inputPtr(0),
+      inputEnd(0),
+      finished(false),
+      pending(false),
+      iobuffer(0),
+      bufsize(bufsize_),
+      sinksource(sinksource_)
+  {
+    checkError(::LZ4F_createDecompressionContext(&stream, LZ4F_VERSION));
+    iobuffer = new char_type[bufsize_];
+  }
+
+  void Unlz4StreamBuf::reset(std::streambuf* sinksource_)
+  {
+    sinksource = sinksource_;
+    inputPtr = 0;
+    inputEnd = 0;
+    finished = false;
+    pending = false;
+    setg(0, 0, 0);
+    setp(0, 0);
+    ::LZ4F_resetDecompressionContext(stream);
+  }
+
+  Unlz4StreamBuf::~Unlz4StreamBuf()
+  {
+    ::LZ4F_freeDecompressionContext(stream);
+    delete[] iobuffer;
+  }
+
+  Unlz4StreamBuf::int_type Unlz4StreamBuf::overflow(int_type c)
+  {
+    if (pptr())
+    {
+      // A full output buffer may leave data in the decoder, so it is
+      // called until the input is consumed and the output is drained.
+      const char* in = obuffer();
+      const char* end = pptr();
+      bool full;
+      do
+      {
+        size_t srcSize = end - in;
+        size_t dstSize = ibuffer_size();
+        checkError(::LZ4F_decompress(stream, ibuffer(), &dstSize, in, &srcSize, 0));
+        in += srcSize;
+        full = (dstSize == static_cast<size_t>(ibuffer_size()));
+
+        std::streamsize count = dstSize;
+        std::streamsize n = sinksource->sputn(ibuffer(), count);
+        if (n < count)
+          return traits_type::eof();
+      } while (in < end || full);
+    }
+
+    // reset outbuffer
+    setp(obuffer(), obuffer() + obuffer_size());
+    if (c != traits_type::eof())
+      sputc(traits_type::to_char_type(c));
+
+    return 0;
+  }
+
+  Unlz4StreamBuf::int_type Unlz4StreamBuf::underflow()
+  {
+    // The frame ends with the compressed cluster; data following it in
+    // the source belongs to something else.
+    if (finished)
+      return traits_type::eof();
+
+    size_t pos = 0;
+
+    do
+    {
+      // Fill ibuffer first if needed. While the decoder may hold output,
+      // it is called without new input; at the end of the source it is
+      // called once more to drain it.
+      bool sourceEnd = false;
+      if (inputPtr >= inputEnd && !pending)
+      {
+        std::streamsize n = sinksource->in_avail() > 0
+          ? sinksource->sgetn(ibuffer(), std::min(sinksource->in_avail(), ibuffer_size()))
+          : sinksource->sgetn(ibuffer(), ibuffer_size());
+        sourceEnd = (n <= 0);
+
+        inputPtr = ibuffer();
+        inputEnd = ibuffer() + (sourceEnd ? 0 : n);
+      }
+
+      size_t srcSize = inputEnd - inputPtr;
+      size_t dstSize = obuffer_size() - pos;
+      if (checkError(::LZ4F_decompress(stream, obuffer() + pos, &dstSize, inputPtr, &srcSize, 0)) == 0)
+        finished = true;
+      inputPtr += srcSize;
+      pos += dstSize;
+      pending = (pos == static_cast<size_t>(obuffer_size()));
+
+      setg(obuffer(), obuffer(), obuffer() + pos);
+
+      if (sourceEnd && gptr() == egptr())
+        return traits_type::eof();
+
+    } while (gptr() == egptr() && !finished);
+
+    return gptr() == egptr() ? traits_type::eof() : sgetc();
+  }
+
+  int Unlz4StreamBuf::sync()
+  {
+    if (pptr() && overflow(traits_type::eof()) == traits_type::eof())
+      return -1;
+    return 0;
+  }
+}
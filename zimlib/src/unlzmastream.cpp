@@ -73,6 +73,20 @@ namespace zim
       ::lzma_stream_decoder(&stream, memsize, 0));
   }
 
+  void UnlzmaStreamBuf::reset(std::streambuf* sinksource_)
+  {
+    sinksource = sinksource_;
+    stream.next_in = 0;
+    stream.avail_in = 0;
+    setg(0, 0, 0);
+    setp(0, 0);
+
+    // liblzma reuses the memory of an initialized stream
+    unsigned memsize = envMemSize("ZIM_LZMA_MEMORY_SIZE", LZMA_MEMORY_SIZE * 1024 * 1024);
+    checkError(
+      ::lzma_stream_decoder(&stream, memsize, 0));
+  }
+
   UnlzmaStreamBuf::~UnlzmaStreamBuf()
   {
     ::lzma_end(&stream);
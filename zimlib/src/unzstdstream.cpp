@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <zim/unzstdstream.h>
+#include "log.h"
+#include <sstream>
+#include <algorithm>
+
+log_define("zim.zstd.uncompress")
+
+namespace zim
+{
+  namespace
+  {
+    size_t checkError(size_t ret)
+    {
+      if (::ZSTD_isError(ret))
+      {
+        std::ostringstream msg;
+        msg << "unzstd-error: " << ::ZSTD_getErrorName(ret);
+        log_error(msg.str());
+        throw UnzstdError(ret, msg.str());
+      }
+      return ret;
+    }
+  }
+
+  UnzstdStreamBuf::UnzstdStreamBuf(std::streambuf* sinksource_, unsigned bufsize_,
+                                   const ZSTD_DDict* dict)
+    : stream(::ZSTD_createDStream()),
+      finished(false),
+      pending(false),
+      iobuffer(0),
+      bufsize(bufsize_),
+      sinksource(sinksource_)
+  {
+    if (stream == 0)
+      throw UnzstdError(0, "failed to create zstd decompressor");
+
+    input.src = 0;
+    input.size = 0;
+    input.pos = 0;
+
+    try
+    {
+      checkError(::ZSTD_initDStream(stream));
+      if (dict)
+        checkError(::ZSTD_DCtx_refDDict(stream, dict));
+    }
+    catch (...)
+    {
+      ::ZSTD_freeDStream(stream);
+      throw;
+    }
+
+    iobuffer = new char_type[bufsize_];
+  }
+
+  void UnzstdStreamBuf::reset(std::streambuf* sinksource_, const ZSTD_DDict* dict)
+  {
+    sinksource = sinksource_;
+    input.src = 0;
+    input.size = 0;
+    input.pos = 0;
+    finished = false;
+    pending = false;
+    setg(0, 0, 0);
+    setp(0, 0);
+
+    // initializing drops a dictionary used before
+    checkError(::ZSTD_initDStream(stream));
+    if (dict)
+      checkError(::ZSTD_DCtx_refDDict(stream, dict));
+  }
+
+  UnzstdStreamBuf::~UnzstdStreamBuf()
+  {
+    ::ZSTD_freeDStream(stream);
+    delete[] iobuffer;
+  }
+
+  UnzstdStreamBuf::int_type UnzstdStreamBuf::overflow(int_type c)
+  {
+    if (pptr())
+    {
+      // A full output buffer may leave data in the decoder, so it is
+      // called until the input is consumed and the output is drained.
+      ZSTD_inBuffer in = { obuffer(), static_cast<size_t>(pptr() - pbase()), 0 };
+      bool full;
+      do
+      {
+        ZSTD_outBuffer out = { ibuffer(), static_cast<size_t>(ibuffer_size()), 0 };
+        checkError(::ZSTD_decompressStream(stream, &out, &in));
+        full = (out.pos == out.size);
+
+        std::streamsize count = out.pos;
+        std::streamsize n = sinksource->sputn(ibuffer(), count);
+        if (n < count)
+          return traits_type::eof();
+      } while (in.pos < in.size || full);
+    }
+
+    // reset outbuffer
+    setp(obuffer(), obuffer() + obuffer_size());
+    if (c != traits_type::eof())
+      sputc(traits_type::to_char_type(c));
+
+    return 0;
+  }
+
+  UnzstdStreamBuf::int_type UnzstdStreamBuf::underflow()
+  {
+    // The frame ends with the compressed cluster; data following it in
+    // the source belongs to something else.
+    if (finished)
+      return traits_type::eof();
+
+    ZSTD_outBuffer out = { obuffer(), static_cast<size_t>(obuffer_size()), 0 };
+
+    do
+    {
+      // Fill ibuffer first if needed. While the decoder may hold output,
+      // it is called without new input; at the end of the source it is
+      // called once more to drain it.
+      bool sourceEnd = false;
+      if (input.pos >= input.size && !pending)
+      {
+        std::streamsize n = sinksource->in_avail() > 0
+          ? sinksource->sgetn(ibuffer(), std::min(sinksource->in_avail(), ibuffer_size()))
+          : sinksource->sgetn(ibuffer(), ibuffer_size());
+        sourceEnd = (n <= 0);
+
+        input.src = ibuffer();
+        input.size = sourceEnd ? 0 : n;
+        input.pos = 0;
+      }
+
+      if (checkError(::ZSTD_decompressStream(stream, &out, &input)) == 0)
+        finished = true;
+      pending = (out.pos == out.size);
+
+      setg(obuffer(), obuffer(), obuffer() + out.pos);
+
+      if (sourceEnd && gptr() == egptr())
+        return traits_type::eof();
+
+    } while (gptr() == egptr() && !finished);
+
+    return gptr() == egptr() ? traits_type::eof() : sgetc();
+  }
+
+  int UnzstdStreamBuf::sync()
+  {
+    if (pptr() && overflow(traits_type::eof()) == traits_type::eof())
+      return -1;
+    return 0;
+  }
+}
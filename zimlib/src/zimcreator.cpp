@@ -22,8 +22,18 @@
 #include <zim/cluster.h>
 #include <zim/blob.h>
 #include <zim/endian.h>
+#include <zim/thread.h>
+#include <zim/mutex.h>
 #include <algorithm>
+#include <deque>
 #include <fstream>
+#include <sstream>
+
+#if __cplusplus >= 201103L
+#include <unordered_map>
+#else
+#include <tr1/unordered_map>
+#endif
 
 #ifdef _WIN32
 #include <io.h>
@@ -36,6 +46,8 @@
 #include <stdexcept>
 #include "config.h"
 #include "arg.h"
+#include "externaldirents.h"
+#include "sha256.h"
 #include "md5stream.h"
 #include "tee.h"
 #include "log.h"
@@ -64,7 +76,21 @@ namespace zim
 #else
         compression(zimcompNone),
 #endif
-        currentSize(0)
+        frameSize(0),
+        compressionThreads(1),
+        deduplicate(false),
+        indexLast(false),
+        compressor(0),
+        direntMemory(0),
+        direntsSize(0),
+        external(0),
+        queueSize(256),
+        articleQueue(0),
+        creatorThread(0),
+        currentSize(0),
+        dictionarySize(0),
+        sampling(false),
+        pendingSize(0)
     {
     }
 
@@ -79,7 +105,21 @@ namespace zim
 #else
         compression(zimcompNone),
 #endif
-        currentSize(0)
+        frameSize(0),
+        compressionThreads(1),
+        deduplicate(false),
+        indexLast(false),
+        compressor(0),
+        direntMemory(0),
+        direntsSize(0),
+        external(0),
+        queueSize(256),
+        articleQueue(0),
+        creatorThread(0),
+        currentSize(0),
+        dictionarySize(0),
+        sampling(false),
+        pendingSize(0)
     {
       Arg<unsigned> minChunkSizeArg(argc, argv, "--min-chunk-size");
       if (minChunkSizeArg.isSet())
@@ -87,6 +127,12 @@ namespace zim
       else
         minChunkSize = Arg<unsigned>(argc, argv, 's', 1024-64);
 
+      frameSize = Arg<unsigned>(argc, argv, "--frame-size", 0) * 1024;
+      compressionThreads = Arg<unsigned>(argc, argv, "--compression-threads", 1);
+      indexLast = Arg<bool>(argc, argv, "--index-last");
+      deduplicate = Arg<bool>(argc, argv, "--deduplicate");
+      direntMemory = offset_type(Arg<unsigned>(argc, argv, "--dirent-memory", 0)) * 1024 * 1024;
+
 #if defined(ENABLE_ZLIB)
       if (Arg<bool>(argc, argv, "--zlib"))
         compression = zimcompZip;
@@ -99,6 +145,529 @@ namespace zim
       if (Arg<bool>(argc, argv, "--lzma"))
         compression = zimcompLzma;
 #endif
+#if defined(ENABLE_ZSTD)
+      if (Arg<bool>(argc, argv, "--zstd"))
+        compression = zimcompZstd;
+      dictionarySize = Arg<unsigned>(argc, argv, "--zstd-dictionary", 0) * 1024;
+#endif
+#if defined(ENABLE_LZ4)
+      // comma separated mime types and a list of namespace characters,
+      // which are compressed with lz4
+      std::istringstream lz4MimeTypes(Arg<const char*>(argc, argv, "--lz4-mimetypes", "").getValue());
+      std::string mimeType;
+      while (std::getline(lz4MimeTypes, mimeType, ','))
+        if (!mimeType.empty())
+          setMimeTypeCompression(mimeType, zimcompLz4);
+
+      for (const char* ns = Arg<const char*>(argc, argv, "--lz4-namespaces", ""); *ns; ++ns)
+        setNamespaceCompression(*ns, zimcompLz4);
+#endif
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // ClusterCompressor
+    //
+    // Compresses clusters in a pool of threads. The compressed clusters are
+    // returned in the order, in which they were added. Without threads the
+    // clusters are compressed, when they are added.
+    //
+    class ClusterCompressor
+    {
+        struct Job
+        {
+          size_type idx;
+          Cluster cluster;
+          std::string data;
+          std::string error;
+          bool failed;
+          bool done;
+        };
+
+        class Worker : public Thread
+        {
+            ClusterCompressor& compressor;
+
+          protected:
+            void run()  { compressor.work(); }
+
+          public:
+            explicit Worker(ClusterCompressor& compressor_)
+              : compressor(compressor_)
+              { }
+        };
+
+        Mutex mutex;
+        Condition workAvailable;
+        Condition workDone;
+        std::deque<Job*> todo;    // jobs not yet taken by a worker
+        std::deque<Job*> jobs;    // all jobs not yet returned, in order
+        std::vector<Worker*> workers;
+        bool stopped;
+
+        static void compress(Job& job);
+        void work();
+        void stop();
+
+      public:
+        explicit ClusterCompressor(unsigned threads);
+        ~ClusterCompressor()  { stop(); }
+
+        void add(size_type idx, const Cluster& cluster);
+
+        /// Returns the next cluster in order of adding with its compressed
+        /// data. Returns false, if there is none or, unless wait is set, if
+        /// it is not compressed yet.
+        bool get(size_type& idx, std::string& data, bool wait);
+
+        /// Returns the number of clusters added and not yet returned.
+        unsigned size();
+    };
+
+    ClusterCompressor::ClusterCompressor(unsigned threads)
+      : stopped(false)
+    {
+      if (threads <= 1)
+        return;
+
+      log_debug("start " << threads << " compression threads");
+      try
+      {
+        for (unsigned n = 0; n < threads; ++n)
+        {
+          workers.push_back(new Worker(*this));
+          workers.back()->start();
+        }
+      }
+      catch (...)
+      {
+        stop();
+        throw;
+      }
+    }
+
+    void ClusterCompressor::stop()
+    {
+      {
+        MutexLock lock(mutex);
+        stopped = true;
+        workAvailable.broadcast();
+      }
+
+      for (std::vector<Worker*>::iterator it = workers.begin(); it != workers.end(); ++it)
+      {
+        (*it)->join();
+        delete *it;
+      }
+      workers.clear();
+
+      for (std::deque<Job*>::iterator it = jobs.begin(); it != jobs.end(); ++it)
+        delete *it;
+      jobs.clear();
+      todo.clear();
+    }
+
+    void ClusterCompressor::compress(Job& job)
+    {
+      try
+      {
+        std::ostringstream out;
+        out << job.cluster;
+        job.data = out.str();
+      }
+      catch (const std::exception& e)
+      {
+        job.error = e.what();
+        job.failed = true;
+      }
+
+      // the uncompressed data is not needed any more
+      job.cluster = Cluster();
+    }
+
+    void ClusterCompressor::work()
+    {
+      while (true)
+      {
+        Job* job;
+
+        {
+          MutexLock lock(mutex);
+          while (todo.empty() && !stopped)
+            workAvailable.wait(mutex);
+          if (stopped)
+            return;
+          job = todo.front();
+          todo.pop_front();
+        }
+
+        compress(*job);
+
+        {
+          MutexLock lock(mutex);
+          job->done = true;
+          workDone.broadcast();
+        }
+      }
+    }
+
+    void ClusterCompressor::add(size_type idx, const Cluster& cluster)
+    {
+      Job* job = new Job();
+      job->idx = idx;
+      job->cluster = cluster;
+      job->failed = false;
+      job->done = false;
+
+      if (workers.empty())
+      {
+        compress(*job);
+        job->done = true;
+        jobs.push_back(job);
+        return;
+      }
+
+      MutexLock lock(mutex);
+      jobs.push_back(job);
+      todo.push_back(job);
+      workAvailable.signal();
+    }
+
+    bool ClusterCompressor::get(size_type& idx, std::string& data, bool wait)
+    {
+      Job* job;
+
+      {
+        MutexLock lock(mutex);
+        if (jobs.empty())
+          return false;
+
+        while (!jobs.front()->done)
+        {
+          if (!wait)
+            return false;
+          workDone.wait(mutex);
+        }
+
+        job = jobs.front();
+        jobs.pop_front();
+      }
+
+      if (job->failed)
+      {
+        std::string error = job->error;
+        delete job;
+        throw std::runtime_error(error);
+      }
+
+      idx = job->idx;
+      data.swap(job->data);
+      delete job;
+      return true;
+    }
+
+    unsigned ClusterCompressor::size()
+    {
+      MutexLock lock(mutex);
+      return jobs.size();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // BufferedArticle
+    //
+    // A copy of an article with its data, so that the article passed to
+    // addArticle is not needed any more, when the call returns.
+    //
+    class BufferedArticle : public Article
+    {
+        std::string aid;
+        char ns;
+        std::string url;
+        std::string title;
+        size_type version;
+        bool redirect;
+        bool linktarget;
+        bool deleted;
+        std::string mimeType;
+        bool compress;
+        std::string redirectAid;
+        std::string parameter;
+        std::string data;
+
+      public:
+        explicit BufferedArticle(const Article& article);
+
+        std::string getAid() const            { return aid; }
+        char getNamespace() const             { return ns; }
+        std::string getUrl() const            { return url; }
+        std::string getTitle() const          { return title; }
+        size_type getVersion() const          { return version; }
+        bool isRedirect() const               { return redirect; }
+        bool isLinktarget() const             { return linktarget; }
+        bool isDeleted() const                { return deleted; }
+        std::string getMimeType() const       { return mimeType; }
+        bool shouldCompress() const           { return compress; }
+        std::string getRedirectAid() const    { return redirectAid; }
+        std::string getParameter() const      { return parameter; }
+        Blob getData() const                  { return Blob(data.data(), data.size()); }
+    };
+
+    BufferedArticle::BufferedArticle(const Article& article)
+      : aid(article.getAid()),
+        ns(article.getNamespace()),
+        url(article.getUrl()),
+        title(article.getTitle()),
+        version(article.getVersion()),
+        redirect(article.isRedirect()),
+        linktarget(article.isLinktarget()),
+        deleted(article.isDeleted()),
+        compress(false),
+        parameter(article.getParameter())
+    {
+      if (redirect)
+        redirectAid = article.getRedirectAid();
+      else if (!linktarget && !deleted)
+      {
+        mimeType = article.getMimeType();
+        compress = article.shouldCompress();
+        Blob blob = article.getData();
+        data.assign(blob.data(), blob.size());
+      }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // ArticleQueue
+    //
+    // The article source of a zim file created with addArticle. It passes
+    // the articles of the source given to start first and then the articles
+    // added. At most maxSize articles are queued; producers wait, until
+    // the creator takes articles.
+    //
+    class ArticleQueue : public ArticleSource
+    {
+        // the source of the metadata; articles are pulled from src, until
+        // it has no more
+        ArticleSource* meta;
+        ArticleSource* src;
+        unsigned maxSize;
+
+        Mutex mutex;
+        Condition notEmpty;
+        Condition notFull;
+        std::deque<BufferedArticle*> articles;
+        bool finished;
+        bool aborted;
+
+        // the article returned last, which is used by the creator until
+        // it fetches the next
+        BufferedArticle* current;
+
+      public:
+        ArticleQueue(ArticleSource* src_, unsigned maxSize_)
+          : meta(src_),
+            src(src_),
+            maxSize(maxSize_ > 0 ? maxSize_ : 1),
+            finished(false),
+            aborted(false),
+            current(0)
+          { }
+        ~ArticleQueue();
+
+        void setFilename(const std::string& fname)  { if (meta) meta->setFilename(fname); }
+        const Article* getNextArticle();
+        Uuid getUuid()              { return meta ? meta->getUuid() : ArticleSource::getUuid(); }
+        std::string getMainPage()   { return meta ? meta->getMainPage() : ArticleSource::getMainPage(); }
+        std::string getLayoutPage() { return meta ? meta->getLayoutPage() : ArticleSource::getLayoutPage(); }
+
+        // returns false, if the creator stopped after an error
+        bool push(BufferedArticle* article);
+        // no more articles are added
+        void finish();
+        // the creator stopped; producers do not wait any more
+        void abort();
+    };
+
+    ArticleQueue::~ArticleQueue()
+    {
+      delete current;
+      for (std::deque<BufferedArticle*>::iterator it = articles.begin(); it != articles.end(); ++it)
+        delete *it;
+    }
+
+    const Article* ArticleQueue::getNextArticle()
+    {
+      delete current;
+      current = 0;
+
+      if (src)
+      {
+        const Article* article = src->getNextArticle();
+        if (article)
+          return article;
+        src = 0;
+      }
+
+      MutexLock lock(mutex);
+      while (articles.empty() && !finished)
+        notEmpty.wait(mutex);
+
+      if (articles.empty())
+        return 0;
+
+      current = articles.front();
+      articles.pop_front();
+      notFull.signal();
+      return current;
+    }
+
+    bool ArticleQueue::push(BufferedArticle* article)
+    {
+      MutexLock lock(mutex);
+      while (articles.size() >= maxSize && !aborted)
+        notFull.wait(mutex);
+
+      if (aborted)
+      {
+        delete article;
+        return false;
+      }
+
+      articles.push_back(article);
+      notEmpty.signal();
+      return true;
+    }
+
+    void ArticleQueue::finish()
+    {
+      MutexLock lock(mutex);
+      finished = true;
+      notEmpty.broadcast();
+    }
+
+    void ArticleQueue::abort()
+    {
+      MutexLock lock(mutex);
+      aborted = true;
+      notFull.broadcast();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // CreatorThread
+    //
+    // Runs ZimCreator::create for the articles added with addArticle.
+    //
+    class CreatorThread : public Thread
+    {
+        ZimCreator& creator;
+        std::string fname;
+        ArticleQueue& queue;
+        std::string error;
+
+      protected:
+        void run();
+
+      public:
+        CreatorThread(ZimCreator& creator_, const std::string& fname_, ArticleQueue& queue_)
+          : creator(creator_),
+            fname(fname_),
+            queue(queue_)
+          { }
+
+        const std::string& getError() const  { return error; }
+    };
+
+    void CreatorThread::run()
+    {
+      try
+      {
+        creator.create(fname, queue);
+      }
+      catch (const std::exception& e)
+      {
+        error = e.what();
+        queue.abort();
+      }
+      catch (...)
+      {
+        error = "unknown error";
+        queue.abort();
+      }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // ZimCreator
+    //
+    ZimCreator::~ZimCreator()
+    {
+      if (creatorThread)
+      {
+        // the file is completed with the articles added so far
+        articleQueue->finish();
+        creatorThread->join();
+        delete creatorThread;
+        delete articleQueue;
+      }
+
+      delete external;
+    }
+
+    void ZimCreator::start(const std::string& fname, ArticleSource* src)
+    {
+      if (creatorThread)
+        throw std::runtime_error("zim file creation already started");
+
+      articleQueue = new ArticleQueue(src, queueSize);
+      creatorThread = new CreatorThread(*this, fname, *articleQueue);
+      try
+      {
+        creatorThread->start();
+      }
+      catch (...)
+      {
+        delete creatorThread;
+        creatorThread = 0;
+        delete articleQueue;
+        articleQueue = 0;
+        throw;
+      }
+    }
+
+    void ZimCreator::start(const std::string& fname)
+    {
+      start(fname, 0);
+    }
+
+    void ZimCreator::start(const std::string& fname, ArticleSource& src)
+    {
+      start(fname, &src);
+    }
+
+    void ZimCreator::addArticle(const Article& article)
+    {
+      if (!creatorThread)
+        throw std::runtime_error("zim file creation not started");
+
+      // the article is copied in the calling thread, so that producers
+      // fetch their data in parallel
+      if (!articleQueue->push(new BufferedArticle(article)))
+        throw std::runtime_error("zim file creation failed");
+    }
+
+    void ZimCreator::finish()
+    {
+      if (!creatorThread)
+        throw std::runtime_error("zim file creation not started");
+
+      articleQueue->finish();
+      creatorThread->join();
+
+      std::string error = creatorThread->getError();
+      delete creatorThread;
+      creatorThread = 0;
+      delete articleQueue;
+      articleQueue = 0;
+
+      if (!error.empty())
+        throw std::runtime_error(error);
     }
 
     void ZimCreator::create(const std::string& fname, ArticleSource& src)
@@ -112,13 +681,16 @@ namespace zim
       log_debug("basename " << basename);
       src.setFilename(fname);
 
+      delete external;
+      external = direntMemory > 0 ? new ExternalDirents(basename, direntMemory) : 0;
+
       INFO("create directory entries");
-      createDirentsAndClusters(src, basename + ".tmp");
-      INFO(dirents.size() << " directory entries created");
+      createDirentsAndClusters(src, indexLast ? basename + ".zim" : basename + ".tmp");
+      INFO(articleCount() << " directory entries created");
 
       INFO("create title index");
       createTitleIndex(src);
-      INFO(dirents.size() << " title index created");
+      INFO(articleCount() << " title index created");
       INFO(clusterOffsets.size() << " clusters created");
 
       INFO("fill header");
@@ -129,26 +701,265 @@ namespace zim
 
       ::remove((basename + ".tmp").c_str());
 
+      delete external;
+      external = 0;
+
       INFO("ready");
     }
 
-    void ZimCreator::createDirentsAndClusters(ArticleSource& src, const std::string& tmpfname)
+    namespace
+    {
+      // a cluster, which is filled, and the dirents of its blobs
+      struct OpenCluster
+      {
+        Cluster cluster;
+        ZimCreator::DirentPtrsType dirents;
+        // counts the clusters opened to find blobs in them by deduplication
+        size_type serial;
+      };
+
+      typedef std::map<CompressionType, OpenCluster> OpenClusters;
+
+#if __cplusplus >= 201103L
+      typedef std::unordered_map<std::string, ZimCreator::DirentsType::size_type> AidIndex;
+#else
+      typedef std::tr1::unordered_map<std::string, ZimCreator::DirentsType::size_type> AidIndex;
+#endif
+
+      // where a blob was added: the serial number of the cluster and the
+      // blob number in it
+      struct BlobLocation
+      {
+        CompressionType compression;
+        size_type serial;
+        size_type blobNumber;
+      };
+
+#if __cplusplus >= 201103L
+      typedef std::unordered_map<std::string, BlobLocation> BlobIndex;
+#else
+      typedef std::tr1::unordered_map<std::string, BlobLocation> BlobIndex;
+#endif
+
+      // the sha256 digest and the size of the blob identify it for
+      // deduplication; unlike md5, colliding blobs can't be constructed
+      std::string blobHash(const Blob& blob)
+      {
+        zim_SHA256_CTX context;
+        zim_SHA256Init(&context);
+        zim_SHA256Update(&context, reinterpret_cast<const unsigned char*>(blob.data()), blob.size());
+        unsigned char digest[32];
+        zim_SHA256Final(digest, &context);
+
+        size_type size = blob.size();
+        std::string hash(reinterpret_cast<const char*>(digest), sizeof(digest));
+        hash.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        return hash;
+      }
+
+      // the dirents of the open clusters get the number of the next
+      // cluster, when another cluster is written before
+      void renumberClusters(ZimCreator::DirentsType& dirents,
+                            const OpenClusters& openClusters, size_type clusterNumber)
+      {
+        for (OpenClusters::const_iterator it = openClusters.begin(); it != openClusters.end(); ++it)
+        {
+          const ZimCreator::DirentPtrsType& ptrs = it->second.dirents;
+          for (ZimCreator::DirentPtrsType::const_iterator dpi = ptrs.begin(); dpi != ptrs.end(); ++dpi)
+          {
+            Dirent& di = dirents[*dpi];
+            di.setCluster(clusterNumber, di.getBlobNumber());
+          }
+        }
+      }
+
+      // moves the dirents, which are not in an open cluster any more, to
+      // the external dirents
+      void spillDirents(ZimCreator::DirentsType& dirents,
+                        OpenClusters& openClusters, ExternalDirents& external)
+      {
+        std::vector<bool> open(dirents.size(), false);
+        for (OpenClusters::const_iterator it = openClusters.begin(); it != openClusters.end(); ++it)
+        {
+          const ZimCreator::DirentPtrsType& ptrs = it->second.dirents;
+          for (ZimCreator::DirentPtrsType::const_iterator dpi = ptrs.begin(); dpi != ptrs.end(); ++dpi)
+            open[*dpi] = true;
+        }
+
+        ZimCreator::DirentsType kept;
+        std::vector<ZimCreator::DirentsType::size_type> newIdx(dirents.size());
+        for (ZimCreator::DirentsType::size_type n = 0; n < dirents.size(); ++n)
+        {
+          if (open[n])
+          {
+            newIdx[n] = kept.size();
+            kept.push_back(dirents[n]);
+          }
+          else
+            external.add(dirents[n]);
+        }
+
+        for (OpenClusters::iterator it = openClusters.begin(); it != openClusters.end(); ++it)
+        {
+          ZimCreator::DirentPtrsType& ptrs = it->second.dirents;
+          for (ZimCreator::DirentPtrsType::iterator dpi = ptrs.begin(); dpi != ptrs.end(); ++dpi)
+            *dpi = newIdx[*dpi];
+        }
+
+        dirents.swap(kept);
+      }
+    }
+
+    CompressionType ZimCreator::getCompression(const Article& article) const
+    {
+      if (!article.shouldCompress())
+        return zimcompNone;
+
+      MimeTypeCompressions::const_iterator mit = mimeTypeCompressions.find(article.getMimeType());
+      if (mit != mimeTypeCompressions.end())
+        return mit->second;
+
+      NamespaceCompressions::const_iterator nit = namespaceCompressions.find(article.getNamespace());
+      if (nit != namespaceCompressions.end())
+        return nit->second;
+
+      return compression;
+    }
+
+    void ZimCreator::writeCluster(std::ostream& out, Cluster& cluster)
+    {
+      // The cluster is handed over and the caller continues with an empty
+      // one, since it may be compressed in the background.
+      Cluster next;
+      next.setCompression(cluster.getCompression());
+      next.setFrameSize(cluster.getFrameSize());
+
+      clusterOffsets.push_back(0);
+      if (sampling)
+      {
+        // Keep the cluster until the dictionary is trained; it is written
+        // with its number reserved.
+        pendingClusters.push_back(cluster);
+        pendingSize += cluster.size();
+      }
+      else
+        compressCluster(out, clusterOffsets.size() - 1, cluster);
+
+      cluster = next;
+    }
+
+    void ZimCreator::compressCluster(std::ostream& out, size_type idx, Cluster& cluster)
+    {
+      if (dictionary && cluster.getCompression() == zimcompZstd)
+        cluster.setDictionary(dictionary);
+
+      compressor->add(idx, cluster);
+      writeCompressedClusters(out, false);
+    }
+
+    void ZimCreator::writeCompressedClusters(std::ostream& out, bool all)
+    {
+      // Clusters are written in the order of their numbers. Not more than
+      // two clusters per thread are kept in memory.
+      size_type idx;
+      std::string data;
+      while (compressor->get(idx, data, all || compressor->size() > 2 * compressionThreads))
+      {
+        clusterOffsets[idx] = offset_type(out.tellp()) - clusterFilePos();
+        out.write(data.data(), data.size());
+        currentSize += data.size() +
+          sizeof(offset_type) /* for cluster pointer entry */;
+      }
+    }
+
+    void ZimCreator::addSample(const Blob& blob)
+    {
+      // zstd trains best on many small samples
+      size_type size = std::min<size_type>(blob.size(), 64 * 1024);
+      if (size == 0)
+        return;
+
+      samples.append(blob.data(), size);
+      sampleSizes.push_back(size);
+    }
+
+    void ZimCreator::createDictionary(std::ostream& out)
+    {
+      sampling = false;
+
+      INFO("train compression dictionary from " << sampleSizes.size() << " articles");
+      dictionary = Dictionary::train(samples, sampleSizes, dictionarySize);
+      std::string().swap(samples);
+      std::vector<size_type>().swap(sampleSizes);
+
+      // write the clusters held back
+      for (std::vector<Cluster>::size_type n = 0; n < pendingClusters.size(); ++n)
+        compressCluster(out, n, pendingClusters[n]);
+      pendingClusters.clear();
+      pendingSize = 0;
+
+      if (!dictionary)
+      {
+        INFO("no compression dictionary created");
+        return;
+      }
+
+      INFO("compression dictionary with " << dictionary->getSize() << " bytes created");
+
+      // store the dictionary as metadata article in its own cluster
+      Dirent dirent;
+      dirent.setAid(std::string(1, Dictionary::ns) + '/' + Dictionary::url);
+      dirent.setUrl(Dictionary::ns, Dictionary::url);
+      uint16_t oldMimeIdx = nextMimeIdx;
+      dirent.setArticle(getMimeTypeIdx("application/octet-stream"), clusterOffsets.size(), 0);
+      dirent.setCompress(false);
+      if (oldMimeIdx != nextMimeIdx)
+        currentSize += rmimeTypes[oldMimeIdx].size() + 1 /* trailing null */;
+
+      currentSize +=
+        dirent.getDirentSize() /* for directory entry */ +
+        sizeof(offset_type) /* for url pointer list */ +
+        sizeof(size_type) /* for title pointer list */;
+      dirents.push_back(dirent);
+
+      Cluster cluster;
+      cluster.setCompression(zimcompNone);
+      cluster.addBlob(dictionary->getData(), dictionary->getSize());
+      writeCluster(out, cluster);
+    }
+
+    void ZimCreator::createDirentsAndClusters(ArticleSource& src, const std::string& clusterfname)
     {
       INFO("collect articles");
-      std::ofstream out(tmpfname.c_str());
+      sampling = dictionarySize > 0 && compression == zimcompZstd;
+      std::ofstream out(clusterfname.c_str());
+
+      // with the index last the header is written, when the file is complete
+      if (indexLast)
+        out << std::string(Fileheader::size, '\0');
       currentSize =
         80 /* for header */ +
         1 /* for mime type table termination */ +
         16 /* for md5sum */;
 
-      // We keep both a "compressed cluster" and an "uncompressed cluster"
-      // because we don't know which one will fill up first.  We also need
-      // to track the dirents currently in each, so we can fix up the
-      // cluster index if the other one ends up written first.
-      DirentPtrsType compDirents, uncompDirents;
-      Cluster compCluster, uncompCluster;
-      compCluster.setCompression(compression);
-      uncompCluster.setCompression(zimcompNone);
+      // We keep an open cluster for each compression type in use, e.g. a
+      // "compressed cluster" and an "uncompressed cluster", because we
+      // don't know which one will fill up first.  We also need to track
+      // the dirents currently in each, so we can fix up the cluster index
+      // if another one ends up written first.
+      OpenClusters openClusters;
+
+      // full clusters are compressed while the next ones are filled; the
+      // compressor is only used within this method
+      ClusterCompressor clusterCompressor(compressionThreads);
+      compressor = &clusterCompressor;
+
+      // With deduplication, the blobs added are found by their hash. Until
+      // their cluster is written, its number is not known, so clusters get
+      // a serial number, which is translated, when written.
+      const size_type unwritten = std::numeric_limits<size_type>::max();
+      BlobIndex blobIndex;
+      std::vector<size_type> clusterNumbers;
 
       const Article* article;
       while ((article = src.getNextArticle()) != 0)
@@ -158,6 +969,7 @@ namespace zim
         dirent.setUrl(article->getNamespace(), article->getUrl());
         dirent.setTitle(article->getTitle());
         dirent.setParameter(article->getParameter());
+        CompressionType articleCompression = zimcompNone;
 
         log_debug("article " << dirent.getLongUrl() << " fetched");
 
@@ -179,7 +991,8 @@ namespace zim
         {
           uint16_t oldMimeIdx = nextMimeIdx;
           dirent.setArticle(getMimeTypeIdx(article->getMimeType()), 0, 0);
-          dirent.setCompress(article->shouldCompress());
+          articleCompression = getCompression(*article);
+          dirent.setCompress(articleCompression != zimcompNone);
           log_debug("is article; mimetype " << dirent.getMimeType());
           if (oldMimeIdx != nextMimeIdx)
           {
@@ -194,6 +1007,7 @@ namespace zim
           sizeof(offset_type) /* for url pointer list */ +
           sizeof(size_type) /* for title pointer list */;
         dirents.push_back(dirent);
+        direntsSize += sizeof(Dirent) + dirent.getDirentSize();
 
         // If this is a redirect, we're done: there's no blob to add.
         if (dirent.isRedirect())
@@ -208,178 +1022,460 @@ namespace zim
           isEmpty = false;
         }
 
-        Cluster *cluster;
-        DirentPtrsType *myDirents, *otherDirents;
-        if (dirent.isCompress())
+        std::string hash;
+        BlobIndex::const_iterator bi;
+        if (deduplicate)
+        {
+          hash = blobHash(blob);
+          bi = blobIndex.find(hash);
+        }
+
+        if (deduplicate && bi != blobIndex.end())
         {
-          cluster = &compCluster;
-          myDirents = &compDirents;
-          otherDirents = &uncompDirents;
+          // point to the blob added before
+          const BlobLocation& location = bi->second;
+          log_debug("duplicate of blob " << location.blobNumber << " in cluster " << location.serial);
+          dirents.back().setCompress(location.compression != zimcompNone);
+          size_type clusterNumber = clusterNumbers[location.serial];
+          if (clusterNumber == unwritten)
+          {
+            // the cluster is still open and renumbered with its dirents
+            dirents.back().setCluster(clusterOffsets.size(), location.blobNumber);
+            openClusters[location.compression].dirents.push_back(dirents.size()-1);
+          }
+          else
+            dirents.back().setCluster(clusterNumber, location.blobNumber);
         }
         else
         {
-          cluster = &uncompCluster;
-          myDirents = &uncompDirents;
-          otherDirents = &compDirents;
-        }
-
-        // If cluster will be too large, write it to dis, and open a new
-        // one for the content.
-        if ( cluster->count()
-          && cluster->size()+blob.size() >= minChunkSize * 1024
-           )
-        {
-          log_info("cluster with " << cluster->count() << " articles, " <<
-                   cluster->size() << " bytes; current title \"" <<
-                   dirent.getTitle() << '\"');
-          offset_type start = out.tellp();
-          clusterOffsets.push_back(start);
-          out << *cluster;
-          log_debug("cluster written");
-          cluster->clear();
-          myDirents->clear();
-          // Update the cluster number of the dirents *not* written to disk.
-          for (DirentPtrsType::iterator dpi = otherDirents->begin();
-               dpi != otherDirents->end(); ++dpi)
+          OpenClusters::iterator oc = openClusters.find(articleCompression);
+          if (oc == openClusters.end())
           {
-            Dirent *di = &dirents[*dpi];
-            di->setCluster(clusterOffsets.size(), di->getBlobNumber());
+            oc = openClusters.insert(OpenClusters::value_type(articleCompression, OpenCluster())).first;
+            oc->second.cluster.setCompression(articleCompression);
+            oc->second.cluster.setFrameSize(frameSize);
+            oc->second.serial = clusterNumbers.size();
+            clusterNumbers.push_back(unwritten);
+          }
+
+          Cluster *cluster = &oc->second.cluster;
+          DirentPtrsType *myDirents = &oc->second.dirents;
+
+          // If cluster will be too large, write it to dis, and open a new
+          // one for the content.
+          if ( cluster->count()
+            && cluster->size()+blob.size() >= minChunkSize * 1024
+             )
+          {
+            log_info("cluster with " << cluster->count() << " articles, " <<
+                     cluster->size() << " bytes; current title \"" <<
+                     dirent.getTitle() << '\"');
+            clusterNumbers[oc->second.serial] = clusterOffsets.size();
+            writeCluster(out, *cluster);
+            log_debug("cluster written");
+            cluster->clear();
+            myDirents->clear();
+            oc->second.serial = clusterNumbers.size();
+            clusterNumbers.push_back(unwritten);
+            // Update the cluster number of the dirents *not* written to disk.
+            renumberClusters(dirents, openClusters, clusterOffsets.size());
+          }
+
+          if (deduplicate)
+          {
+            BlobLocation location;
+            location.compression = articleCompression;
+            location.serial = oc->second.serial;
+            location.blobNumber = cluster->count();
+            blobIndex[hash] = location;
+          }
+
+          dirents.back().setCluster(clusterOffsets.size(), cluster->count());
+          cluster->addBlob(blob);
+          myDirents->push_back(dirents.size()-1);
+
+          if (sampling)
+          {
+            if (articleCompression == zimcompZstd)
+              addSample(blob);
+            if (samples.size() >= offset_type(dictionarySize) * 100
+              || pendingSize >= offset_type(dictionarySize) * 200)
+            {
+              createDictionary(out);
+              renumberClusters(dirents, openClusters, clusterOffsets.size());
+            }
           }
-          offset_type end = out.tellp();
-          currentSize += (end - start) +
-            sizeof(offset_type) /* for cluster pointer entry */;
         }
 
-        dirents.back().setCluster(clusterOffsets.size(), cluster->count());
-        cluster->addBlob(blob);
-        myDirents->push_back(dirents.size()-1);
+        if (external && direntsSize > direntMemory / 4)
+        {
+          spillDirents(dirents, openClusters, *external);
+          direntsSize = 0;
+        }
+      }
+
+      if (sampling)
+      {
+        createDictionary(out);
+        renumberClusters(dirents, openClusters, clusterOffsets.size());
       }
 
       // When we've seen all articles, write any remaining clusters.
-      if (compCluster.count() > 0)
+      for (OpenClusters::iterator oc = openClusters.begin(); oc != openClusters.end(); ++oc)
       {
-        clusterOffsets.push_back(out.tellp());
-        out << compCluster;
-        for (DirentPtrsType::iterator dpi = uncompDirents.begin();
-             dpi != uncompDirents.end(); ++dpi)
+        if (oc->second.cluster.count() > 0)
         {
-          Dirent *di = &dirents[*dpi];
-          di->setCluster(clusterOffsets.size(), di->getBlobNumber());
+          clusterNumbers[oc->second.serial] = clusterOffsets.size();
+          writeCluster(out, oc->second.cluster);
+          oc->second.cluster.clear();
+          oc->second.dirents.clear();
+          renumberClusters(dirents, openClusters, clusterOffsets.size());
         }
       }
-      compCluster.clear();
-      compDirents.clear();
+      openClusters.clear();
 
-      if (uncompCluster.count() > 0)
-      {
-        clusterOffsets.push_back(out.tellp());
-        out << uncompCluster;
-      }
-      uncompCluster.clear();
-      uncompDirents.clear();
+      writeCompressedClusters(out, true);
+      compressor = 0;
 
       if (!out)
       {
-        throw std::runtime_error("failed to write temporary cluster file");
+        throw std::runtime_error("failed to write cluster file " + clusterfname);
       }
 
-      clustersSize = out.tellp();
+      clustersSize = offset_type(out.tellp()) - clusterFilePos();
+
+      if (external)
+      {
+        for (DirentsType::const_iterator di = dirents.begin(); di != dirents.end(); ++di)
+          external->add(*di);
+        DirentsType().swap(dirents);
 
-      // sort
-      INFO("sort " << dirents.size() << " directory entries (aid)");
-      std::sort(dirents.begin(), dirents.end(), compareAid);
+        INFO("sort directory entries");
+        external->sort(src.getMainPage(), src.getLayoutPage());
+      }
+      else
+        resolveRedirects();
+    }
 
-      // remove invalid redirects
-      INFO("remove invalid redirects from " << dirents.size() << " directory entries");
-      DirentsType::size_type di = 0;
-      while (di < dirents.size())
+    void ZimCreator::resolveRedirects()
+    {
+      INFO("index " << dirents.size() << " directory entries");
+      AidIndex aidIndex;
+      aidIndex.rehash(dirents.size());
+      for (DirentsType::size_type n = 0; n < dirents.size(); ++n)
+        aidIndex[dirents[n].getAid()] = n;
+
+      // Find the final target of each redirect, so that readers never
+      // follow more than one redirect. Redirects to missing articles,
+      // including those reached through other redirects, and redirect
+      // loops are invalid.
+      INFO("resolve redirects");
+      const size_type unresolved = std::numeric_limits<size_type>::max();
+      const size_type visiting = unresolved - 1;
+      const size_type invalid = unresolved - 2;
+
+      std::vector<size_type> target(dirents.size(), unresolved);
+      std::vector<size_type> chain;
+      for (DirentsType::size_type n = 0; n < dirents.size(); ++n)
       {
-        if (dirents[di].isRedirect())
+        size_type t = n;
+        while (target[t] == unresolved && dirents[t].isRedirect())
         {
-          log_debug("check " << dirents[di].getTitle() << " redirect to " << dirents[di].getRedirectAid() << " (" << di << '/' << dirents.size() << ')');
+          target[t] = visiting;
+          chain.push_back(t);
 
-          if (!std::binary_search(dirents.begin(), dirents.end(), Dirent(dirents[di].getRedirectAid()), compareAid))
+          AidIndex::const_iterator it = aidIndex.find(dirents[t].getRedirectAid());
+          if (it == aidIndex.end())
           {
-            log_debug("remove invalid redirection " << dirents[di].getTitle());
-            dirents.erase(dirents.begin() + di);
-            continue;
+            t = invalid;
+            break;
           }
+
+          t = it->second;
+        }
+
+        if (t != invalid)
+        {
+          if (target[t] == unresolved)
+            target[t] = t;
+          t = target[t] == visiting ? invalid : target[t];
         }
 
-        ++di;
+        for (std::vector<size_type>::const_iterator it = chain.begin(); it != chain.end(); ++it)
+          target[*it] = t;
+        chain.clear();
       }
 
-      // sort
+      AidIndex().swap(aidIndex);
+
+      // remove invalid redirects in one pass
+      INFO("remove invalid redirects from " << dirents.size() << " directory entries");
+      std::vector<size_type> newPos(dirents.size());
+      DirentsType::size_type count = 0;
+      for (DirentsType::size_type n = 0; n < dirents.size(); ++n)
+      {
+        if (target[n] == invalid)
+        {
+          log_debug("remove invalid redirection " << dirents[n].getTitle());
+          continue;
+        }
+
+        newPos[n] = count;
+        if (count != n)
+          dirents[count] = dirents[n];
+        target[count] = target[n];
+        ++count;
+      }
+
+      dirents.erase(dirents.begin() + count, dirents.end());
+      target.resize(count);
+      for (std::vector<size_type>::iterator it = target.begin(); it != target.end(); ++it)
+        *it = newPos[*it];
+
+      // sort; the index holds the position before sorting for now
       INFO("sort " << dirents.size() << " directory entries (url)");
+      for (DirentsType::size_type n = 0; n < dirents.size(); ++n)
+        dirents[n].setIdx(n);
       std::sort(dirents.begin(), dirents.end(), compareUrl);
 
-      // set index
+      // set index and translate redirect targets to index
       INFO("set index");
-      unsigned idx = 0;
-      for (DirentsType::iterator di = dirents.begin(); di != dirents.end(); ++di)
-        di->setIdx(idx++);
-
-      // sort
-      log_debug("sort " << dirents.size() << " directory entries (aid)");
-      std::sort(dirents.begin(), dirents.end(), compareAid);
+      for (DirentsType::size_type n = 0; n < dirents.size(); ++n)
+        newPos[dirents[n].getIdx()] = n;
 
-      // translate redirect aid to index
-      INFO("translate redirect aid to index");
       for (DirentsType::iterator di = dirents.begin(); di != dirents.end(); ++di)
       {
         if (di->isRedirect())
         {
-          DirentsType::iterator ddi = std::lower_bound(dirents.begin(), dirents.end(), di->getRedirectAid(), compareAid);
-          if (ddi != dirents.end() && ddi->getAid() == di->getRedirectAid())
-          {
-            log_debug("redirect aid=" << ddi->getAid() << " redirect index=" << ddi->getIdx());
-            di->setRedirect(ddi->getIdx());
-          }
-          else
-          {
-            std::ostringstream msg;
-            msg << "internal error: redirect aid " << di->getRedirectAid() << " not found";
-            log_fatal(msg.str());
-            throw std::runtime_error(msg.str());
-          }
+          log_debug("redirect aid=" << di->getRedirectAid() << " redirect index=" << newPos[target[di->getIdx()]]);
+          di->setRedirect(newPos[target[di->getIdx()]]);
         }
       }
 
-      // sort
-      log_debug("sort " << dirents.size() << " directory entries (url)");
-      std::sort(dirents.begin(), dirents.end(), compareUrl);
-
+      for (DirentsType::size_type n = 0; n < dirents.size(); ++n)
+        dirents[n].setIdx(n);
     }
 
     namespace
     {
-      class CompareTitle
+      // The sort key of the title index. The title points into the dirent,
+      // so comparing keys does not copy strings.
+      struct TitleKey
       {
-          ZimCreator::DirentsType& dirents;
+        char ns;
+        const std::string* title;
+        size_type idx;
+      };
+
+      struct CompareTitleKey
+      {
+        bool operator() (const TitleKey& k1, const TitleKey& k2) const
+        {
+          return k1.ns < k2.ns
+             || (k1.ns == k2.ns && *k1.title < *k2.title);
+        }
+      };
+
+      template <typename Iterator, typename Compare>
+      class SortThread : public Thread
+      {
+          Iterator begin;
+          Iterator end;
+          Compare compare;
+
+        protected:
+          void run()  { std::sort(begin, end, compare); }
 
         public:
-          explicit CompareTitle(ZimCreator::DirentsType& dirents_)
-            : dirents(dirents_)
+          SortThread(Iterator begin_, Iterator end_, Compare compare_)
+            : begin(begin_),
+              end(end_),
+              compare(compare_)
             { }
-          bool operator() (size_type titleIdx1, size_type titleIdx2) const
+      };
+
+      // Sorts parts of the range in threads and merges them. The comparison
+      // must not throw.
+      template <typename Iterator, typename Compare>
+      void parallelSort(Iterator begin, Iterator end, Compare compare, unsigned threads)
+      {
+        typedef SortThread<Iterator, Compare> SortThreadType;
+
+        std::size_t size = end - begin;
+        if (threads <= 1 || size < 2 * threads)
+        {
+          std::sort(begin, end, compare);
+          return;
+        }
+
+        std::vector<Iterator> bounds;
+        for (unsigned n = 0; n <= threads; ++n)
+          bounds.push_back(begin + size * n / threads);
+
+        std::vector<SortThreadType*> sorters;
+        try
+        {
+          for (unsigned n = 1; n < threads; ++n)
           {
-            Dirent d1 = dirents[titleIdx1];
-            Dirent d2 = dirents[titleIdx2];
-            return d1.getNamespace() < d2.getNamespace()
-               || (d1.getNamespace() == d2.getNamespace()
-                && d1.getTitle() < d2.getTitle());
+            sorters.push_back(new SortThreadType(bounds[n], bounds[n + 1], compare));
+            sorters.back()->start();
+          }
+
+          std::sort(bounds[0], bounds[1], compare);
+        }
+        catch (...)
+        {
+          // the started sorters still use the range
+          for (unsigned n = 0; n < sorters.size(); ++n)
+          {
+            sorters[n]->join();
+            delete sorters[n];
+          }
+          throw;
+        }
+
+        for (unsigned n = 0; n < sorters.size(); ++n)
+        {
+          sorters[n]->join();
+          delete sorters[n];
+        }
+
+        // merge neighbouring parts until one is left
+        while (bounds.size() > 2)
+        {
+          std::vector<Iterator> merged;
+          unsigned n;
+          for (n = 0; n + 2 < bounds.size(); n += 2)
+          {
+            std::inplace_merge(bounds[n], bounds[n + 1], bounds[n + 2], compare);
+            merged.push_back(bounds[n]);
+          }
+          for ( ; n < bounds.size() - 1; ++n)
+            merged.push_back(bounds[n]);
+          merged.push_back(bounds.back());
+          bounds.swap(merged);
+        }
+      }
+
+      // serializes a range of dirents into a buffer
+      class SerializeThread : public Thread
+      {
+          ZimCreator::DirentsType::const_iterator begin;
+          ZimCreator::DirentsType::const_iterator end;
+          std::string data;
+          std::string error;
+
+        protected:
+          void run();
+
+        public:
+          void set(ZimCreator::DirentsType::const_iterator begin_,
+                   ZimCreator::DirentsType::const_iterator end_)
+          {
+            begin = begin_;
+            end = end_;
+          }
+
+          void serialize()  { run(); }
+
+          // throws the error of the last run, if any
+          const std::string& getData() const
+          {
+            if (!error.empty())
+              throw std::runtime_error(error);
+            return data;
           }
       };
+
+      void SerializeThread::run()
+      {
+        try
+        {
+          std::ostringstream out;
+          for (ZimCreator::DirentsType::const_iterator it = begin; it != end; ++it)
+            out << *it;
+          data = out.str();
+          error.clear();
+        }
+        catch (const std::exception& e)
+        {
+          error = e.what();
+        }
+      }
+
+      // Serializes the dirents in batches, where each thread takes a part of
+      // the batch. The parts are written in order.
+      void serializeDirents(std::ostream& out, const ZimCreator::DirentsType& dirents, unsigned threads)
+      {
+        static const ZimCreator::DirentsType::size_type partSize = 16384;
+
+        if (threads < 1)
+          threads = 1;
+        std::vector<SerializeThread*> parts;
+        for (unsigned n = 0; n < threads; ++n)
+          parts.push_back(new SerializeThread());
+
+        try
+        {
+          ZimCreator::DirentsType::const_iterator it = dirents.begin();
+          while (it != dirents.end())
+          {
+            unsigned used;
+            for (used = 0; used < threads && it != dirents.end(); ++used)
+            {
+              ZimCreator::DirentsType::const_iterator next =
+                dirents.end() - it > static_cast<std::ptrdiff_t>(partSize) ? it + partSize : dirents.end();
+              parts[used]->set(it, next);
+              it = next;
+            }
+
+            for (unsigned n = 1; n < used; ++n)
+              parts[n]->start();
+            parts[0]->serialize();
+            for (unsigned n = 1; n < used; ++n)
+              parts[n]->join();
+
+            for (unsigned n = 0; n < used; ++n)
+            {
+              const std::string& data = parts[n]->getData();
+              out.write(data.data(), data.size());
+            }
+          }
+        }
+        catch (...)
+        {
+          for (unsigned n = 0; n < parts.size(); ++n)
+          {
+            parts[n]->join();
+            delete parts[n];
+          }
+          throw;
+        }
+
+        for (unsigned n = 0; n < parts.size(); ++n)
+          delete parts[n];
+      }
     }
 
     void ZimCreator::createTitleIndex(ArticleSource& src)
     {
-      titleIdx.resize(dirents.size());
+      // the external dirents have their title index already
+      if (external)
+        return;
+
+      std::vector<TitleKey> keys(dirents.size());
       for (DirentsType::size_type n = 0; n < dirents.size(); ++n)
-        titleIdx[n] = dirents[n].getIdx();
+      {
+        keys[n].ns = dirents[n].getNamespace();
+        keys[n].title = &dirents[n].getTitle();
+        keys[n].idx = dirents[n].getIdx();
+      }
+
+      parallelSort(keys.begin(), keys.end(), CompareTitleKey(), compressionThreads);
 
-      CompareTitle compareTitle(dirents);
-      std::sort(titleIdx.begin(), titleIdx.end(), compareTitle);
+      titleIdx.resize(keys.size());
+      for (std::vector<TitleKey>::size_type n = 0; n < keys.size(); ++n)
+        titleIdx[n] = keys[n].idx;
     }
 
     void ZimCreator::fillHeader(ArticleSource& src)
@@ -392,7 +1488,12 @@ namespace zim
       header.setMainPage(std::numeric_limits<size_type>::max());
       header.setLayoutPage(std::numeric_limits<size_type>::max());
 
-      if (!mainAid.empty() || !layoutAid.empty())
+      if (external)
+      {
+        header.setMainPage(external->getMainPage());
+        header.setLayoutPage(external->getLayoutPage());
+      }
+      else if (!mainAid.empty() || !layoutAid.empty())
       {
         for (DirentsType::const_iterator di = dirents.begin(); di != dirents.end(); ++di)
         {
@@ -411,7 +1512,7 @@ namespace zim
       }
 
       header.setUuid( src.getUuid() );
-      header.setArticleCount( dirents.size() );
+      header.setArticleCount( articleCount() );
       header.setUrlPtrPos( urlPtrPos() );
       header.setMimeListPos( mimeListPos() );
       header.setTitleIdxPos( titleIdxPos() );
@@ -430,7 +1531,6 @@ namespace zim
            " clusterPtrPos=" << clusterPtrPos() <<
            " clusterCount=" << clusterCount() <<
            " articleCount=" << articleCount() <<
-           " articleCount=" << dirents.size() <<
            " urlPtrPos=" << header.getUrlPtrPos() <<
            " titleIdxPos=" << header.getTitleIdxPos() <<
            " clusterCount=" << header.getClusterCount() <<
@@ -441,6 +1541,42 @@ namespace zim
 
     void ZimCreator::write(const std::string& fname, const std::string& tmpfname)
     {
+      if (indexLast)
+      {
+        // The clusters are in the zim file already. The checksum starts
+        // with the header, which is known only now, so they are read once
+        // more; the header and the index are hashed, while written.
+        std::fstream zimfile(fname.c_str(), std::ios::in | std::ios::out);
+        Md5stream md5;
+        Tee out(zimfile, md5);
+
+        out << header;
+
+        INFO("calculate checksum");
+        zimfile.seekg(clusterFilePos());
+        std::vector<char> buffer(1024 * 1024);
+        for (offset_type remaining = clustersSize; remaining > 0 && zimfile; )
+        {
+          std::streamsize n = static_cast<std::streamsize>(std::min(remaining, offset_type(buffer.size())));
+          zimfile.read(&buffer[0], n);
+          md5.write(&buffer[0], zimfile.gcount());
+          remaining -= zimfile.gcount();
+        }
+
+        zimfile.seekp(mimeListPos());
+        writeIndex(out);
+
+        if (!out)
+          throw std::runtime_error("failed to write zimfile");
+
+        unsigned char digest[16];
+        md5.getDigest(digest);
+        zimfile.write(reinterpret_cast<const char*>(digest), 16);
+        if (!zimfile)
+          throw std::runtime_error("failed to write checksum");
+        return;
+      }
+
       std::ofstream zimfile(fname.c_str());
       Md5stream md5;
       Tee out(zimfile, md5);
@@ -449,6 +1585,29 @@ namespace zim
 
       log_debug("after writing header - pos=" << zimfile.tellp());
 
+      writeIndex(out);
+
+      // write cluster data
+
+      if (!isEmpty)
+      {
+        std::ifstream blobsfile(tmpfname.c_str());
+        out << blobsfile.rdbuf();
+      }
+      else
+        log_warn("no data found");
+
+      if (!out)
+        throw std::runtime_error("failed to write zimfile");
+
+      log_debug("after writing clusterData - pos=" << out.tellp());
+      unsigned char digest[16];
+      md5.getDigest(digest);
+      zimfile.write(reinterpret_cast<const char*>(digest), 16);
+    }
+
+    void ZimCreator::writeIndex(std::ostream& out)
+    {
       // write mime type list
       std::vector<std::string> oldMImeList;
       std::vector<std::string> newMImeList;
@@ -472,6 +1631,22 @@ namespace zim
         }
       }
 
+      if (external)
+      {
+        for (unsigned i=0; i<newMImeList.size(); ++i)
+        {
+          out << newMImeList[i] << '\0';
+        }
+
+        out << '\0';
+
+        external->writeUrlPtrs(out, indexPos());
+        external->writeTitleIdx(out);
+        external->writeDirents(out, mapping);
+        writeClusterPtrs(out);
+        return;
+      }
+
       for (unsigned i=0; i<dirents.size(); ++i)
       {
         if (dirents[i].isArticle())
@@ -509,17 +1684,18 @@ namespace zim
 
       // write directory entries
 
-      for (DirentsType::const_iterator it = dirents.begin(); it != dirents.end(); ++it)
-      {
-        out << *it;
-        log_debug("write " << it->getTitle() << " dirent.size()=" << it->getDirentSize() << " pos=" << out.tellp());
-      }
+      serializeDirents(out, dirents, compressionThreads);
 
       log_debug("after writing dirents - pos=" << out.tellp());
 
+      writeClusterPtrs(out);
+    }
+
+    void ZimCreator::writeClusterPtrs(std::ostream& out)
+    {
       // write cluster offset list
 
-      off += clusterOffsets.size() * sizeof(offset_type);
+      offset_type off = clusterDataPos();
       for (OffsetsType::const_iterator it = clusterOffsets.begin(); it != clusterOffsets.end(); ++it)
       {
         offset_type o = (off + *it);
@@ -528,24 +1704,6 @@ namespace zim
       }
 
       log_debug("after writing clusterOffsets - pos=" << out.tellp());
-
-      // write cluster data
-
-      if (!isEmpty)
-      {
-        std::ifstream blobsfile(tmpfname.c_str());
-        out << blobsfile.rdbuf();
-      }
-      else
-        log_warn("no data found");
-
-      if (!out)
-        throw std::runtime_error("failed to write zimfile");
-
-      log_debug("after writing clusterData - pos=" << out.tellp());
-      unsigned char digest[16];
-      md5.getDigest(digest);
-      zimfile.write(reinterpret_cast<const char*>(digest), 16);
     }
 
     offset_type ZimCreator::mimeListSize() const
@@ -556,8 +1714,16 @@ namespace zim
       return ret;
     }
 
+    size_type ZimCreator::articleCount() const
+    {
+      return external ? external->getArticleCount() : dirents.size();
+    }
+
     offset_type ZimCreator::indexSize() const
     {
+      if (external)
+        return external->getIndexSize();
+
       offset_type s = 0;
 
       for (DirentsType::const_iterator it = dirents.begin(); it != dirents.end(); ++it)
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <zim/zstdstream.h>
+#include "log.h"
+#include <sstream>
+
+log_define("zim.zstd.compress")
+
+namespace zim
+{
+  namespace
+  {
+    size_t checkError(size_t ret)
+    {
+      if (::ZSTD_isError(ret))
+      {
+        std::ostringstream msg;
+        msg << "zstd-error: " << ::ZSTD_getErrorName(ret);
+        log_error(msg.str());
+        throw ZstdError(ret, msg.str());
+      }
+      return ret;
+    }
+  }
+
+  ZstdStreamBuf::ZstdStreamBuf(std::streambuf* sink_, int level, unsigned bufsize_,
+                               const void* dict, size_t dictSize)
+    : stream(::ZSTD_createCStream()),
+      obuffer(bufsize_),
+      sink(sink_)
+  {
+    if (stream == 0)
+      throw ZstdError(0, "failed to create zstd compressor");
+
+    try
+    {
+      checkError(::ZSTD_initCStream(stream, level));
+      if (dict)
+        checkError(::ZSTD_CCtx_loadDictionary(stream, dict, dictSize));
+    }
+    catch (...)
+    {
+      ::ZSTD_freeCStream(stream);
+      throw;
+    }
+
+    setp(&obuffer[0], &obuffer[0] + obuffer.size());
+  }
+
+  ZstdStreamBuf::~ZstdStreamBuf()
+  {
+    ::ZSTD_freeCStream(stream);
+  }
+
+  bool ZstdStreamBuf::writeSink(const char* data, size_t size)
+  {
+    return size == 0
+        || sink->sputn(data, size) == static_cast<std::streamsize>(size);
+  }
+
+  bool ZstdStreamBuf::compressBuffer()
+  {
+    // zstd consumes all input, so the buffer is empty afterwards
+    ZSTD_inBuffer in = { &obuffer[0], static_cast<size_t>(pptr() - &obuffer[0]), 0 };
+    char zbuffer[8192];
+    while (in.pos < in.size)
+    {
+      ZSTD_outBuffer out = { zbuffer, sizeof(zbuffer), 0 };
+      checkError(::ZSTD_compressStream(stream, &out, &in));
+      if (!writeSink(zbuffer, out.pos))
+        return false;
+    }
+
+    setp(&obuffer[0], &obuffer[0] + obuffer.size());
+    return true;
+  }
+
+  ZstdStreamBuf::int_type ZstdStreamBuf::overflow(int_type c)
+  {
+    if (!compressBuffer())
+      return traits_type::eof();
+
+    if (c != traits_type::eof())
+      sputc(traits_type::to_char_type(c));
+
+    return 0;
+  }
+
+  ZstdStreamBuf::int_type ZstdStreamBuf::underflow()
+  {
+    return traits_type::eof();
+  }
+
+  int ZstdStreamBuf::sync()
+  {
+    if (!compressBuffer())
+      return -1;
+
+    char zbuffer[8192];
+    size_t remaining;
+    do
+    {
+      ZSTD_outBuffer out = { zbuffer, sizeof(zbuffer), 0 };
+      remaining = checkError(::ZSTD_flushStream(stream, &out));
+      if (!writeSink(zbuffer, out.pos))
+        return -1;
+    } while (remaining > 0);
+
+    return 0;
+  }
+
+  int ZstdStreamBuf::end()
+  {
+    if (!compressBuffer())
+      throw ZstdError(0, "failed to send compressed data to sink in zstdstream");
+
+    char zbuffer[8192];
+    size_t remaining;
+    do
+    {
+      ZSTD_outBuffer out = { zbuffer, sizeof(zbuffer), 0 };
+      remaining = checkError(::ZSTD_endStream(stream, &out));
+      if (!writeSink(zbuffer, out.pos))
+        throw ZstdError(0, "failed to send compressed data to sink in zstdstream");
+    } while (remaining > 0);
+
+    return 0;
+  }
+
+  void ZstdStream::end()
+  {
+    if (streambuf.end() != 0)
+      setstate(failbit);
+  }
+
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <zim/cache.h>
+#include <zim/shardedcache.h>
+
+#include <cxxtools/unit/testsuite.h>
+#include <cxxtools/unit/registertest.h>
+
+class CacheTest : public cxxtools::unit::TestSuite
+{
+  public:
+    CacheTest()
+      : cxxtools::unit::TestSuite("zim::CacheTest")
+    {
+      registerMethod("PutGet", *this, &CacheTest::PutGet);
+      registerMethod("WinnerSurvivesScan", *this, &CacheTest::WinnerSurvivesScan);
+      registerMethod("Lru", *this, &CacheTest::Lru);
+      registerMethod("Clock", *this, &CacheTest::Clock);
+      registerMethod("SetMaxElements", *this, &CacheTest::SetMaxElements);
+      registerMethod("Erase", *this, &CacheTest::Erase);
+      registerMethod("Sharded", *this, &CacheTest::Sharded);
+      registerMethod("Cost", *this, &CacheTest::Cost);
+      registerMethod("ShardedLarge", *this, &CacheTest::ShardedLarge);
+    }
+
+    void PutGet()
+    {
+      zim::Cache<int, int> cache(4);
+      cache.put(1, 10);
+      cache.put(2, 20);
+
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.size(), 2);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.get(1), 10);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.get(2), 20);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.get(3, -1), -1);
+      CXXTOOLS_UNIT_ASSERT(!cache.getx(3).first);
+
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.getHits(), 2);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.getMisses(), 2);
+
+      for (int i = 10; i < 20; ++i)
+        cache.put(i, i);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.size(), 4);
+    }
+
+    void WinnerSurvivesScan()
+    {
+      zim::Cache<int, int> cache(4);
+      cache.put(1, 1);
+      cache.put(2, 2);
+      cache.get(1);
+      cache.get(2);
+
+      // elements, which are used only once, do not displace the winners
+      for (int i = 100; i < 200; ++i)
+        cache.put(i, i);
+
+      CXXTOOLS_UNIT_ASSERT(cache.getx(1).first);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(2).first);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(199).first);
+      CXXTOOLS_UNIT_ASSERT(!cache.getx(100).first);
+    }
+
+    void Lru()
+    {
+      zim::Cache<int, int> cache(4, zim::CACHE_LRU);
+      for (int i = 0; i < 4; ++i)
+        cache.put(i, i);
+
+      cache.get(0);
+      cache.put(4, 4);
+
+      CXXTOOLS_UNIT_ASSERT(cache.getx(0).first);
+      CXXTOOLS_UNIT_ASSERT(!cache.getx(1).first);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(4).first);
+    }
+
+    void Clock()
+    {
+      zim::Cache<int, int> cache(4, zim::CACHE_CLOCK);
+      for (int i = 0; i < 4; ++i)
+        cache.put(i, i);
+
+      cache.get(3);
+      cache.put(4, 4);
+      cache.put(5, 5);
+
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.size(), 4);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(3).first);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(4).first);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(5).first);
+    }
+
+    void SetMaxElements()
+    {
+      zim::Cache<int, int> cache(8);
+      for (int i = 0; i < 8; ++i)
+        cache.put(i, i);
+      cache.get(0);
+
+      cache.setMaxElements(2);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.size(), 2);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(0).first);
+
+      cache.setMaxElements(6);
+      for (int i = 10; i < 20; ++i)
+        cache.put(i, i);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.size(), 6);
+    }
+
+    void Erase()
+    {
+      zim::Cache<int, int> cache(4, zim::CACHE_CLOCK);
+      for (int i = 0; i < 4; ++i)
+        cache.put(i, i);
+
+      CXXTOOLS_UNIT_ASSERT(cache.erase(2));
+      CXXTOOLS_UNIT_ASSERT(!cache.erase(2));
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.size(), 3);
+
+      cache.put(5, 5);
+      cache.put(6, 6);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.size(), 4);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(6).first);
+    }
+
+    void Sharded()
+    {
+      zim::ShardedCache<int, int> cache(64, 4);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.getCountShards(), 4);
+
+      for (int i = 0; i < 32; ++i)
+        cache.put(i, i * 2);
+
+      for (int i = 0; i < 32; ++i)
+      {
+        std::pair<bool, int> v = cache.getx(i);
+        CXXTOOLS_UNIT_ASSERT(v.first);
+        CXXTOOLS_UNIT_ASSERT_EQUALS(v.second, i * 2);
+      }
+      CXXTOOLS_UNIT_ASSERT(!cache.getx(100).first);
+
+      unsigned hits = 0;
+      unsigned misses = 0;
+      for (unsigned n = 0; n < cache.getCountShards(); ++n)
+      {
+        hits += cache.getHits(n);
+        misses += cache.getMisses(n);
+      }
+
+      CXXTOOLS_UNIT_ASSERT_EQUALS(hits, 32);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(misses, 1);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.getHits(), 32);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.getMisses(), 1);
+
+      // small caches use fewer segments
+      zim::ShardedCache<int, int> small(4, 16);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(small.getCountShards(), 2);
+    }
+
+    void Cost()
+    {
+      zim::Cache<int, int> cache(1000);
+      cache.put(1, 1, 400);
+      cache.get(1);
+      cache.put(2, 2, 300);
+      cache.put(3, 3, 300);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.getCost(), 1000);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.size(), 3);
+
+      // drops the loosers until the new element fits
+      cache.put(4, 4, 500);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.getCost(), 900);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(1).first);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(4).first);
+      CXXTOOLS_UNIT_ASSERT(!cache.getx(2).first);
+
+      // elements larger than the cache are not cached
+      cache.put(5, 5, 2000);
+      CXXTOOLS_UNIT_ASSERT(!cache.getx(5).first);
+
+      cache.setMaxElements(500);
+      CXXTOOLS_UNIT_ASSERT(cache.getCost() <= 500);
+
+      zim::ShardedCache<int, int> sharded(1000, 2);
+      sharded.put(1, 1, 100);
+      sharded.put(2, 2, 200);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(sharded.getCost(), 300);
+      sharded.setMaxElements(100);
+      CXXTOOLS_UNIT_ASSERT(sharded.getCost() <= 100);
+    }
+
+    void ShardedLarge()
+    {
+      // each segment holds 250; larger elements are still cached
+      zim::ShardedCache<int, int> cache(1000, 4, zim::CACHE_WINNER, true);
+      cache.put(1, 1, 600);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(1).first);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.getCost(), 600);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.size(), 1);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.getMaxElements(), 1000);
+
+      // a second large element does not fit besides the first
+      cache.put(2, 2, 500);
+      CXXTOOLS_UNIT_ASSERT(cache.getx(2).first);
+      CXXTOOLS_UNIT_ASSERT(!cache.getx(1).first);
+
+      // small elements take their budget from the large ones
+      for (int i = 10; i < 20; ++i)
+        cache.put(i, i, 60);
+      CXXTOOLS_UNIT_ASSERT(cache.getCost() <= 1000);
+
+      // elements larger than the whole cache are not cached
+      cache.put(3, 3, 2000);
+      CXXTOOLS_UNIT_ASSERT(!cache.getx(3).first);
+
+      CXXTOOLS_UNIT_ASSERT(!cache.erase(1));
+      cache.put(4, 4, 300);
+      CXXTOOLS_UNIT_ASSERT(cache.erase(4));
+      CXXTOOLS_UNIT_ASSERT(!cache.getx(4).first);
+
+      cache.setMaxElements(400);
+      CXXTOOLS_UNIT_ASSERT(cache.getCost() <= 400);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.getMaxElements(), 400);
+
+      cache.clear();
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cache.getCost(), 0);
+
+      // without the large segment they are dropped
+      zim::ShardedCache<int, int> plain(1000, 4);
+      plain.put(1, 1, 600);
+      CXXTOOLS_UNIT_ASSERT(!plain.getx(1).first);
+    }
+
+};
+
+cxxtools::unit::RegisterTest<CacheTest> register_CacheTest;
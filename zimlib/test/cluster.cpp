@@ -18,6 +18,9 @@
  */
 
 #include <zim/cluster.h>
+#include <zim/blob.h>
+#include <zim/dictionary.h>
+#include <zim/error.h>
 #include <zim/fstream.h>
 #include <zim/zim.h>
 #include <sstream>
@@ -39,6 +42,12 @@ class ClusterTest : public cxxtools::unit::TestSuite
       registerMethod("CreateCluster", *this, &ClusterTest::CreateCluster);
       registerMethod("ReadWriteCluster", *this, &ClusterTest::ReadWriteCluster);
       registerMethod("ReadWriteEmpty", *this, &ClusterTest::ReadWriteEmpty);
+      registerMethod("ReadMappedCluster", *this, &ClusterTest::ReadMappedCluster);
+      registerMethod("ReadBlobUncompressed", *this, &ClusterTest::ReadBlobUncompressed);
+      registerMethod("ReuseDecoder", *this, &ClusterTest::ReuseDecoder);
+      registerMethod("ReadBlockCompressed", *this, &ClusterTest::ReadBlockCompressed);
+      registerMethod("ReadFramedCluster", *this, &ClusterTest::ReadFramedCluster);
+      registerMethod("ReadPartialMapped", *this, &ClusterTest::ReadPartialMapped);
 #if defined(ENABLE_ZLIB)
       registerMethod("ReadWriteClusterZ", *this, &ClusterTest::ReadWriteClusterZ);
 #endif
@@ -47,6 +56,11 @@ class ClusterTest : public cxxtools::unit::TestSuite
 #endif
 #if defined(ENABLE_LZMA)
       registerMethod("ReadWriteClusterLzma", *this, &ClusterTest::ReadWriteClusterLzma);
+      registerMethod("ReadPartialClusterLzma", *this, &ClusterTest::ReadPartialClusterLzma);
+      registerMethod("ReadTruncatedClusterLzma", *this, &ClusterTest::ReadTruncatedClusterLzma);
+#endif
+#if defined(ENABLE_ZSTD)
+      registerMethod("ReadWriteClusterZstdDictionary", *this, &ClusterTest::ReadWriteClusterZstdDictionary);
 #endif
     }
 
@@ -126,6 +140,363 @@ class ClusterTest : public cxxtools::unit::TestSuite
       std::remove(name.c_str());
     }
 
+    void ReadMappedCluster()
+    {
+      std::string name = std::tmpnam(NULL);
+      std::ofstream os;
+      os.open(name.c_str());
+
+      zim::Cluster cluster;
+
+      std::string blob0("123456789012345678901234567890");
+      std::string blob1("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+      std::string blob2("abcdefghijklmnopqrstuvwxyz");
+
+      cluster.addBlob(blob0.data(), blob0.size());
+      cluster.addBlob(blob1.data(), blob1.size());
+      cluster.addBlob(blob2.data(), blob2.size());
+
+      os << cluster;
+      os.close();
+
+      zim::SmartPtr<zim::FileCompound> file = new zim::FileCompound(name);
+      CXXTOOLS_UNIT_ASSERT(file->map());
+
+      zim::Cluster cluster2;
+      cluster2.init_from_file(file, 0, file->fsize());
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.count(), 3);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getBlobSize(0), blob0.size());
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getBlobSize(1), blob1.size());
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getBlobSize(2), blob2.size());
+      CXXTOOLS_UNIT_ASSERT(std::equal(cluster2.getBlobPtr(0), cluster2.getBlobPtr(0) + cluster2.getBlobSize(0), blob0.data()));
+      CXXTOOLS_UNIT_ASSERT(std::equal(cluster2.getBlobPtr(2), cluster2.getBlobPtr(2) + cluster2.getBlobSize(2), blob2.data()));
+      std::remove(name.c_str());
+    }
+
+    void ReadBlobUncompressed()
+    {
+      std::string name = std::tmpnam(NULL);
+      std::ofstream os;
+      os.open(name.c_str());
+
+      zim::Cluster cluster;
+
+      std::string blob0("123456789012345678901234567890");
+      std::string blob1("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+      std::string blob2("abcdefghijklmnopqrstuvwxyz");
+
+      cluster.addBlob(blob0.data(), blob0.size());
+      cluster.addBlob(blob1.data(), blob1.size());
+      cluster.addBlob(blob2.data(), blob2.size());
+
+      os << cluster;
+      os.close();
+
+      zim::SmartPtr<zim::FileCompound> file = new zim::FileCompound(name);
+      zim::Cluster cluster2;
+      cluster2.init_from_file(file, 0);
+
+      // blobs are read one by one, before the cluster data is read
+      zim::Blob b1 = cluster2.getBlob(1);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(std::string(b1.data(), b1.size()), blob1);
+      zim::Blob b2 = cluster2.getBlob(2);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(std::string(b2.data(), b2.size()), blob2);
+
+      // reading the whole cluster does not invalidate the blobs
+      CXXTOOLS_UNIT_ASSERT(std::equal(cluster2.getBlobPtr(0), cluster2.getBlobPtr(0) + cluster2.getBlobSize(0), blob0.data()));
+      zim::Blob b0 = cluster2.getBlob(0);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(std::string(b0.data(), b0.size()), blob0);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(std::string(b1.data(), b1.size()), blob1);
+      std::remove(name.c_str());
+    }
+
+    void readRepeatedly(zim::CompressionType compression)
+    {
+      std::string blobs[2] = { "123456789012345678901234567890",
+                               "ABCDEFGHIJKLMNOPQRSTUVWXYZ" };
+      std::string names[2];
+
+      for (unsigned n = 0; n < 2; ++n)
+      {
+        names[n] = std::tmpnam(NULL);
+        std::ofstream os;
+        os.open(names[n].c_str());
+
+        zim::Cluster cluster;
+        cluster.addBlob(blobs[n].data(), blobs[n].size());
+        cluster.setCompression(compression);
+        os << cluster;
+      }
+
+      // the decoder of a released cluster is reused for the next one
+      for (unsigned n = 0; n < 4; ++n)
+      {
+        zim::SmartPtr<zim::FileCompound> file = new zim::FileCompound(names[n % 2]);
+        const std::string& blob = blobs[n % 2];
+        zim::Cluster cluster2;
+        cluster2.init_from_file(file, 0);
+        CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.count(), 1);
+        CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getBlobSize(0), blob.size());
+        CXXTOOLS_UNIT_ASSERT(std::equal(cluster2.getBlobPtr(0), cluster2.getBlobPtr(0) + cluster2.getBlobSize(0), blob.data()));
+      }
+
+      std::remove(names[0].c_str());
+      std::remove(names[1].c_str());
+    }
+
+    void ReuseDecoder()
+    {
+#if defined(ENABLE_ZLIB)
+      readRepeatedly(zim::zimcompZip);
+#endif
+#if defined(ENABLE_BZIP2)
+      readRepeatedly(zim::zimcompBzip2);
+#endif
+#if defined(ENABLE_LZMA)
+      readRepeatedly(zim::zimcompLzma);
+#endif
+#if defined(ENABLE_ZSTD)
+      readRepeatedly(zim::zimcompZstd);
+#endif
+#if defined(ENABLE_LZ4)
+      readRepeatedly(zim::zimcompLz4);
+#endif
+    }
+
+    void readBlock(zim::CompressionType compression)
+    {
+      std::string name = std::tmpnam(NULL);
+      std::ofstream os;
+      os.open(name.c_str());
+
+      std::string blob0("123456789012345678901234567890");
+      std::string blob1("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+
+      zim::Cluster cluster;
+      cluster.addBlob(blob0.data(), blob0.size());
+      cluster.addBlob(blob1.data(), blob1.size());
+      cluster.setCompression(compression);
+      os << cluster;
+
+      // a second cluster follows, so that the size limits the first one
+      zim::offset_type size0 = os.tellp();
+      zim::Cluster cluster1;
+      cluster1.addBlob(blob1.data(), blob1.size());
+      cluster1.setCompression(compression);
+      os << cluster1;
+      zim::offset_type size1 = static_cast<zim::offset_type>(os.tellp()) - size0;
+      os.close();
+
+      zim::SmartPtr<zim::FileCompound> file = new zim::FileCompound(name);
+
+      zim::Cluster cluster2;
+      cluster2.init_from_file(file, 0, size0);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.count(), 2);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getBlobSize(0), blob0.size());
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getBlobSize(1), blob1.size());
+      CXXTOOLS_UNIT_ASSERT(std::equal(cluster2.getBlobPtr(0), cluster2.getBlobPtr(0) + cluster2.getBlobSize(0), blob0.data()));
+      CXXTOOLS_UNIT_ASSERT(std::equal(cluster2.getBlobPtr(1), cluster2.getBlobPtr(1) + cluster2.getBlobSize(1), blob1.data()));
+
+      zim::Cluster cluster3;
+      cluster3.init_from_file(file, size0, size1);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster3.count(), 1);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster3.getBlobSize(0), blob1.size());
+      CXXTOOLS_UNIT_ASSERT(std::equal(cluster3.getBlobPtr(0), cluster3.getBlobPtr(0) + cluster3.getBlobSize(0), blob1.data()));
+
+      // a truncated cluster is detected
+      zim::Cluster cluster4;
+      CXXTOOLS_UNIT_ASSERT_THROW(cluster4.init_from_file(file, size0, 8), std::exception);
+
+      std::remove(name.c_str());
+    }
+
+    void ReadBlockCompressed()
+    {
+#if defined(ENABLE_ZLIB)
+      readBlock(zim::zimcompZip);
+#endif
+#if defined(ENABLE_BZIP2)
+      readBlock(zim::zimcompBzip2);
+#endif
+#if defined(ENABLE_LZMA)
+      readBlock(zim::zimcompLzma);
+#endif
+#if defined(ENABLE_ZSTD)
+      readBlock(zim::zimcompZstd);
+#endif
+#if defined(ENABLE_LZ4)
+      readBlock(zim::zimcompLz4);
+#endif
+    }
+
+    void readFramed(zim::CompressionType compression)
+    {
+      std::string name = std::tmpnam(NULL);
+      std::ofstream os;
+      os.open(name.c_str());
+
+      // blobs spanning several frames of 64 bytes
+      std::vector<std::string> blobs;
+      zim::Cluster cluster;
+      for (unsigned n = 0; n < 20; ++n)
+      {
+        std::ostringstream blob;
+        for (unsigned i = 0; i <= n; ++i)
+          blob << "blob " << n << '.' << i << ';';
+        blobs.push_back(blob.str());
+        cluster.addBlob(blobs.back().data(), blobs.back().size());
+      }
+      cluster.setCompression(compression);
+      cluster.setFrameSize(64);
+      os << cluster;
+      os.close();
+
+      for (unsigned mapped = 0; mapped < 2; ++mapped)
+      {
+        zim::SmartPtr<zim::FileCompound> file = new zim::FileCompound(name);
+        if (mapped)
+          CXXTOOLS_UNIT_ASSERT(file->map());
+
+        // read the blobs in reverse order, so that later frames come first
+        zim::Cluster cluster2;
+        cluster2.init_from_file(file, 0, file->fsize());
+        CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getCompression(), compression);
+        CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getFrameSize(), 64);
+        CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.count(), blobs.size());
+        for (unsigned n = blobs.size(); n-- > 0; )
+        {
+          CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getBlobSize(n), blobs[n].size());
+          zim::Blob blob = cluster2.getBlob(n);
+          CXXTOOLS_UNIT_ASSERT_EQUALS(std::string(blob.data(), blob.size()), blobs[n]);
+        }
+      }
+
+      std::remove(name.c_str());
+    }
+
+    // writes a framed cluster with a part of the frame table replaced
+    void writeCorruptFrames(const std::string& name, zim::CompressionType compression,
+                            unsigned pos, zim::size_type value)
+    {
+      zim::Cluster cluster;
+      std::string blob(1000, 'x');
+      cluster.addBlob(blob.data(), blob.size());
+      cluster.setCompression(compression);
+      cluster.setFrameSize(64);
+
+      std::ostringstream data;
+      data << cluster;
+      std::string s = data.str();
+      // the table follows the compression byte
+      s.replace(1 + pos * sizeof(zim::size_type), sizeof(value),
+                reinterpret_cast<const char*>(&value), sizeof(value));
+
+      std::ofstream os(name.c_str());
+      os << s;
+    }
+
+    void readCorruptFrames(zim::CompressionType compression)
+    {
+      std::string name = std::tmpnam(NULL);
+
+      // a frame count, which exceeds the cluster, a frame end before the
+      // previous one and a last frame end past the cluster; 1000 bytes
+      // in frames of 64 bytes give 16 frame ends after the 2 header values
+      unsigned pos[] = { 1, 3, 17 };
+      zim::size_type value[] = { 0x7fffffff, 1, 0x7fffffff };
+      for (unsigned c = 0; c < 3; ++c)
+      {
+        writeCorruptFrames(name, compression, pos[c], value[c]);
+        for (unsigned mapped = 0; mapped < 2; ++mapped)
+        {
+          zim::SmartPtr<zim::FileCompound> file = new zim::FileCompound(name);
+          if (mapped)
+            CXXTOOLS_UNIT_ASSERT(file->map());
+
+          zim::Cluster cluster;
+          CXXTOOLS_UNIT_ASSERT_THROW(cluster.init_from_file(file, 0, file->fsize()), zim::ZimFileFormatError);
+          zim::Cluster cluster2;
+          CXXTOOLS_UNIT_ASSERT_THROW(cluster2.init_from_file(file, 0), zim::ZimFileFormatError);
+        }
+      }
+
+      std::remove(name.c_str());
+    }
+
+    void ReadFramedCluster()
+    {
+#if defined(ENABLE_ZLIB)
+      readFramed(zim::zimcompZip);
+#endif
+#if defined(ENABLE_BZIP2)
+      readFramed(zim::zimcompBzip2);
+#endif
+#if defined(ENABLE_LZMA)
+      readFramed(zim::zimcompLzma);
+      readCorruptFrames(zim::zimcompLzma);
+#endif
+#if defined(ENABLE_ZSTD)
+      readFramed(zim::zimcompZstd);
+#endif
+#if defined(ENABLE_LZ4)
+      readFramed(zim::zimcompLz4);
+#endif
+    }
+
+    // The mapped source ends with the cluster, so the decoder has to
+    // give out what it holds, when no more input is available.
+    void readPartialMapped(zim::CompressionType compression)
+    {
+      std::string name = std::tmpnam(NULL);
+
+      zim::Cluster cluster;
+      std::string blob0(100000, 'a');
+      std::string blob1;
+      for (unsigned n = 0; n < 100000; ++n)
+        blob1 += char('a' + n * n % 26);
+      cluster.addBlob(blob0.data(), blob0.size());
+      cluster.addBlob(blob1.data(), blob1.size());
+      cluster.setCompression(compression);
+
+      {
+        std::ofstream os(name.c_str());
+        os << cluster;
+      }
+
+      {
+        zim::SmartPtr<zim::FileCompound> file = new zim::FileCompound(name);
+        CXXTOOLS_UNIT_ASSERT(file->map());
+
+        zim::Cluster cluster2;
+        cluster2.init_from_file(file, 0, file->fsize(), true);
+        CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.count(), 2);
+        CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getBlobSize(1), blob1.size());
+        CXXTOOLS_UNIT_ASSERT(std::equal(cluster2.getBlobPtr(1), cluster2.getBlobPtr(1) + blob1.size(), blob1.data()));
+        CXXTOOLS_UNIT_ASSERT(std::equal(cluster2.getBlobPtr(0), cluster2.getBlobPtr(0) + blob0.size(), blob0.data()));
+      }
+
+      std::remove(name.c_str());
+    }
+
+    void ReadPartialMapped()
+    {
+#if defined(ENABLE_ZLIB)
+      readPartialMapped(zim::zimcompZip);
+#endif
+#if defined(ENABLE_BZIP2)
+      readPartialMapped(zim::zimcompBzip2);
+#endif
+#if defined(ENABLE_LZMA)
+      readPartialMapped(zim::zimcompLzma);
+#endif
+#if defined(ENABLE_ZSTD)
+      readPartialMapped(zim::zimcompZstd);
+#endif
+#if defined(ENABLE_LZ4)
+      readPartialMapped(zim::zimcompLz4);
+#endif
+    }
+
 #if defined(ENABLE_ZLIB)
     void ReadWriteClusterZ()
     {
@@ -238,6 +609,129 @@ class ClusterTest : public cxxtools::unit::TestSuite
       std::remove(name.c_str());
     }
 
+    void ReadPartialClusterLzma()
+    {
+      std::string name = std::tmpnam(NULL);
+      std::ofstream os;
+      os.open(name.c_str());
+
+      zim::Cluster cluster;
+
+      std::string blob0(100000, 'a');
+      std::string blob1(100000, 'b');
+      std::string blob2(100000, 'c');
+
+      cluster.addBlob(blob0.data(), blob0.size());
+      cluster.addBlob(blob1.data(), blob1.size());
+      cluster.addBlob(blob2.data(), blob2.size());
+      cluster.setCompression(zim::zimcompLzma);
+
+      os << cluster;
+      os.close();
+
+      zim::SmartPtr<zim::FileCompound> file = new zim::FileCompound(name);
+      zim::Cluster cluster2;
+      cluster2.init_from_file(file, 0, 0, true);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.count(), 3);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getCompression(), zim::zimcompLzma);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getBlobSize(0), blob0.size());
+
+      // blob 0 is valid before the rest is decompressed and stays valid
+      const char* p0 = cluster2.getBlobPtr(0);
+      CXXTOOLS_UNIT_ASSERT(std::equal(p0, p0 + blob0.size(), blob0.data()));
+      CXXTOOLS_UNIT_ASSERT(std::equal(cluster2.getBlobPtr(2), cluster2.getBlobPtr(2) + cluster2.getBlobSize(2), blob2.data()));
+      CXXTOOLS_UNIT_ASSERT(std::equal(cluster2.getBlobPtr(1), cluster2.getBlobPtr(1) + cluster2.getBlobSize(1), blob1.data()));
+      CXXTOOLS_UNIT_ASSERT(cluster2.getBlobPtr(0) == p0);
+      std::remove(name.c_str());
+    }
+
+    void ReadTruncatedClusterLzma()
+    {
+      zim::Cluster cluster;
+
+      // data, which does not compress well, so that the cut off part
+      // contains the last blob
+      std::string blob0;
+      std::string blob1;
+      unsigned x = 1;
+      for (unsigned n = 0; n < 100000; ++n)
+      {
+        x = x * 1103515245 + 12345;
+        blob0 += static_cast<char>(x >> 16);
+        x = x * 1103515245 + 12345;
+        blob1 += static_cast<char>(x >> 16);
+      }
+
+      cluster.addBlob(blob0.data(), blob0.size());
+      cluster.addBlob(blob1.data(), blob1.size());
+      cluster.setCompression(zim::zimcompLzma);
+
+      std::ostringstream data;
+      data << cluster;
+      std::string truncated = data.str().substr(0, data.str().size() / 2);
+
+      std::string name = std::tmpnam(NULL);
+      {
+        std::ofstream os(name.c_str());
+        os << truncated;
+      }
+
+      zim::SmartPtr<zim::FileCompound> file = new zim::FileCompound(name);
+      zim::Cluster cluster2;
+      cluster2.init_from_file(file, 0, truncated.size(), true);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.count(), 2);
+      CXXTOOLS_UNIT_ASSERT_THROW(cluster2.getBlobPtr(1), zim::ZimFileFormatError);
+      std::remove(name.c_str());
+    }
+
+#endif
+
+#if defined(ENABLE_ZSTD)
+    void ReadWriteClusterZstdDictionary()
+    {
+      std::string samples;
+      std::vector<zim::size_type> sampleSizes;
+      for (unsigned n = 0; n < 2000; ++n)
+      {
+        std::ostringstream s;
+        s << "<html><head><title>article " << n << "</title></head><body><p>text "
+          << n * 7919 % 1000 << "</p></body></html>";
+        samples += s.str();
+        sampleSizes.push_back(s.str().size());
+      }
+
+      zim::SmartPtr<zim::Dictionary> dictionary = zim::Dictionary::train(samples, sampleSizes, 4096);
+      CXXTOOLS_UNIT_ASSERT(dictionary);
+      CXXTOOLS_UNIT_ASSERT(dictionary->getId() != 0);
+
+      std::string name = std::tmpnam(NULL);
+      std::ofstream os;
+      os.open(name.c_str());
+
+      std::string blob0("<html><head><title>article 1</title></head><body><p>text 1</p></body></html>");
+
+      zim::Cluster cluster;
+      cluster.addBlob(blob0.data(), blob0.size());
+      cluster.setCompression(zim::zimcompZstd);
+      cluster.setDictionary(dictionary);
+      os << cluster;
+      zim::offset_type size = os.tellp();
+      os.close();
+
+      zim::SmartPtr<zim::FileCompound> file = new zim::FileCompound(name);
+
+      zim::Cluster cluster2;
+      cluster2.init_from_file(file, 0, size, false, dictionary);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.count(), 1);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(cluster2.getBlobSize(0), blob0.size());
+      CXXTOOLS_UNIT_ASSERT(std::equal(cluster2.getBlobPtr(0), cluster2.getBlobPtr(0) + cluster2.getBlobSize(0), blob0.data()));
+
+      // without the dictionary the cluster can't be read
+      zim::Cluster cluster3;
+      CXXTOOLS_UNIT_ASSERT_THROW(cluster3.init_from_file(file, 0, size), std::exception);
+
+      std::remove(name.c_str());
+    }
 #endif
 
 };
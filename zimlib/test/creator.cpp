@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <zim/writer/zimcreator.h>
+#include <zim/file.h>
+#include <zim/article.h>
+#include <zim/blob.h>
+#include <zim/fileheader.h>
+#include <zim/dirent.h>
+#include <zim/thread.h>
+#include <limits>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+
+#include <cxxtools/unit/testsuite.h>
+#include <cxxtools/unit/registertest.h>
+
+namespace
+{
+  class TestArticle : public zim::writer::Article
+  {
+    public:
+      std::string aid;
+      char ns;
+      std::string data;
+      std::string mimeType;
+      std::string redirectAid;
+
+      std::string getAid() const            { return aid; }
+      char getNamespace() const             { return ns; }
+      std::string getUrl() const            { return aid; }
+      std::string getTitle() const          { return "Title " + aid; }
+      bool isRedirect() const               { return !redirectAid.empty(); }
+      std::string getRedirectAid() const    { return redirectAid; }
+      std::string getMimeType() const       { return mimeType; }
+      zim::Blob getData() const             { return zim::Blob(data.data(), data.size()); }
+  };
+
+  class TestSource : public zim::writer::ArticleSource
+  {
+      unsigned next;
+
+    public:
+      std::vector<TestArticle> articles;
+      zim::Uuid uuid;
+      bool pull;
+
+      // Articles a0 ... a<count-1> with different data; every fifth is an
+      // image, so that there are compressed and uncompressed clusters.
+      explicit TestSource(unsigned count)
+        : next(0),
+          uuid(zim::Uuid::generate()),
+          pull(true)
+      {
+        for (unsigned n = 0; n < count; ++n)
+        {
+          std::ostringstream aid;
+          aid << 'a' << n;
+          std::ostringstream data;
+          for (unsigned k = 0; k < 100 + n % 1000; ++k)
+            data << char('a' + (n + k * k) % 26);
+          add(aid.str(), data.str(), n % 5 == 0 ? "image/png" : "text/html");
+        }
+      }
+
+      void add(const std::string& aid, const std::string& data,
+               const std::string& mimeType = "text/html")
+      {
+        TestArticle article;
+        article.aid = aid;
+        article.ns = 'A';
+        article.data = data;
+        article.mimeType = mimeType;
+        articles.push_back(article);
+      }
+
+      void addRedirect(const std::string& aid, const std::string& redirectAid)
+      {
+        TestArticle article;
+        article.aid = aid;
+        article.ns = 'A';
+        article.mimeType = "text/html";
+        article.redirectAid = redirectAid;
+        articles.push_back(article);
+      }
+
+      const zim::writer::Article* getNextArticle()
+      {
+        return pull && next < articles.size() ? &articles[next++] : 0;
+      }
+
+      zim::Uuid getUuid()             { return uuid; }
+      std::string getMainPage()       { return "a1"; }
+      std::string getLayoutPage()     { return "a2"; }
+  };
+
+  class Producer : public zim::Thread
+  {
+      zim::writer::ZimCreator& creator;
+      const TestSource& src;
+      unsigned first;
+      unsigned step;
+
+    protected:
+      void run()
+      {
+        try
+        {
+          for (unsigned n = first; n < src.articles.size(); n += step)
+            creator.addArticle(src.articles[n]);
+        }
+        catch (const std::exception&)
+        {
+          failed = true;
+        }
+      }
+
+    public:
+      bool failed;
+
+      Producer(zim::writer::ZimCreator& creator_, const TestSource& src_,
+               unsigned first_, unsigned step_)
+        : creator(creator_),
+          src(src_),
+          first(first_),
+          step(step_),
+          failed(false)
+        { }
+  };
+}
+
+class ZimCreatorTest : public cxxtools::unit::TestSuite
+{
+    // checks the data of all articles of src in the zim file
+    void checkArticles(zim::File& file, const TestSource& src)
+    {
+      CXXTOOLS_UNIT_ASSERT(file.verify());
+      for (unsigned n = 0; n < src.articles.size(); ++n)
+      {
+        const TestArticle& a = src.articles[n];
+        if (a.isRedirect())
+          continue;
+        zim::Article article = file.getArticle(a.ns, a.aid);
+        CXXTOOLS_UNIT_ASSERT(article.good());
+        zim::Blob data = article.getData();
+        CXXTOOLS_UNIT_ASSERT_EQUALS(std::string(data.data(), data.size()), a.data);
+      }
+    }
+
+    void checkHeader(zim::File& file, const TestSource& src)
+    {
+      const zim::Fileheader& header = file.getFileheader();
+      CXXTOOLS_UNIT_ASSERT(header.getUuid() == src.uuid);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(header.getMainPage(), file.getArticle('A', "a1").getIndex());
+      CXXTOOLS_UNIT_ASSERT_EQUALS(header.getLayoutPage(), file.getArticle('A', "a2").getIndex());
+    }
+
+    // articles with redirect chains, loops and redirects to missing
+    // articles
+    static void addRedirects(TestSource& src)
+    {
+      src.addRedirect("r1", "a5");
+      src.addRedirect("r2", "r1");
+      src.addRedirect("r3", "r2");
+      src.addRedirect("r4", "r3");
+      src.addRedirect("r5", "r6");
+      src.addRedirect("r6", "r5");
+      src.addRedirect("r7", "missing");
+      src.addRedirect("r8", "r7");
+      src.addRedirect("r9", "r9");
+      src.addRedirect("r10", "r4");
+      src.addRedirect("r11", "r5");
+    }
+
+    static void create(const std::string& name, TestSource& src,
+                       zim::offset_type direntMemory)
+    {
+      zim::writer::ZimCreator creator;
+      creator.setMinChunkSize(16);
+      creator.setDirentMemory(direntMemory);
+      creator.create(name, src);
+    }
+
+    void checkRedirects(zim::File& file)
+    {
+      const char* valid[] = { "r1", "r2", "r3", "r4", "r10" };
+      zim::size_type target = file.getArticle('A', "a5").getIndex();
+      for (unsigned n = 0; n < sizeof(valid) / sizeof(valid[0]); ++n)
+      {
+        zim::Article article = file.getArticle('A', valid[n]);
+        CXXTOOLS_UNIT_ASSERT(article.good());
+        CXXTOOLS_UNIT_ASSERT(article.isRedirect());
+        CXXTOOLS_UNIT_ASSERT_EQUALS(article.getDirent().getRedirectIndex(), target);
+      }
+
+      const char* invalid[] = { "r5", "r6", "r7", "r8", "r9", "r11" };
+      for (unsigned n = 0; n < sizeof(invalid) / sizeof(invalid[0]); ++n)
+        CXXTOOLS_UNIT_ASSERT(!file.getArticle('A', invalid[n]).good());
+    }
+
+  public:
+    ZimCreatorTest()
+      : cxxtools::unit::TestSuite("zim::ZimCreatorTest")
+    {
+      registerMethod("PushHeader", *this, &ZimCreatorTest::PushHeader);
+      registerMethod("PushFromThreads", *this, &ZimCreatorTest::PushFromThreads);
+      registerMethod("ResolveRedirects", *this, &ZimCreatorTest::ResolveRedirects);
+      registerMethod("ExternalDirents", *this, &ZimCreatorTest::ExternalDirents);
+      registerMethod("CompressionThreads", *this, &ZimCreatorTest::CompressionThreads);
+      registerMethod("IndexLast", *this, &ZimCreatorTest::IndexLast);
+      registerMethod("Deduplicate", *this, &ZimCreatorTest::Deduplicate);
+    }
+
+    void PushHeader()
+    {
+      std::string name = std::string(std::tmpnam(NULL)) + ".zim";
+
+      TestSource src(20);
+      src.pull = false;
+
+      {
+        zim::writer::ZimCreator creator;
+        creator.start(name, src);
+        for (unsigned n = 0; n < src.articles.size(); ++n)
+          creator.addArticle(src.articles[n]);
+        creator.finish();
+      }
+
+      {
+        zim::File file(name);
+        CXXTOOLS_UNIT_ASSERT_EQUALS(file.getCountArticles(), 20);
+        checkHeader(file, src);
+        checkArticles(file, src);
+      }
+
+      std::remove(name.c_str());
+    }
+
+    void PushFromThreads()
+    {
+      std::string name = std::string(std::tmpnam(NULL)) + ".zim";
+
+      TestSource src(2000);
+      src.pull = false;
+
+      {
+        zim::writer::ZimCreator creator;
+        creator.setMinChunkSize(16);
+        creator.setQueueSize(8);
+        creator.start(name, src);
+
+        std::vector<Producer*> producers;
+        for (unsigned n = 0; n < 4; ++n)
+        {
+          producers.push_back(new Producer(creator, src, n, 4));
+          producers.back()->start();
+        }
+
+        bool failed = false;
+        for (unsigned n = 0; n < producers.size(); ++n)
+        {
+          producers[n]->join();
+          failed = failed || producers[n]->failed;
+          delete producers[n];
+        }
+
+        CXXTOOLS_UNIT_ASSERT(!failed);
+
+        creator.finish();
+      }
+
+      {
+        zim::File file(name);
+        CXXTOOLS_UNIT_ASSERT_EQUALS(file.getCountArticles(), 2000);
+        checkHeader(file, src);
+        checkArticles(file, src);
+      }
+
+      std::remove(name.c_str());
+    }
+
+    void ResolveRedirects()
+    {
+      std::string name = std::string(std::tmpnam(NULL)) + ".zim";
+
+      TestSource src(20);
+      addRedirects(src);
+      create(name, src, 0);
+
+      {
+        zim::File file(name);
+        CXXTOOLS_UNIT_ASSERT_EQUALS(file.getCountArticles(), 25);
+        checkArticles(file, src);
+        checkRedirects(file);
+      }
+
+      std::remove(name.c_str());
+    }
+
+    void ExternalDirents()
+    {
+      std::string name1 = std::string(std::tmpnam(NULL)) + ".zim";
+      std::string name2 = std::string(std::tmpnam(NULL)) + ".zim";
+
+      TestSource src1(500);
+      addRedirects(src1);
+      create(name1, src1, 0);
+
+      // a budget small enough to spill the dirents to several files
+      TestSource src2(500);
+      addRedirects(src2);
+      create(name2, src2, 4096);
+
+      {
+        zim::File file1(name1);
+        zim::File file2(name2);
+        checkHeader(file2, src2);
+        checkArticles(file2, src2);
+        checkRedirects(file2);
+
+        CXXTOOLS_UNIT_ASSERT_EQUALS(file1.getCountArticles(), file2.getCountArticles());
+        for (zim::size_type idx = 0; idx < file1.getCountArticles(); ++idx)
+        {
+          zim::Dirent d1 = file1.getDirent(idx);
+          zim::Dirent d2 = file2.getDirent(idx);
+          CXXTOOLS_UNIT_ASSERT_EQUALS(d1.getLongUrl(), d2.getLongUrl());
+          CXXTOOLS_UNIT_ASSERT_EQUALS(d1.getTitle(), d2.getTitle());
+          CXXTOOLS_UNIT_ASSERT_EQUALS(d1.isRedirect(), d2.isRedirect());
+          if (d1.isRedirect())
+            CXXTOOLS_UNIT_ASSERT_EQUALS(d1.getRedirectIndex(), d2.getRedirectIndex());
+          else
+          {
+            CXXTOOLS_UNIT_ASSERT_EQUALS(d1.getMimeType(), d2.getMimeType());
+            CXXTOOLS_UNIT_ASSERT_EQUALS(d1.getClusterNumber(), d2.getClusterNumber());
+            CXXTOOLS_UNIT_ASSERT_EQUALS(d1.getBlobNumber(), d2.getBlobNumber());
+          }
+
+          CXXTOOLS_UNIT_ASSERT_EQUALS(file1.getDirentByTitle(idx).getLongUrl(),
+                                      file2.getDirentByTitle(idx).getLongUrl());
+        }
+      }
+
+      std::remove(name1.c_str());
+      std::remove(name2.c_str());
+    }
+
+    static std::string readFile(const std::string& name)
+    {
+      std::ifstream in(name.c_str(), std::ios::binary);
+      std::ostringstream data;
+      data << in.rdbuf();
+      return data.str();
+    }
+
+    void CompressionThreads()
+    {
+      std::string name1 = std::string(std::tmpnam(NULL)) + ".zim";
+      std::string name2 = std::string(std::tmpnam(NULL)) + ".zim";
+
+      TestSource src1(1000);
+      addRedirects(src1);
+      create(name1, src1, 0);
+
+      TestSource src2(1000);
+      src2.uuid = src1.uuid;
+      addRedirects(src2);
+
+      {
+        zim::writer::ZimCreator creator;
+        creator.setMinChunkSize(16);
+        creator.setCompressionThreads(4);
+        creator.create(name2, src2);
+      }
+
+      {
+        zim::File file(name2);
+        checkHeader(file, src2);
+        checkArticles(file, src2);
+        checkRedirects(file);
+      }
+
+      // the threads do not change the output
+      CXXTOOLS_UNIT_ASSERT(readFile(name1) == readFile(name2));
+
+      std::remove(name1.c_str());
+      std::remove(name2.c_str());
+    }
+
+    void IndexLast()
+    {
+      std::string name = std::string(std::tmpnam(NULL)) + ".zim";
+
+      TestSource src(500);
+      addRedirects(src);
+
+      {
+        zim::writer::ZimCreator creator;
+        creator.setMinChunkSize(16);
+        creator.setIndexLast(true);
+        creator.create(name, src);
+      }
+
+      for (unsigned mapped = 0; mapped < 2; ++mapped)
+      {
+        zim::File file(name, mapped != 0);
+        // the index follows the clusters
+        CXXTOOLS_UNIT_ASSERT(file.getFileheader().getMimeListPos() > file.getClusterOffset(0));
+        checkHeader(file, src);
+        checkArticles(file, src);
+        checkRedirects(file);
+      }
+
+      std::remove(name.c_str());
+    }
+
+    void Deduplicate()
+    {
+      std::string name = std::string(std::tmpnam(NULL)) + ".zim";
+
+      TestSource src(100);
+      addRedirects(src);
+      // copies of a compressed and an uncompressed article
+      for (unsigned n = 0; n < 5; ++n)
+      {
+        std::ostringstream aid;
+        aid << 'd' << n;
+        src.add(aid.str() + "t", src.articles[3].data);
+        src.add(aid.str() + "i", src.articles[10].data, "image/png");
+      }
+
+      {
+        zim::writer::ZimCreator creator;
+        creator.setMinChunkSize(16);
+        creator.setDeduplicate(true);
+        creator.create(name, src);
+      }
+
+      {
+        zim::File file(name);
+        checkHeader(file, src);
+        checkArticles(file, src);
+        checkRedirects(file);
+
+        zim::Dirent t = file.getArticle('A', "a3").getDirent();
+        zim::Dirent i = file.getArticle('A', "a10").getDirent();
+        for (unsigned n = 0; n < 5; ++n)
+        {
+          std::ostringstream aid;
+          aid << 'd' << n;
+          zim::Dirent dt = file.getArticle('A', aid.str() + "t").getDirent();
+          CXXTOOLS_UNIT_ASSERT_EQUALS(dt.getClusterNumber(), t.getClusterNumber());
+          CXXTOOLS_UNIT_ASSERT_EQUALS(dt.getBlobNumber(), t.getBlobNumber());
+          zim::Dirent di = file.getArticle('A', aid.str() + "i").getDirent();
+          CXXTOOLS_UNIT_ASSERT_EQUALS(di.getClusterNumber(), i.getClusterNumber());
+          CXXTOOLS_UNIT_ASSERT_EQUALS(di.getBlobNumber(), i.getBlobNumber());
+        }
+      }
+
+      std::remove(name.c_str());
+    }
+};
+
+cxxtools::unit::RegisterTest<ZimCreatorTest> register_ZimCreatorTest;
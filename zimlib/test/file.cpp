@@ -0,0 +1,534 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <zim/writer/zimcreator.h>
+#include <zim/file.h>
+#include <zim/article.h>
+#include <zim/blob.h>
+#include <zim/dirent.h>
+#include <zim/thread.h>
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <cstdio>
+#include <unistd.h>
+
+#include <cxxtools/unit/testsuite.h>
+#include <cxxtools/unit/registertest.h>
+
+namespace
+{
+  class TestArticle : public zim::writer::Article
+  {
+    public:
+      std::string aid;
+      std::string data;
+      std::string mimeType;
+      std::string redirectAid;
+
+      std::string getAid() const            { return aid; }
+      char getNamespace() const             { return 'A'; }
+      std::string getUrl() const            { return aid; }
+      std::string getTitle() const          { return aid; }
+      bool isRedirect() const               { return !redirectAid.empty(); }
+      std::string getRedirectAid() const    { return redirectAid; }
+      std::string getMimeType() const       { return mimeType; }
+      zim::Blob getData() const             { return zim::Blob(data.data(), data.size()); }
+  };
+
+  // Articles a0 ... a<count-1> with different data and a redirect r0 to
+  // a0; every fifth article is an image, so that there are compressed
+  // and uncompressed clusters.
+  class TestSource : public zim::writer::ArticleSource
+  {
+      unsigned next;
+
+    public:
+      std::vector<TestArticle> articles;
+
+      explicit TestSource(unsigned count)
+        : next(0)
+      {
+        for (unsigned n = 0; n < count; ++n)
+        {
+          TestArticle article;
+          std::ostringstream aid;
+          aid << 'a' << n;
+          article.aid = aid.str();
+          for (unsigned k = 0; k < 100 + n % 500; ++k)
+            article.data += char('a' + (n + k * k) % 26);
+          article.mimeType = n % 5 == 0 ? "image/png" : "text/html";
+          articles.push_back(article);
+        }
+
+        TestArticle redirect;
+        redirect.aid = "r0";
+        redirect.mimeType = "text/html";
+        redirect.redirectAid = "a0";
+        articles.push_back(redirect);
+      }
+
+      const zim::writer::Article* getNextArticle()
+      {
+        return next < articles.size() ? &articles[next++] : 0;
+      }
+  };
+
+  // records the visited articles
+  class Recorder : public zim::ArticleVisitor
+  {
+    public:
+      std::vector<zim::size_type> indexes;
+      std::vector<std::string> data;
+      std::vector<zim::size_type> clusters;
+
+      void visit(const zim::Article& article, const zim::Blob& blob)
+      {
+        indexes.push_back(article.getIndex());
+        data.push_back(std::string(blob.data(), blob.size()));
+        clusters.push_back(article.getDirent().getClusterNumber());
+      }
+  };
+
+  // waits in the first visit, until the scan has read clusters ahead
+  class PrefetchWatcher : public Recorder
+  {
+      zim::File& file;
+
+    public:
+      bool sawPrefetch;
+
+      explicit PrefetchWatcher(zim::File& file_)
+        : file(file_),
+          sawPrefetch(false)
+        { }
+
+      void visit(const zim::Article& article, const zim::Blob& blob)
+      {
+        if (indexes.empty())
+        {
+          for (unsigned n = 0; n < 500 && !sawPrefetch; ++n)
+          {
+            sawPrefetch = file.getPrefetchedClusters() >= 2;
+            if (!sawPrefetch)
+              ::usleep(10000);
+          }
+        }
+
+        Recorder::visit(article, blob);
+      }
+  };
+
+  // reads the articles of src by url and by index starting at an offset
+  // and counts wrong data
+  class ArticleReader : public zim::Thread
+  {
+      zim::File file;
+      const TestSource& src;
+      unsigned offset;
+
+    protected:
+      void run()
+      {
+        for (unsigned n = 0; n < src.articles.size(); ++n)
+        {
+          const TestArticle& a = src.articles[(n + offset) % src.articles.size()];
+          if (a.isRedirect())
+            continue;
+
+          try
+          {
+            zim::Article article = file.getArticle('A', a.aid);
+            zim::Blob data = article.getData();
+            if (!article.good() || std::string(data.data(), data.size()) != a.data)
+              ++errors;
+
+            data = file.getArticle(article.getIndex()).getData();
+            if (std::string(data.data(), data.size()) != a.data)
+              ++errors;
+          }
+          catch (const std::exception&)
+          {
+            ++errors;
+          }
+        }
+      }
+
+    public:
+      unsigned errors;
+
+      ArticleReader(const zim::File& file_, const TestSource& src_, unsigned offset_)
+        : file(file_),
+          src(src_),
+          offset(offset_),
+          errors(0)
+        { }
+  };
+
+  // reads one cluster
+  class ClusterReader : public zim::Thread
+  {
+      const zim::File& file;
+      zim::size_type idx;
+
+    protected:
+      void run()
+      {
+        try
+        {
+          cluster = file.getCluster(idx);
+        }
+        catch (const std::exception&)
+        {
+          failed = true;
+        }
+      }
+
+    public:
+      zim::Cluster cluster;
+      bool failed;
+
+      ClusterReader(const zim::File& file_, zim::size_type idx_)
+        : file(file_),
+          idx(idx_),
+          failed(false)
+        { }
+  };
+
+  // changes the cache size until stopped
+  class CacheShrinker : public zim::Thread
+  {
+      zim::File& file;
+
+    protected:
+      void run()
+      {
+        for (unsigned n = 0; !stopped; ++n)
+          file.setClusterCacheSize(n % 2 ? 0 : 4096);
+      }
+
+    public:
+      volatile bool stopped;
+
+      explicit CacheShrinker(zim::File& file_)
+        : file(file_),
+          stopped(false)
+        { }
+  };
+}
+
+class FileTest : public cxxtools::unit::TestSuite
+{
+    std::string name;
+    TestSource src;
+    // expected data by article index; empty for the redirect
+    std::vector<std::string> expected;
+
+    void create()
+    {
+      if (!name.empty())
+        return;
+
+      name = std::string(std::tmpnam(NULL)) + ".zim";
+
+      {
+        zim::writer::ZimCreator creator;
+        creator.setMinChunkSize(4);
+        creator.create(name, src);
+      }
+
+      zim::File file(name);
+      expected.resize(file.getCountArticles());
+      for (unsigned n = 0; n < src.articles.size(); ++n)
+      {
+        zim::Article article = file.getArticle('A', src.articles[n].aid);
+        CXXTOOLS_UNIT_ASSERT(article.good());
+        expected[article.getIndex()] = src.articles[n].data;
+      }
+    }
+
+    // checks, that every article with data is visited exactly once
+    void checkVisited(const Recorder& recorder)
+    {
+      std::vector<unsigned> count(expected.size());
+      for (unsigned n = 0; n < recorder.indexes.size(); ++n)
+      {
+        zim::size_type idx = recorder.indexes[n];
+        CXXTOOLS_UNIT_ASSERT(idx < expected.size());
+        CXXTOOLS_UNIT_ASSERT_EQUALS(recorder.data[n], expected[idx]);
+        ++count[idx];
+      }
+
+      for (unsigned idx = 0; idx < expected.size(); ++idx)
+        CXXTOOLS_UNIT_ASSERT_EQUALS(count[idx], expected[idx].empty() ? 0u : 1u);
+    }
+
+    void checkArticles(zim::File& file)
+    {
+      for (zim::size_type idx = 0; idx < expected.size(); ++idx)
+      {
+        if (expected[idx].empty())
+          continue;
+        zim::Blob data = file.getArticle(idx).getData();
+        CXXTOOLS_UNIT_ASSERT_EQUALS(std::string(data.data(), data.size()), expected[idx]);
+      }
+    }
+
+  public:
+    FileTest()
+      : cxxtools::unit::TestSuite("zim::FileTest"),
+        src(600)
+    {
+      registerMethod("ConcurrentReaders", *this, &FileTest::ConcurrentReaders);
+      registerMethod("GetArticleData", *this, &FileTest::GetArticleData);
+      registerMethod("ForEachArticleByCluster", *this, &FileTest::ForEachArticleByCluster);
+      registerMethod("ParallelForEachArticle", *this, &FileTest::ParallelForEachArticle);
+      registerMethod("Prefetch", *this, &FileTest::Prefetch);
+      registerMethod("Readahead", *this, &FileTest::Readahead);
+      registerMethod("ReadaheadScan", *this, &FileTest::ReadaheadScan);
+      registerMethod("ShrinkCacheWhilePrefetching", *this, &FileTest::ShrinkCacheWhilePrefetching);
+      registerMethod("HugeCacheSize", *this, &FileTest::HugeCacheSize);
+      registerMethod("ConcurrentMisses", *this, &FileTest::ConcurrentMisses);
+    }
+
+    ~FileTest()
+    {
+      if (!name.empty())
+        std::remove(name.c_str());
+    }
+
+    void ConcurrentReaders()
+    {
+      create();
+
+      for (unsigned mapped = 0; mapped < 2; ++mapped)
+      {
+        zim::File file(name, mapped != 0);
+
+        std::vector<ArticleReader*> readers;
+        for (unsigned n = 0; n < 8; ++n)
+          readers.push_back(new ArticleReader(file, src, n * 75));
+        for (unsigned n = 0; n < readers.size(); ++n)
+          readers[n]->start();
+        for (unsigned n = 0; n < readers.size(); ++n)
+          readers[n]->join();
+
+        unsigned errors = 0;
+        for (unsigned n = 0; n < readers.size(); ++n)
+        {
+          errors += readers[n]->errors;
+          delete readers[n];
+        }
+
+        CXXTOOLS_UNIT_ASSERT_EQUALS(errors, 0);
+      }
+    }
+
+    void GetArticleData()
+    {
+      create();
+      zim::File file(name);
+      file.setClusterCacheSize(0);
+
+      // all articles backwards and some twice
+      std::vector<zim::size_type> idx;
+      for (zim::size_type n = expected.size(); n > 0; --n)
+        idx.push_back(n - 1);
+      for (zim::size_type n = 0; n < expected.size(); n += 7)
+        idx.push_back(n);
+
+      std::vector<zim::Blob> data = file.getArticleData(idx);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(data.size(), idx.size());
+      for (unsigned n = 0; n < idx.size(); ++n)
+        CXXTOOLS_UNIT_ASSERT_EQUALS(std::string(data[n].data(), data[n].size()), expected[idx[n]]);
+    }
+
+    void ForEachArticleByCluster()
+    {
+      create();
+      zim::File file(name);
+
+      Recorder recorder;
+      file.forEachArticleByCluster(recorder);
+      checkVisited(recorder);
+
+      for (unsigned n = 1; n < recorder.clusters.size(); ++n)
+        CXXTOOLS_UNIT_ASSERT(recorder.clusters[n - 1] <= recorder.clusters[n]);
+
+      // the scan does not fill the cache
+      CXXTOOLS_UNIT_ASSERT_EQUALS(file.getClusterCacheUsage(), 0);
+    }
+
+    void ParallelForEachArticle()
+    {
+      create();
+      zim::File file(name);
+
+      std::vector<Recorder> recorders(4);
+      std::vector<zim::ArticleVisitor*> visitors;
+      for (unsigned n = 0; n < recorders.size(); ++n)
+        visitors.push_back(&recorders[n]);
+
+      file.parallelForEachArticle(visitors);
+
+      Recorder all;
+      for (unsigned n = 0; n < recorders.size(); ++n)
+      {
+        all.indexes.insert(all.indexes.end(), recorders[n].indexes.begin(), recorders[n].indexes.end());
+        all.data.insert(all.data.end(), recorders[n].data.begin(), recorders[n].data.end());
+      }
+
+      checkVisited(all);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(file.getClusterCacheUsage(), 0);
+    }
+
+    void Prefetch()
+    {
+      create();
+      zim::File file(name);
+
+      for (zim::size_type n = 0; n < file.getCountClusters(); ++n)
+        file.prefetch(n);
+      // out of range hints are ignored
+      file.prefetch(file.getCountClusters());
+
+      checkArticles(file);
+    }
+
+    void Readahead()
+    {
+      create();
+      zim::File file(name);
+      file.setReadahead(4);
+
+      Recorder recorder;
+      for (zim::size_type n = 0; n < file.getCountArticles(); ++n)
+      {
+        zim::Article article = file.getArticle(n);
+        if (!article.isRedirect())
+          recorder.visit(article, article.getData());
+      }
+
+      checkVisited(recorder);
+    }
+
+    void ReadaheadScan()
+    {
+      create();
+      zim::File file(name);
+      file.setReadahead(4);
+
+      PrefetchWatcher watcher(file);
+      file.forEachArticleByCluster(watcher);
+      checkVisited(watcher);
+
+      // the next clusters were read, while the first one was visited
+      CXXTOOLS_UNIT_ASSERT(watcher.sawPrefetch);
+      CXXTOOLS_UNIT_ASSERT(file.getPrefetchedClusters() >= file.getCountClusters() - 1);
+      CXXTOOLS_UNIT_ASSERT_EQUALS(file.getClusterCacheUsage(), 0);
+    }
+
+    void ShrinkCacheWhilePrefetching()
+    {
+      create();
+      zim::File file(name);
+      file.setReadahead(8);
+
+      CacheShrinker shrinker(file);
+      shrinker.start();
+
+      try
+      {
+        for (unsigned round = 0; round < 3; ++round)
+        {
+          for (zim::size_type n = 0; n < file.getCountClusters(); ++n)
+            file.prefetch(n);
+          checkArticles(file);
+        }
+      }
+      catch (...)
+      {
+        shrinker.stopped = true;
+        shrinker.join();
+        throw;
+      }
+
+      shrinker.stopped = true;
+      shrinker.join();
+
+      file.setClusterCacheSize(0);
+      checkArticles(file);
+    }
+
+    void HugeCacheSize()
+    {
+      create();
+      zim::File file(name);
+
+      // clamped instead of wrapped around
+      file.setClusterCacheSize(std::numeric_limits<zim::offset_type>::max());
+      CXXTOOLS_UNIT_ASSERT(file.getClusterCacheSize() >= std::numeric_limits<std::size_t>::max() / 2);
+
+      checkArticles(file);
+      CXXTOOLS_UNIT_ASSERT(file.getClusterCacheUsage() > 0);
+    }
+
+    void ConcurrentMisses()
+    {
+      create();
+      zim::File file(name);
+
+      for (zim::size_type idx = 0; idx < file.getCountClusters(); ++idx)
+      {
+        zim::size_type reads = file.getClusterReads();
+
+        std::vector<ClusterReader*> readers;
+        for (unsigned n = 0; n < 8; ++n)
+          readers.push_back(new ClusterReader(file, idx));
+        for (unsigned n = 0; n < readers.size(); ++n)
+          readers[n]->start();
+        for (unsigned n = 0; n < readers.size(); ++n)
+          readers[n]->join();
+
+        bool failed = false;
+        bool shared = true;
+        for (unsigned n = 0; n < readers.size(); ++n)
+        {
+          failed = failed || readers[n]->failed;
+          shared = shared && readers[n]->cluster.getBlobPtr(0) == readers[0]->cluster.getBlobPtr(0);
+        }
+        bool compressed = readers[0]->cluster.isCompressed();
+
+        for (unsigned n = 0; n < readers.size(); ++n)
+          delete readers[n];
+
+        CXXTOOLS_UNIT_ASSERT(!failed);
+
+        // compressed clusters are read once and shared; uncompressed
+        // ones are not cached
+        if (compressed)
+        {
+          CXXTOOLS_UNIT_ASSERT_EQUALS(file.getClusterReads() - reads, 1);
+          CXXTOOLS_UNIT_ASSERT(shared);
+        }
+      }
+    }
+};
+
+cxxtools::unit::RegisterTest<FileTest> register_FileTest;
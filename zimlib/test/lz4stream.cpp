@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <zim/lz4stream.h>
+#include <zim/unlz4stream.h>
+#include <iostream>
+#include <sstream>
+
+#include <cxxtools/unit/testsuite.h>
+#include <cxxtools/unit/registertest.h>
+
+class Lz4streamTest : public cxxtools::unit::TestSuite
+{
+    std::string testtext;
+
+  public:
+    Lz4streamTest()
+      : cxxtools::unit::TestSuite("zim::Lz4streamTest")
+    {
+      registerMethod("lz4Istream", *this, &Lz4streamTest::lz4IstreamTest);
+      registerMethod("lz4Ostream", *this, &Lz4streamTest::lz4OstreamTest);
+
+      for (unsigned n = 0; n < 10240; ++n)
+        testtext += "Hello";
+    }
+
+    void lz4IstreamTest()
+    {
+      // test 
+      std::stringstream lz4target;
+      zim::Lz4Stream compressor(lz4target);
+      compressor << testtext << std::flush;
+
+      {
+        std::ostringstream msg;
+        msg << "teststring with " << testtext.size() << " bytes compressed into " << lz4target.str().size() << " bytes";
+        reportMessage(msg.str());
+      }
+
+      zim::Unlz4Stream lz4(lz4target);
+      std::ostringstream unlz4target;
+      unlz4target << lz4.rdbuf(); // lz4 is a istream here
+
+      {
+        std::ostringstream msg;
+        msg << "teststring uncompressed to " << unlz4target.str().size() << " bytes";
+        reportMessage(msg.str());
+      }
+
+      CXXTOOLS_UNIT_ASSERT_EQUALS(testtext, unlz4target.str());
+    }
+
+    void lz4OstreamTest()
+    {
+      // test 
+      std::stringstream lz4target;
+      zim::Lz4Stream compressor(lz4target);
+      compressor << testtext << std::flush;
+
+      {
+        std::ostringstream msg;
+        msg << "teststring with " << testtext.size() << " bytes compressed into " << lz4target.str().size() << " bytes";
+        reportMessage(msg.str());
+      }
+
+      std::ostringstream unlz4target;
+      zim::Unlz4Stream lz4(unlz4target); // lz4 is a ostream here
+      lz4 << lz4target.str() << std::flush;
+
+      {
+        std::ostringstream msg;
+        msg << "teststring uncompressed to " << unlz4target.str().size() << " bytes";
+        reportMessage(msg.str());
+      }
+
+      CXXTOOLS_UNIT_ASSERT_EQUALS(testtext, unlz4target.str());
+    }
+
+};
+
+cxxtools::unit::RegisterTest<Lz4streamTest> register_Lz4streamTest;
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2026 openZIM
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * is provided AS IS, WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, and
+ * NON-INFRINGEMENT.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <zim/zstdstream.h>
+#include <zim/unzstdstream.h>
+#include <iostream>
+#include <sstream>
+
+#include <cxxtools/unit/testsuite.h>
+#include <cxxtools/unit/registertest.h>
+
+class ZstdstreamTest : public cxxtools::unit::TestSuite
+{
+    std::string testtext;
+
+  public:
+    ZstdstreamTest()
+      : cxxtools::unit::TestSuite("zim::ZstdstreamTest")
+    {
+      registerMethod("zstdIstream", *this, &ZstdstreamTest::zstdIstreamTest);
+      registerMethod("zstdOstream", *this, &ZstdstreamTest::zstdOstreamTest);
+
+      for (unsigned n = 0; n < 10240; ++n)
+        testtext += "Hello";
+    }
+
+    void zstdIstreamTest()
+    {
+      // test 
+      std::stringstream zstdtarget;
+      zim::ZstdStream compressor(zstdtarget);
+      compressor << testtext << std::flush;
+
+      {
+        std::ostringstream msg;
+        msg << "teststring with " << testtext.size() << " bytes compressed into " << zstdtarget.str().size() << " bytes";
+        reportMessage(msg.str());
+      }
+
+      zim::UnzstdStream zstd(zstdtarget);
+      std::ostringstream unzstdtarget;
+      unzstdtarget << zstd.rdbuf(); // zstd is a istream here
+
+      {
+        std::ostringstream msg;
+        msg << "teststring uncompressed to " << unzstdtarget.str().size() << " bytes";
+        reportMessage(msg.str());
+      }
+
+      CXXTOOLS_UNIT_ASSERT_EQUALS(testtext, unzstdtarget.str());
+    }
+
+    void zstdOstreamTest()
+    {
+      // test 
+      std::stringstream zstdtarget;
+      zim::ZstdStream compressor(zstdtarget);
+      compressor << testtext << std::flush;
+
+      {
+        std::ostringstream msg;
+        msg << "teststring with " << testtext.size() << " bytes compressed into " << zstdtarget.str().size() << " bytes";
+        reportMessage(msg.str());
+      }
+
+      std::ostringstream unzstdtarget;
+      zim::UnzstdStream zstd(unzstdtarget); // zstd is a ostream here
+      zstd << zstdtarget.str() << std::flush;
+
+      {
+        std::ostringstream msg;
+        msg << "teststring uncompressed to " << unzstdtarget.str().size() << " bytes";
+        reportMessage(msg.str());
+      }
+
+      CXXTOOLS_UNIT_ASSERT_EQUALS(testtext, unzstdtarget.str());
+    }
+
+};
+
+cxxtools::unit::RegisterTest<ZstdstreamTest> register_ZstdstreamTest;
@@ -115,8 +115,10 @@ public class ZIMFile extends File {
 			mHeader.layoutPage = reader.readFourLittleEndianBytesValue(buffer);
 			// System.out.println(mHeader.layoutPage);
 
-			// Initialise the MIMETypeList
+			// Initialise the MIMETypeList; it follows the header, unless
+			// the file was written with the index last
 			mMIMETypeList = new ArrayList<String>();
+			reader.seek(mHeader.mimeListPos);
 			while (true) {
 				reader.read(buffer, 0, 1);
 				len = 0;
@@ -135,6 +135,8 @@ void usage() {
   std::cout << "\t-v, --verbose\t\tprint processing details on STDOUT" << std::endl;
   std::cout << "\t-h, --help\t\tprint this help" << std::endl;
   std::cout << "\t-m, --minChunkSize\tnumber of bytes per ZIM cluster (defaul: 2048)" << std::endl;
+  std::cout << "\t-j, --threads\t\tnumber of threads compressing clusters (default: 1)" << std::endl;
+  std::cout << "\t-D, --deduplicate\tstore identical files only once" << std::endl;
   std::cout << "\t-x, --inflateHtml\ttry to inflate HTML files before packing (*.html, *.htm, ...)" << std::endl;
   std::cout << "\t-u, --uniqueNamespace\tput everything in the same namespace 'A'. Might be necessary to avoid problems with dynamic/javascript data loading." << std::endl;
   std::cout << "\t-r, --redirects\t\tpath to the TSV file with the list of redirects (url, title, target_url tab separated)." << std::endl;
@@ -244,6 +246,8 @@ int main(int argc, char** argv) {
   XapianIndexer* xapianIndexer = NULL;
 #endif
   int minChunkSize = 2048;
+  int compressionThreads = 1;
+  bool deduplicate = false;
 
   /* Argument parsing */
   static struct option long_options[] = {
@@ -251,6 +255,8 @@ int main(int argc, char** argv) {
     {"verbose", no_argument, 0, 'v'},
     {"welcome", required_argument, 0, 'w'},
     {"minchunksize", required_argument, 0, 'm'},
+    {"threads", required_argument, 0, 'j'},
+    {"deduplicate", no_argument, 0, 'D'},
     {"name", required_argument, 0, 'n'},
     {"redirects", required_argument, 0, 'r'},
     {"inflateHtml", no_argument, 0, 'x'},
@@ -269,7 +275,7 @@ int main(int argc, char** argv) {
   int c;
 
   do { 
-    c = getopt_long(argc, argv, "hvixuw:m:f:t:d:c:l:p:r:", long_options, &option_index);
+    c = getopt_long(argc, argv, "hvixuDw:m:j:f:t:d:c:l:p:r:", long_options, &option_index);
     
     if (c != -1) {
       switch (c) {
@@ -304,6 +310,12 @@ int main(int argc, char** argv) {
       case 'm':
 	minChunkSize = atoi(optarg);
 	break;
+      case 'j':
+	compressionThreads = atoi(optarg);
+	break;
+      case 'D':
+	deduplicate = true;
+	break;
       case 'n':
 	name = optarg;
 	break;
@@ -415,6 +427,8 @@ int main(int argc, char** argv) {
   setenv("ZIM_LZMA_LEVEL", "9e", 1);
   try {
     zimCreator.setMinChunkSize(minChunkSize);
+    zimCreator.setCompressionThreads(compressionThreads);
+    zimCreator.setDeduplicate(deduplicate);
     zimCreator.create(zimPath, source);
   } catch (const std::exception& e) {
     std::cerr << e.what() << std::endl;